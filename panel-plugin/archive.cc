@@ -0,0 +1,363 @@
+/*  archive.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <algorithm>
+#include "archive.h"
+#include "history.h"
+
+/*
+ * The data of a block:
+ *
+ *   guint8 min[num_rows], max[num_rows]    gaps excluded
+ *   guint8 first[num_rows]                 level of the oldest tick
+ *   guint8 width[num_rows]                 of the level deltas, from 0 to LEVEL_DELTA_BITS
+ *   guint8 timestamp_width                 bits per timestamp delta of delta, from 0 to 64
+ *   bit stream, least significant bit first:
+ *     num_ticks-1 timestamp deltas of deltas, the first one from a delta of zero
+ *     for every row, num_ticks-1 level deltas
+ *
+ * The deltas are zigzag encoded, so that small negative ones take few bits
+ * as well. A row whose level does not change takes no bits. Otherwise a
+ * level delta is a 0 bit if it is zero, 01 and width bits if it fits, or
+ * 11 and LEVEL_DELTA_BITS bits: the width is chosen for the smallest size,
+ * so that a single burst does not widen all the deltas of the row.
+ */
+
+#define LEVEL_DELTA_BITS 9      /* Zigzag of -255 to 255 */
+
+static inline guint64
+zigzag (gint64 v)
+{
+    return ((guint64) v << 1) ^ (guint64) (v >> 63);
+}
+
+static inline gint64
+unzigzag (guint64 v)
+{
+    return (gint64) (v >> 1) ^ -(gint64) (v & 1);
+}
+
+static inline guint
+bit_width (guint64 v)
+{
+    return v ? 64 - __builtin_clzll (v) : 0;
+}
+
+struct BitWriter
+{
+    std::vector<guint8> &out;
+    guint64 acc = 0;
+    guint n = 0;
+
+    explicit BitWriter (std::vector<guint8> &out) : out(out) {}
+
+    void put (guint64 v, guint bits)
+    {
+        if (bits > 32)
+        {
+            put (v & 0xffffffff, 32);
+            put (v >> 32, bits - 32);
+            return;
+        }
+        acc |= (v & ((G_GUINT64_CONSTANT (1) << bits) - 1)) << n;
+        n += bits;
+        for (; n >= 8; n -= 8, acc >>= 8)
+            out.push_back (acc);
+    }
+
+    void flush ()
+    {
+        if (n)
+            out.push_back (acc);
+        acc = 0;
+        n = 0;
+    }
+};
+
+struct BitReader
+{
+    const guint8 *p, *end;
+    guint64 acc = 0;
+    guint n = 0;
+
+    BitReader (const guint8 *p, const guint8 *end) : p(p), end(end) {}
+
+    guint64 get (guint bits)
+    {
+        if (bits > 32)
+        {
+            const guint64 low = get (32);
+            return low | get (bits - 32) << 32;
+        }
+        while (n < bits)
+        {
+            acc |= (guint64) (p < end ? *p++ : 0) << n;
+            n += 8;
+        }
+        const guint64 v = acc & ((G_GUINT64_CONSTANT (1) << bits) - 1);
+        acc >>= bits;
+        n -= bits;
+        return v;
+    }
+};
+
+
+
+void
+reset_archive (HistoryArchive &archive, guint num_rows)
+{
+    archive.num_rows = num_rows;
+    archive.blocks.clear();
+    archive.blocks.shrink_to_fit();
+    archive.open_timestamps.clear();
+    archive.open_levels.clear();
+    archive.num_ticks = 0;
+    archive.num_bytes = 0;
+}
+
+/* Compresses the open block and drops the blocks past the retention */
+static void
+close_block (HistoryArchive &archive)
+{
+    const guint num_rows = archive.num_rows;
+    const guint num_ticks = archive.open_timestamps.size();
+    const gint64 *timestamps = archive.open_timestamps.data();
+    const guint8 *levels = archive.open_levels.data();
+
+    archive.blocks.emplace_back();
+    ArchiveBlock &block = archive.blocks.back();
+    block.first = timestamps[0];
+    block.last = timestamps[num_ticks - 1];
+    block.num_ticks = num_ticks;
+
+    std::vector<guint8> &data = block.data;
+    data.resize (4 * num_rows + 1);
+    guint8 *min = data.data(), *max = min + num_rows, *first = max + num_rows, *width = first + num_rows;
+    for (guint row = 0; row < num_rows; row++)
+    {
+        guint8 lo = HISTORY_GAP, hi = 0;
+        guint counts[LEVEL_DELTA_BITS + 1] = {};   /* Of the deltas by bit width */
+        for (guint t = 0; t < num_ticks; t++)
+        {
+            const guint8 level = levels[t * num_rows + row];
+            if (level != HISTORY_GAP)
+            {
+                lo = MIN (lo, level);
+                hi = MAX (hi, level);
+            }
+            if (t > 0)
+                counts[bit_width (zigzag (level - levels[(t - 1) * num_rows + row]))]++;
+        }
+        min[row] = lo;
+        max[row] = hi;
+        first[row] = levels[row];
+
+        width[row] = 0;
+        if (counts[0] != num_ticks - 1)
+        {
+            guint best = G_MAXUINT;
+            for (guint w = 1; w <= LEVEL_DELTA_BITS; w++)
+            {
+                guint bits = counts[0];
+                for (guint b = 1; b <= LEVEL_DELTA_BITS; b++)
+                    bits += counts[b] * (2 + (b <= w ? w : LEVEL_DELTA_BITS));
+                if (bits < best)
+                {
+                    best = bits;
+                    width[row] = w;
+                }
+            }
+        }
+    }
+
+    guint64 widest = 0;
+    for (guint t = 1; t < num_ticks; t++)
+        widest |= zigzag ((timestamps[t] - timestamps[t - 1]) - (t > 1 ? timestamps[t - 1] - timestamps[t - 2] : 0));
+    const guint timestamp_width = bit_width (widest);
+    data[4 * num_rows] = timestamp_width;
+
+    BitWriter bits (data);
+    gint64 prev_delta = 0;
+    for (guint t = 1; t < num_ticks; t++)
+    {
+        const gint64 d = timestamps[t] - timestamps[t - 1];
+        bits.put (zigzag (d - prev_delta), timestamp_width);
+        prev_delta = d;
+    }
+    for (guint row = 0; row < num_rows; row++)
+    {
+        const guint w = data[3 * num_rows + row];
+        if (w == 0)
+            continue;
+        for (guint t = 1; t < num_ticks; t++)
+        {
+            const guint64 delta = zigzag (levels[t * num_rows + row] - levels[(t - 1) * num_rows + row]);
+            if (delta == 0)
+                bits.put (0, 1);
+            else if (bit_width (delta) <= w)
+                bits.put (1 | delta << 2, 2 + w);
+            else
+                bits.put (3 | delta << 2, 2 + LEVEL_DELTA_BITS);
+        }
+    }
+    bits.flush ();
+    data.shrink_to_fit ();
+
+    archive.num_ticks += num_ticks;
+    archive.num_bytes += data.size();
+    archive.open_timestamps.clear();
+    archive.open_levels.clear();
+
+    while (archive.blocks.size() > 1 && block.last - archive.blocks.front().last > archive.retention)
+    {
+        archive.num_ticks -= archive.blocks.front().num_ticks;
+        archive.num_bytes -= archive.blocks.front().data.size();
+        archive.blocks.pop_front();
+    }
+}
+
+guint8 *
+archive_append (HistoryArchive &archive, gint64 timestamp)
+{
+    if (archive.open_timestamps.size() == ARCHIVE_BLOCK_TICKS)
+        close_block (archive);
+    if (archive.open_timestamps.capacity() == 0)
+    {
+        archive.open_timestamps.reserve (ARCHIVE_BLOCK_TICKS);
+        archive.open_levels.reserve (ARCHIVE_BLOCK_TICKS * (gsize) archive.num_rows);
+    }
+
+    archive.open_timestamps.push_back (timestamp);
+    archive.open_levels.resize (archive.open_levels.size() + archive.num_rows);
+    return archive.open_levels.data() + archive.open_levels.size() - archive.num_rows;
+}
+
+void
+decode_archive_block (const HistoryArchive &archive, const ArchiveBlock &block,
+                      gint64 *timestamps, guint8 *levels)
+{
+    const guint num_rows = archive.num_rows;
+    const guint num_ticks = block.num_ticks;
+    const guint8 *data = block.data.data();
+    const guint8 *first = data + 2 * num_rows, *width = first + num_rows;
+    const guint timestamp_width = data[4 * num_rows];
+
+    BitReader bits (data + 4 * num_rows + 1, data + block.data.size());
+    gint64 prev_delta = 0;
+    timestamps[0] = block.first;
+    for (guint t = 1; t < num_ticks; t++)
+    {
+        prev_delta += unzigzag (bits.get (timestamp_width));
+        timestamps[t] = timestamps[t - 1] + prev_delta;
+    }
+
+    for (guint row = 0; row < num_rows; row++)
+    {
+        const guint w = width[row];
+        guint8 level = first[row];
+        levels[row] = level;
+        for (guint t = 1; t < num_ticks; t++)
+        {
+            if (w != 0 && bits.get (1))
+                level += unzigzag (bits.get (1) ? bits.get (LEVEL_DELTA_BITS) : bits.get (w));
+            levels[t * (gsize) num_rows + row] = level;
+        }
+    }
+}
+
+void
+decode_archive (const HistoryArchive &archive, gint64 from, gint64 to,
+                const std::function<void (gint64 timestamp, const guint8 *levels)> &tick)
+{
+    std::vector<gint64> timestamps (ARCHIVE_BLOCK_TICKS);
+    std::vector<guint8> levels (ARCHIVE_BLOCK_TICKS * (gsize) archive.num_rows);
+
+    /* The blocks are sorted by time, the first one ending at or after from is found by bisection */
+    auto it = std::lower_bound (archive.blocks.begin(), archive.blocks.end(), from,
+                                [](const ArchiveBlock &block, gint64 t) { return block.last < t; });
+    for (; it != archive.blocks.end() && it->first <= to; ++it)
+    {
+        decode_archive_block (archive, *it, timestamps.data(), levels.data());
+        for (guint t = 0; t < it->num_ticks; t++)
+            if (timestamps[t] >= from && timestamps[t] <= to)
+                tick (timestamps[t], &levels[t * (gsize) archive.num_rows]);
+    }
+
+    for (gsize t = 0; t < archive.open_timestamps.size(); t++)
+        if (archive.open_timestamps[t] >= from && archive.open_timestamps[t] <= to)
+            tick (archive.open_timestamps[t], &archive.open_levels[t * archive.num_rows]);
+}
+
+bool
+archive_peak (const HistoryArchive &archive, guint row, gint64 since, guint8 &level, gint64 &timestamp)
+{
+    const guint num_rows = archive.num_rows;
+    if (row >= num_rows)
+        return false;
+
+    bool found = false;
+    const auto consider = [&](gint64 t, guint8 l) {
+        if (t >= since && l != HISTORY_GAP && (!found || l > level))
+        {
+            level = l;
+            timestamp = t;
+            found = true;
+        }
+    };
+
+    /* Newest first, so that the newest of equal peaks wins */
+    for (gsize t = archive.open_timestamps.size(); t-- > 0;)
+        consider (archive.open_timestamps[t], archive.open_levels[t * num_rows + row]);
+
+    std::vector<gint64> timestamps (ARCHIVE_BLOCK_TICKS);
+    std::vector<guint8> levels (ARCHIVE_BLOCK_TICKS * (gsize) num_rows);
+    const auto scan = [&](const ArchiveBlock &block) {
+        decode_archive_block (archive, block, timestamps.data(), levels.data());
+        for (guint t = block.num_ticks; t-- > 0;)
+            consider (timestamps[t], levels[t * (gsize) num_rows + row]);
+    };
+
+    /* Whole blocks are ranked by their maximum, only the best one and the one across since are decoded */
+    const ArchiveBlock *best = nullptr;
+    for (auto it = archive.blocks.rbegin(); it != archive.blocks.rend() && it->last >= since; ++it)
+    {
+        const guint8 max = it->max (row, num_rows);
+        if (it->first < since)
+            scan (*it);
+        else if (it->min (row) != HISTORY_GAP && (!best || max > best->max (row, num_rows)))
+            best = &*it;
+    }
+    if (best && (!found || best->max (row, num_rows) > level))
+        scan (*best);
+
+    return found;
+}
+
+gsize
+archive_bytes (const HistoryArchive &archive)
+{
+    return archive.num_bytes + archive.blocks.size() * sizeof (ArchiveBlock) +
+           archive.open_timestamps.capacity() * sizeof (gint64) + archive.open_levels.capacity();
+}
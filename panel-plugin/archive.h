@@ -0,0 +1,81 @@
+/*  archive.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_ARCHIVE_H_
+#define _XFCE_CPUWATERFALL_ARCHIVE_H_
+
+#include <glib.h>
+#include <deque>
+#include <functional>
+#include <vector>
+
+/* Ticks per compressed block */
+#define ARCHIVE_BLOCK_TICKS 256
+
+/* A block of ARCHIVE_BLOCK_TICKS ticks, or fewer at the end of a run, compressed */
+struct ArchiveBlock
+{
+    gint64 first = 0;               /* Timestamp of the oldest tick */
+    gint64 last = 0;                /* Timestamp of the newest tick */
+    guint num_ticks = 0;
+    std::vector<guint8> data;       /* See archive.cc */
+
+    /* Range of the levels of a row, gaps excluded. HISTORY_GAP and 0 if all are gaps. */
+    guint8 min (guint row) const    { return data[row]; }
+    guint8 max (guint row, guint num_rows) const    { return data[num_rows + row]; }
+};
+
+/*
+ * Append-only history of the colour levels of every tick, at full
+ * resolution, kept for retention microseconds. The ticks are appended to
+ * an open block, which is compressed once full: the timestamps as bit-packed
+ * deltas of deltas, the levels of every row as bit-packed deltas. Each block
+ * records the minimum and the maximum of every row, so that searches skip
+ * the blocks without decoding them.
+ */
+struct HistoryArchive
+{
+    guint num_rows = 0;
+    gint64 retention = 0;           /* Microseconds, zero not to keep any tick */
+    std::deque<ArchiveBlock> blocks;    /* Oldest first */
+    std::vector<gint64> open_timestamps;    /* Of the ticks of the open block */
+    std::vector<guint8> open_levels;        /* num_rows levels per tick */
+    guint64 num_ticks = 0;          /* In the blocks */
+    gsize num_bytes = 0;            /* Of the blocks */
+};
+
+/* Drops all the ticks and sets the number of rows */
+void reset_archive (HistoryArchive &archive, guint num_rows);
+
+/* Appends a tick, returning where to write its num_rows levels */
+guint8 *archive_append (HistoryArchive &archive, gint64 timestamp);
+
+/* Decodes the num_ticks timestamps and num_ticks * num_rows levels of a block, oldest first */
+void decode_archive_block (const HistoryArchive &archive, const ArchiveBlock &block,
+                           gint64 *timestamps, guint8 *levels);
+
+/* Calls tick() with the num_rows levels of every tick from `from` to `to`, oldest first */
+void decode_archive (const HistoryArchive &archive, gint64 from, gint64 to,
+                     const std::function<void (gint64 timestamp, const guint8 *levels)> &tick);
+
+/* The highest level of a row since `since` and its newest timestamp. Returns false if there is none. */
+bool archive_peak (const HistoryArchive &archive, guint row, gint64 since, guint8 &level, gint64 &timestamp);
+
+/* Bytes allocated, the open block included */
+gsize archive_bytes (const HistoryArchive &archive);
+
+#endif /* _XFCE_CPUWATERFALL_ARCHIVE_H_ */
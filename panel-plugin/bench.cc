@@ -0,0 +1,823 @@
+/*  bench.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Scaling harness, built with "make cpuwaterfall-bench".
+ *
+ * Drives the per-tick path of the plugin (sampling, history write and
+ * draw_waterfall() into an offscreen surface) with the synthetic source
+ * and reports the time per tick and the memory used by the history.
+ *
+ * With --proc-stat it instead parses a generated /proc/stat with holes
+ * in the CPU IDs and reports the time per read and the stack it used.
+ * With --loads it compares the variants of compute_loads().
+ * With --history it compares the layouts of the history.
+ * With --archive it reports the size and the decoding speed of the
+ * compressed archive, for loads with noise, bursts and idle CPUs.
+ * With --resize it times the growth and the shrinking of a full history.
+ * With --ring it publishes frames in shared memory, as the plugin does,
+ * and reports how long after the publishing reader processes got them.
+ * With --sysfs it checks the readers of sysfs against a fixture tree,
+ * fixtures/sysfs by "make check", and fails if they disagree with it.
+ *
+ * Usage: cpuwaterfall-bench [TICKS [CPUS...]]
+ *        cpuwaterfall-bench --proc-stat [TICKS [CPUS]]
+ *        cpuwaterfall-bench --loads [TICKS [CPUS...]]
+ *        cpuwaterfall-bench --history [TICKS [CPUS...]]
+ *        cpuwaterfall-bench --archive [TICKS [CPUS...]]
+ *        cpuwaterfall-bench --resize [ROUNDS [CPUS...]]
+ *        cpuwaterfall-bench --ring [FRAMES [READERS [CPUS]]]
+ *        cpuwaterfall-bench --sysfs DIR
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+#include <cairo/cairo.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <algorithm>
+#include "archive.h"
+#include "cpuwaterfall-ring.h"
+#include "draw_waterfall.h"
+#include "history.h"
+#include "loads.h"
+#include "os.h"
+#include "publisher.h"
+#include "waterfall.h"
+
+#define BENCH_HISTORY 128       /* Width of the plugin in pixels */
+#define BENCH_STACK (1 << 20)   /* Of the thread running read_cpu_data() */
+#define BENCH_RING_INTERVAL_US 1000  /* Between the frames of --ring */
+#define BENCH_CAPACITY 4096     /* Ticks in the history, as sized by resize_history() for 2048 px */
+#define STACK_FILL 0xa5
+
+
+
+static glong
+max_rss_kb ()
+{
+    struct rusage usage;
+    if (getrusage (RUSAGE_SELF, &usage) != 0)
+        return -1;
+    return usage.ru_maxrss;
+}
+
+
+
+static void
+bench (guint num_cpus, guint ticks, gint height)
+{
+    /* No widgets: install_source() and draw_waterfall() do not touch them while the mode is disabled */
+    auto base = xfce4::make<CPUWaterfall>();
+    base->mode = MODE_DISABLED;
+    base->has_average = true;
+    base->colors[BG_COLOR] = xfce4::RGBA {0, 0, 0, 1};
+    base->colors[FG_COLOR1] = xfce4::RGBA {0, 1, 0, 1};
+    base->colors[FG_COLOR2] = xfce4::RGBA {1, 0, 0, 1};
+
+    /* There is no main loop to open the source in the background */
+    Ptr0<DataSource> source = create_data_source ("synthetic", xfce4::sprintf ("cpus=%u,pattern=mixed", num_cpus));
+    install_source (base, source, source->topology ());
+    resize_history (base, BENCH_HISTORY);
+    base->mode = MODE_WATERFALL;
+
+    cairo_surface_t *target = cairo_image_surface_create (CAIRO_FORMAT_RGB24, BENCH_HISTORY, height);
+    cairo_t *cr = cairo_create (target);
+
+    gint64 sample_us = 0, draw_us = 0, max_tick_us = 0;
+    for (guint i = 0; i < ticks; i++)
+    {
+        const gint64 t0 = g_get_monotonic_time ();
+        record_sample (base);
+        const gint64 t1 = g_get_monotonic_time ();
+        draw_waterfall (base, cr, BENCH_HISTORY, height);
+        const gint64 t2 = g_get_monotonic_time ();
+
+        sample_us += t1 - t0;
+        draw_us += t2 - t1;
+        max_tick_us = MAX (max_tick_us, t2 - t0);
+    }
+
+    printf ("%6u CPUs %5dpx: sample+history %8.1f us/tick, draw %8.1f us/tick, max %6" G_GINT64_FORMAT " us,"
+            " history %7.1f MiB, max RSS %7.1f MiB\n",
+            num_cpus, height, (gdouble) sample_us / ticks, (gdouble) draw_us / ticks, max_tick_us,
+            history_bytes (base->history) / 1048576.0, max_rss_kb () / 1024.0);
+
+    cairo_destroy (cr);
+    cairo_surface_destroy (target);
+}
+
+
+
+/* Every 7th CPU ID and a block of 256 IDs in the middle are missing */
+static bool
+is_hole (guint id, guint num_ids)
+{
+    return id % 7 == 3 || (id >= num_ids / 2 && id < num_ids / 2 + 256);
+}
+
+static bool
+write_proc_stat (const std::string &path, guint num_ids, guint tick, guint offline_every)
+{
+    FILE *f = fopen (path.c_str(), "w");
+    if (!f)
+        return false;
+
+    fprintf (f, "cpu  %u 0 %u %u 0 0 0 0 0 0\n", tick * num_ids, tick * num_ids, tick * num_ids);
+    for (guint id = 0; id < num_ids; id++)
+    {
+        if (is_hole (id, num_ids) || (offline_every != 0 && id % offline_every == 0))
+            continue;
+        const guint busy = tick * (id % 100);
+        fprintf (f, "cpu%u %u 0 %u %u 0 0 0 0 0 0\n", id, busy, busy, tick * 200 - 2 * busy);
+    }
+    fputs ("intr 0\nctxt 0\n", f);
+    return fclose (f) == 0;
+}
+
+struct ProcStatRun
+{
+    CpuRows *rows;
+    gfloat *load;
+    guint ticks;
+    gint64 total_us;
+    gint64 max_us;
+};
+
+static void*
+proc_stat_thread (void *data)
+{
+    ProcStatRun *run = (ProcStatRun*) data;
+    for (guint i = 0; i < run->ticks; i++)
+    {
+        const gint64 t0 = g_get_monotonic_time ();
+        read_cpu_data (*run->rows, run->load);
+        const gint64 t = g_get_monotonic_time () - t0;
+        run->total_us += t;
+        run->max_us = MAX (run->max_us, t);
+    }
+    return NULL;
+}
+
+static void
+bench_proc_stat (guint num_ids, guint ticks)
+{
+    gchar tmpl[] = "/tmp/cpuwaterfall-stat-XXXXXX";
+    const gint fd = mkstemp (tmpl);
+    if (fd < 0)
+    {
+        perror ("mkstemp");
+        return;
+    }
+    close (fd);
+    const std::string path = tmpl;
+
+    CpuRows rows;
+    std::vector<gfloat> load;
+    if (!write_proc_stat (path, num_ids, 1, 0) || !init_cpu_rows (rows, path.c_str()))
+    {
+        fprintf (stderr, "cannot parse %s\n", path.c_str());
+        unlink (path.c_str());
+        return;
+    }
+    load.resize (rows.size());
+    read_cpu_data (rows, load.data());
+
+    /* Take a few more CPUs offline, their rows have to stay */
+    write_proc_stat (path, num_ids, 2, 64);
+
+    /* The reads run on a thread with a stack of known content to find out how much of it they touch */
+    std::vector<guint8> stack (BENCH_STACK, STACK_FILL);
+    ProcStatRun run = {&rows, load.data(), ticks, 0, 0};
+    pthread_attr_t attr;
+    pthread_t thread;
+    pthread_attr_init (&attr);
+    pthread_attr_setstack (&attr, stack.data(), stack.size());
+    if (pthread_create (&thread, &attr, proc_stat_thread, &run) != 0)
+    {
+        fprintf (stderr, "cannot create the benchmark thread\n");
+        pthread_attr_destroy (&attr);
+        unlink (path.c_str());
+        return;
+    }
+    pthread_join (thread, NULL);
+    pthread_attr_destroy (&attr);
+
+    /* CPU load = 0.01 * (ID % 100) */
+    write_proc_stat (path, num_ids, 3, 64);
+    read_cpu_data (rows, load.data());
+    unlink (path.c_str());
+
+    size_t untouched = 0;
+    while (untouched < stack.size() && stack[untouched] == STACK_FILL)
+        untouched++;
+
+    guint offline = 0, wrong = 0;
+    for (guint row = 1; row < rows.size(); row++)
+    {
+        const guint id = rows.ids[row-1];
+        const gfloat expected = rows.is_offline (id) ? 0 : 0.01f * (id % 100);
+        offline += rows.is_offline (id);
+        wrong += fabsf (load[row] - expected) > 1e-4f;
+    }
+
+    printf ("%6u CPU IDs: %u rows, %u offline, read %8.1f us, max %6" G_GINT64_FORMAT " us, stack %5.1f KiB,"
+            " %u wrong loads\n",
+            num_ids, rows.size() - 1, offline, (gdouble) run.total_us / ticks, run.max_us,
+            (stack.size() - untouched) / 1024.0, wrong);
+}
+
+
+
+/*
+ * Runs a kernel over counters advancing by a few hundred jiffies per tick, returns ns per CPU.
+ * A few CPUs count more used than total ticks, as when iowait goes backwards, one of
+ * them by more than the 14 bits of encode_ticks(), so the kernels must clamp alike.
+ */
+static gdouble
+time_loads (LoadsKernel kernel, guint num_cpus, guint ticks, std::vector<gfloat> &load, std::vector<guint32> &deltas)
+{
+    std::vector<guint64> used (num_cpus), total (num_cpus), previous_used (num_cpus), previous_total (num_cpus);
+    for (guint i = 0; i < num_cpus; i++)
+    {
+        previous_used[i] = used[i] = 1000000 + 7 * i;
+        previous_total[i] = total[i] = 4000000 + 11 * i;
+    }
+    load.assign (num_cpus, 0);
+    deltas.assign (num_cpus, 0);
+
+    gint64 elapsed_ns = 0;
+    for (guint tick = 0; tick < ticks; tick++)
+    {
+        for (guint i = 0; i < num_cpus; i++)
+        {
+            const guint busy = (i * 37 + tick * 13) % 101;
+            used[i] += i % 64 == 5 ? 120 + busy : i % 64 == 9 ? 20000 : busy;
+            total[i] += 100 + (i & 1);
+        }
+        struct timespec t0, t1;
+        clock_gettime (CLOCK_MONOTONIC, &t0);
+        kernel (used.data(), total.data(), previous_used.data(), previous_total.data(), load.data(), deltas.data(), num_cpus);
+        clock_gettime (CLOCK_MONOTONIC, &t1);
+        elapsed_ns += (t1.tv_sec - t0.tv_sec) * (gint64) 1000000000 + (t1.tv_nsec - t0.tv_nsec);
+    }
+    return (gdouble) elapsed_ns / ticks / num_cpus;
+}
+
+static void
+bench_loads (guint num_cpus, guint ticks)
+{
+    std::vector<gfloat> scalar_load, avx2_load;
+    std::vector<guint32> scalar_deltas, avx2_deltas;
+    const gdouble scalar_ns = time_loads (compute_loads_scalar, num_cpus, ticks, scalar_load, scalar_deltas);
+    printf ("%6u CPUs: scalar %6.2f ns/CPU", num_cpus, scalar_ns);
+
+    const LoadsKernel avx2 = loads_kernel_avx2 ();
+    if (avx2)
+    {
+        const gdouble avx2_ns = time_loads (avx2, num_cpus, ticks, avx2_load, avx2_deltas);
+        guint wrong = 0;
+        for (guint i = 0; i < num_cpus; i++)
+            wrong += fabsf (scalar_load[i] - avx2_load[i]) > 1e-6f || scalar_deltas[i] != avx2_deltas[i];
+        printf (", avx2 %6.2f ns/CPU (%.1fx), %u differences", avx2_ns, scalar_ns / avx2_ns, wrong);
+    }
+    else
+        printf (", avx2 not available");
+    printf ("\n");
+}
+
+
+
+/* The layout History replaced: a ring of packed loads per row */
+struct RowLoad
+{
+    gint64 timestamp;
+    guint32 ticks;
+} __attribute__((packed));
+
+/* Per tick: writes a frame, then reads the colour levels of the newest column as draw_waterfall() does */
+static void
+bench_history (guint num_cpus, guint ticks)
+{
+    const guint num_rows = num_cpus + 1;
+    const gssize mask = BENCH_CAPACITY - 1;
+    std::vector<guint32> frame (num_rows);
+
+    std::vector<RowLoad*> rings (num_rows);
+    for (RowLoad *&ring : rings)
+        ring = g_new0 (RowLoad, BENCH_CAPACITY);
+    gssize offset = 0;
+    guint64 rings_levels = 0;
+
+    gint64 t0 = g_get_monotonic_time ();
+    for (guint tick = 0; tick < ticks; tick++)
+    {
+        for (guint row = 0; row < num_rows; row++)
+            frame[row] = encode_ticks ((row + tick) % 101, 100);
+        const gint64 timestamp = g_get_real_time ();
+        offset = (offset - 1) & mask;
+        for (guint row = 0; row < num_rows; row++)
+        {
+            rings[row][offset].timestamp = timestamp;
+            rings[row][offset].ticks = frame[row];
+        }
+        for (guint row = 0; row < num_rows; row++)
+            rings_levels += History::quantize_ticks (rings[row][offset].ticks, HISTORY_GAP);
+    }
+    const gdouble rings_us = (gdouble) (g_get_monotonic_time () - t0) / ticks;
+    const gdouble rings_mib = num_rows * BENCH_CAPACITY * sizeof (RowLoad) / 1048576.0;
+    for (RowLoad *ring : rings)
+        g_free (ring);
+
+    printf ("%6u CPUs: per-row rings %8.2f us/tick %7.1f MiB\n", num_cpus, rings_us, rings_mib);
+
+    static const struct { HistoryFormat format; const gchar *name; } formats[] = {
+        {HISTORY_TICKS, "ticks"}, {HISTORY_16BIT, "16-bit"}, {HISTORY_8BIT, "8-bit"},
+    };
+    for (const auto &f : formats)
+    {
+        History history;
+        reallocate_history (history, f.format, num_rows, BENCH_CAPACITY);
+        guint64 levels = 0;
+
+        t0 = g_get_monotonic_time ();
+        for (guint tick = 0; tick < ticks; tick++)
+        {
+            for (guint row = 0; row < num_rows; row++)
+                frame[row] = encode_ticks ((row + tick) % 101, 100);
+            record_history (history, g_get_real_time (), frame.data());
+            const guint8 *column = history.frame (0);
+            for (guint row = 0; row < num_rows; row++)
+                levels += history.level (column, row);
+        }
+        const gdouble arena_us = (gdouble) (g_get_monotonic_time () - t0) / ticks;
+        const gdouble arena_mib = history_bytes (history) / 1048576.0;
+
+        printf ("%6u CPUs: %6s arena    %8.2f us/tick %7.1f MiB (%.1fx faster, %.1fx smaller)%s\n",
+                num_cpus, f.name, arena_us, arena_mib, rings_us / arena_us, rings_mib / arena_mib,
+                f.format == HISTORY_TICKS && levels != rings_levels ? ", MISMATCH" : "");
+    }
+}
+
+
+
+/* Levels of a tick: a quarter of the CPUs idle, the others a noisy random walk with bursts to full load */
+static void
+archive_loads (std::vector<gint> &walk, guint32 &seed, guint8 *levels)
+{
+    const guint num_rows = walk.size();
+    const auto next = [&seed]() {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        return seed;
+    };
+
+    guint sum = 0;
+    for (guint row = 1; row < num_rows; row++)
+    {
+        if (row % 4 == 0)
+            walk[row] = 0;
+        else if (next () % 200 == 0)
+            walk[row] = next () % 2 ? HISTORY_GAP - 1 : next () % 32;
+        else
+            walk[row] = CLAMP (walk[row] + (gint) (next () % 9) - 4, 0, HISTORY_GAP - 1);
+        levels[row] = walk[row];
+        sum += walk[row];
+    }
+    levels[0] = num_rows > 1 ? sum / (num_rows - 1) : 0;
+}
+
+static void
+bench_archive (guint num_cpus, guint ticks)
+{
+    const guint num_rows = num_cpus + 1;
+    std::vector<gint> walk (num_rows, 0);
+    std::vector<guint8> reference ((gsize) ticks * num_rows);
+    guint32 seed = 2463534242u;
+
+    HistoryArchive archive;
+    reset_archive (archive, num_rows);
+    archive.retention = G_MAXINT64;
+
+    /* Ticks of 200 ms with up to 2 ms of jitter */
+    const gint64 start = g_get_real_time ();
+    gint64 timestamp = start;
+    gint64 t0 = g_get_monotonic_time ();
+    for (guint tick = 0; tick < ticks; tick++)
+    {
+        archive_loads (walk, seed, &reference[(gsize) tick * num_rows]);
+        timestamp += 200000 + seed % 2000;
+        memcpy (archive_append (archive, timestamp), &reference[(gsize) tick * num_rows], num_rows);
+    }
+    const gdouble encode_us = (gdouble) (g_get_monotonic_time () - t0) / ticks;
+
+    guint64 decoded = 0, mismatches = 0;
+    t0 = g_get_monotonic_time ();
+    decode_archive (archive, G_MININT64, G_MAXINT64, [&](gint64, const guint8 *levels) {
+        if (memcmp (levels, &reference[decoded * num_rows], num_rows) != 0)
+            mismatches++;
+        decoded++;
+    });
+    const gdouble decode_s = (g_get_monotonic_time () - t0) / 1e6;
+
+    t0 = g_get_monotonic_time ();
+    guint peaks = 0;
+    for (guint row = 0; row < num_rows; row++)
+    {
+        guint8 level;
+        gint64 when;
+        peaks += archive_peak (archive, row, start, level, when);
+    }
+    const gdouble peak_us = (gdouble) (g_get_monotonic_time () - t0) / num_rows;
+
+    const gdouble samples = (gdouble) ticks * num_rows;
+    const gdouble raw_bytes = ticks * (sizeof (gint64) + (gdouble) num_rows);
+    printf ("%6u CPUs: %.2f bits/sample (%.1fx smaller than 8-bit), %.1f MiB, encode %.2f us/tick,"
+            " decode %.0f Msamples/s, peak %.1f us/row%s\n",
+            num_cpus, archive_bytes (archive) * 8 / samples, raw_bytes / archive_bytes (archive),
+            archive_bytes (archive) / 1048576.0, encode_us, samples / decode_s / 1e6, peak_us,
+            decoded != ticks || mismatches || peaks != num_rows ? ", MISMATCH" : "");
+}
+
+
+
+/* Grows a full history from BENCH_CAPACITY to twice that and back: by copying it, then in place */
+static void
+bench_resize (guint num_cpus, guint rounds)
+{
+    const guint num_rows = num_cpus + 1;
+    std::vector<guint32> frame (num_rows);
+    History history;
+    reallocate_history (history, HISTORY_TICKS, num_rows, BENCH_CAPACITY);
+
+    /* A third of the ticks wrap around the end of the ring */
+    for (guint tick = 0; tick < BENCH_CAPACITY + BENCH_CAPACITY / 3; tick++)
+    {
+        for (guint row = 0; row < num_rows; row++)
+            frame[row] = encode_ticks ((row + tick) % 101, 100);
+        record_history (history, tick + 1, frame.data());
+    }
+    const gint64 newest = history.timestamp (0);
+
+    gint64 copy_us = 0, grow_us = 0, shrink_us = 0;
+    for (guint round = 0; round < rounds; round++)
+    {
+        gint64 t0 = g_get_monotonic_time ();
+        reallocate_history (history, HISTORY_TICKS, num_rows, 2 * BENCH_CAPACITY);
+        copy_us += g_get_monotonic_time () - t0;
+        set_history_capacity (history, BENCH_CAPACITY);
+
+        t0 = g_get_monotonic_time ();
+        set_history_capacity (history, 2 * BENCH_CAPACITY);
+        grow_us += g_get_monotonic_time () - t0;
+
+        t0 = g_get_monotonic_time ();
+        set_history_capacity (history, BENCH_CAPACITY);
+        shrink_us += g_get_monotonic_time () - t0;
+
+        /* Shift the wrap point for the next round */
+        record_history (history, newest + round + 1, frame.data());
+    }
+
+    const bool kept = history.timestamp (0) == newest + rounds &&
+                      history.timestamp (BENCH_CAPACITY - 1) == newest + rounds - (BENCH_CAPACITY - 1);
+    printf ("%6u CPUs, %.1f MiB: copying growth %8.1f us, in place growth %8.1f us, shrink %8.1f us%s\n",
+            num_cpus, history_bytes (history) / 1048576.0, (gdouble) copy_us / rounds,
+            (gdouble) grow_us / rounds, (gdouble) shrink_us / rounds, kept ? "" : ", MISMATCH");
+}
+
+
+
+/* Latencies of a reader of the ring, in microseconds */
+struct RingReaderResult
+{
+    guint64 frames;
+    guint64 missed;
+    gint64 p50, p99, max;
+};
+
+/* Runs in a child process: reads every frame of the ring until it is closed */
+static RingReaderResult
+read_ring (const std::string &name, gint ready_fd)
+{
+    RingReaderResult result = RingReaderResult();
+    size_t size;
+    const void *ring = cwf_ring_open (name.c_str(), &size);
+    const gchar ready = ring != nullptr;
+    if (write (ready_fd, &ready, 1) != 1 || !ring)
+        return result;
+
+    const struct cwf_ring_header *h = (const struct cwf_ring_header*) ring;
+    std::vector<guint8> copy (h->slot_size);
+    std::vector<gint64> latencies;
+    guint64 n = cwf_ring_head (ring);
+    while (cwf_ring_wait (ring, n, 1000))
+    {
+        if (cwf_ring_read (ring, n, copy.data()))
+        {
+            const gint64 latency = g_get_real_time () - ((const struct cwf_ring_slot*) copy.data())->timestamp_us;
+            latencies.push_back (latency);
+        }
+        else
+            result.missed++;
+        n++;
+    }
+    cwf_ring_close (ring, size);
+
+    std::sort (latencies.begin(), latencies.end());
+    result.frames = latencies.size();
+    if (!latencies.empty())
+    {
+        result.p50 = latencies[latencies.size() / 2];
+        result.p99 = latencies[latencies.size() * 99 / 100];
+        result.max = latencies.back();
+    }
+    return result;
+}
+
+/* Publishes frames of the synthetic source, one every BENCH_RING_INTERVAL_US, to reader processes */
+static void
+bench_ring (guint num_cpus, guint num_readers, guint frames)
+{
+    Ptr0<DataSource> source = create_data_source ("synthetic", xfce4::sprintf ("cpus=%u,pattern=mixed", num_cpus));
+    RingPublisher publisher;
+    publisher.name = xfce4::sprintf ("/cpuwaterfall-bench-%d", (gint) getpid ());
+    publish_ring (publisher, *source);
+    if (!publisher.ring)
+        return;
+
+    std::vector<pid_t> pids;
+    std::vector<gint> result_fds;
+    gint ready_pipe[2];
+    if (pipe (ready_pipe) != 0)
+        return;
+    for (guint i = 0; i < num_readers; i++)
+    {
+        gint result_pipe[2];
+        if (pipe (result_pipe) != 0)
+            break;
+        const pid_t pid = fork ();
+        if (pid == 0)
+        {
+            const RingReaderResult result = read_ring (publisher.name, ready_pipe[1]);
+            _exit (write (result_pipe[1], &result, sizeof (result)) == sizeof (result) ? 0 : 1);
+        }
+        close (result_pipe[1]);
+        pids.push_back (pid);
+        result_fds.push_back (result_pipe[0]);
+    }
+    for (size_t i = 0; i < pids.size(); i++)
+    {
+        gchar ready = 0;
+        if (read (ready_pipe[0], &ready, 1) != 1 || !ready)
+            g_warning ("a reader cannot open %s", publisher.name.c_str());
+    }
+
+    const guint num_rows = source->num_rows();
+    std::vector<gfloat> frame (num_rows);
+    std::vector<guint32> ticks (num_rows);
+    gint64 publish_us = 0;
+    for (guint i = 0; i < frames; i++)
+    {
+        source->sample (frame.data());
+        for (guint row = 0; row < num_rows; row++)
+            ticks[row] = source->value_ticks (frame[row]);
+
+        const gint64 t0 = g_get_real_time ();
+        publish_frame (publisher, t0, ticks.data());
+        publish_us += g_get_real_time () - t0;
+        g_usleep (BENCH_RING_INTERVAL_US);
+    }
+    close_ring (publisher);
+
+    printf ("%6u CPUs, %u readers: publishing %.2f us/frame\n", num_cpus, num_readers, (gdouble) publish_us / frames);
+    for (size_t i = 0; i < pids.size(); i++)
+    {
+        RingReaderResult result = RingReaderResult();
+        if (read (result_fds[i], &result, sizeof (result)) != sizeof (result))
+            g_warning ("no result from reader %zu", i);
+        close (result_fds[i]);
+        waitpid (pids[i], NULL, 0);
+        printf ("  reader %zu: %" G_GUINT64_FORMAT " frames, %" G_GUINT64_FORMAT " missed, latency "
+                "p50 %" G_GINT64_FORMAT " us, p99 %" G_GINT64_FORMAT " us, max %" G_GINT64_FORMAT " us\n",
+                i, result.frames, result.missed, result.p50, result.p99, result.max);
+    }
+    close (ready_pipe[0]);
+    close (ready_pipe[1]);
+}
+
+
+
+/*
+ * The fixture tree has one package of five logical CPUs: CPU 0 in core 0,
+ * CPUs 1 and 3 in core 1, CPU 2 offline, CPU 4 in core 2. CPU 3 is
+ * isolated and nohz_full. Coretemp has sensors for cores 0 and 1 and for
+ * the package. Powercap has a package zone with a 15 W limit, its core
+ * subzone, and an MMIO zone which duplicates the package.
+ */
+static guint sysfs_failures = 0;
+
+static void
+check (bool ok, const gchar *what)
+{
+    printf ("%s %s\n", ok ? "ok  " : "FAIL", what);
+    if (!ok)
+        sysfs_failures++;
+}
+
+static bool
+near (gfloat value, gfloat expected)
+{
+    return fabsf (value - expected) < 0.01f * MAX (fabsf (expected), 1.0f);
+}
+
+static guint
+check_sysfs (const std::string &root)
+{
+    Ptr0<Topology> topology = read_topology (root);
+    check (topology != nullptr, "topology: read");
+    if (!topology)
+        return sysfs_failures;
+    const Topology &t = *topology;
+    check (t.num_logical_cpus == 5 && t.num_online_logical_cpus == 4, "topology: 5 logical CPUs, 4 online");
+    check (t.num_cores == 3 && t.num_online_cores == 3, "topology: 3 cores");
+    check (t.logical_cpu_2_core == std::vector<gint>({0, 1, -1, 1, 2}), "topology: offline CPU 2 has no core");
+    check (t.logical_cpu_2_package == std::vector<gint>({0, 0, -1, 0, 0}), "topology: offline CPU 2 has no package");
+    std::vector<guint> core_1 = t.cores.at (1).logical_cpus;
+    std::sort (core_1.begin(), core_1.end());
+    check (t.smt && core_1 == std::vector<guint>({1, 3}), "topology: SMT in core 1");
+
+    std::vector<guint8> flags;
+    check (read_cpu_flags (root, flags), "CPU flags: read");
+    check (flags.size() == 4 && flags[0] == 0 && flags[1] == 0 && flags[2] == 0 &&
+           flags[3] == (CPU_FLAG_ISOLATED | CPU_FLAG_NOHZ_FULL), "CPU flags: CPU 3 isolated and nohz_full");
+
+    BatchReader reader;
+    Ptr0<Thermal> thermal = read_thermal_sensors (root, t);
+    check (thermal != nullptr, "thermal: sensors found");
+    if (thermal)
+    {
+        add_thermal_reads (*thermal, reader);
+        reader.read_all ();
+        const std::vector<gfloat> &c = thermal->celsius;
+        check (read_thermal_data (*thermal, reader), "thermal: read");
+        check (thermal->sensors.size() == 3, "thermal: 2 core sensors and the package sensor");
+        check (near (c[0], 45) && near (c[1], 61) && near (c[3], 61), "thermal: CPUs 0, 1 and 3 from their core sensors");
+        check (near (c[4], 52), "thermal: CPU 4 from the package sensor");
+        check (isnan (c[2]), "thermal: offline CPU 2 unknown");
+        check (near (thermal->critical[1], 90) && near (thermal->critical[4], 100), "thermal: critical temperatures");
+        check (!cpu_hotplug_detected (*thermal, reader), "thermal: no hotplug");
+    }
+
+    Ptr0<PowerMeter> power = read_power_domains (root);
+    check (power != nullptr, "power: domains found");
+    if (power)
+    {
+        std::vector<PowerDomain> &domains = power->domains;
+        check (domains.size() == 2 && domains[0].name == "package-0" && domains[1].name == "package-0 core",
+               "power: package and core zones, MMIO skipped");
+        reader.clear ();
+        add_power_reads (*power, reader);
+        reader.read_all ();
+        check (read_power_data (*power, reader), "power: read");
+
+        /* 0.5 J before the wrap-around and 1 J after it, over 1 s */
+        PowerDomain &package = domains[0];
+        package.previous_energy = package.max_energy - 500000;
+        package.previous_time = g_get_monotonic_time () - G_USEC_PER_SEC;
+        reader.read_all ();
+        read_power_data (*power, reader);
+        check (near (package.watts, 1.5f), "power: 1.5 W across the wrap-around");
+        check (near (package.max_watts, 15), "power: full scale from the power limit");
+    }
+
+    printf ("%u failures\n", sysfs_failures);
+    return sysfs_failures;
+}
+
+
+
+int
+main (int argc, char **argv)
+{
+    guint ticks = 1000;
+    std::vector<guint> cpus = {1024, 4096};
+
+    if (argc > 1 && strcmp (argv[1], "--proc-stat") == 0)
+    {
+        ticks = argc > 2 ? MAX (atoi (argv[2]), 1) : 100;
+        bench_proc_stat (argc > 3 ? MAX (atoi (argv[3]), 1) : 8192, ticks);
+        return 0;
+    }
+
+    if (argc > 1 && strcmp (argv[1], "--loads") == 0)
+    {
+        std::vector<guint> loads_cpus = {512, 1024, 4096, 16384};
+        ticks = argc > 2 ? MAX (atoi (argv[2]), 1) : 10000;
+        if (argc > 3)
+        {
+            loads_cpus.clear();
+            for (int i = 3; i < argc; i++)
+                loads_cpus.push_back (MAX (atoi (argv[i]), 1));
+        }
+        for (guint num_cpus : loads_cpus)
+            bench_loads (num_cpus, ticks);
+        return 0;
+    }
+
+    if (argc > 1 && strcmp (argv[1], "--history") == 0)
+    {
+        std::vector<guint> history_cpus = {256, 2048};
+        ticks = argc > 2 ? MAX (atoi (argv[2]), 1) : 20000;
+        if (argc > 3)
+        {
+            history_cpus.clear();
+            for (int i = 3; i < argc; i++)
+                history_cpus.push_back (MAX (atoi (argv[i]), 1));
+        }
+        for (guint num_cpus : history_cpus)
+            bench_history (num_cpus, ticks);
+        return 0;
+    }
+
+    if (argc > 1 && strcmp (argv[1], "--archive") == 0)
+    {
+        std::vector<guint> archive_cpus = {128, 1024};
+        ticks = argc > 2 ? MAX (atoi (argv[2]), 1) : 20000;
+        if (argc > 3)
+        {
+            archive_cpus.clear();
+            for (int i = 3; i < argc; i++)
+                archive_cpus.push_back (MAX (atoi (argv[i]), 1));
+        }
+        for (guint num_cpus : archive_cpus)
+            bench_archive (num_cpus, ticks);
+        return 0;
+    }
+
+    if (argc > 1 && strcmp (argv[1], "--resize") == 0)
+    {
+        std::vector<guint> resize_cpus = {256, 2048};
+        const guint rounds = argc > 2 ? MAX (atoi (argv[2]), 1) : 20;
+        if (argc > 3)
+        {
+            resize_cpus.clear();
+            for (int i = 3; i < argc; i++)
+                resize_cpus.push_back (MAX (atoi (argv[i]), 1));
+        }
+        for (guint num_cpus : resize_cpus)
+            bench_resize (num_cpus, rounds);
+        return 0;
+    }
+
+    if (argc > 1 && strcmp (argv[1], "--ring") == 0)
+    {
+        const guint frames = argc > 2 ? MAX (atoi (argv[2]), 1) : 10000;
+        const guint num_readers = argc > 3 ? MAX (atoi (argv[3]), 1) : 4;
+        bench_ring (argc > 4 ? MAX (atoi (argv[4]), 1) : 256, num_readers, frames);
+        return 0;
+    }
+
+    if (argc > 2 && strcmp (argv[1], "--sysfs") == 0)
+        return check_sysfs (argv[2]) == 0 ? 0 : 1;
+
+    if (argc > 1)
+        ticks = MAX (atoi (argv[1]), 1);
+    if (argc > 2)
+    {
+        cpus.clear();
+        for (int i = 2; i < argc; i++)
+            cpus.push_back (MAX (atoi (argv[i]), 1));
+    }
+
+    for (guint num_cpus : cpus)
+    {
+        /* A typical panel and a tall vertical panel */
+        bench (num_cpus, ticks, 48);
+        bench (num_cpus, ticks, 1024);
+    }
+    return 0;
+}
@@ -0,0 +1,274 @@
+/*  collector.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * cpuwaterfall-collector: samples the per-CPU load with the plugin's own
+ * reader and streams it to every connected client, see wire.h.
+ *
+ * Usage: cpuwaterfall-collector [-i INTERVAL_MS] [-b TICKS_PER_BATCH] ADDRESS
+ *   ADDRESS is unix:/path/to/socket, PORT (localhost only) or HOST:PORT.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+#include <errno.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "os.h"
+#include "wire.h"
+
+#define DEFAULT_INTERVAL_MS 200
+#define DEFAULT_BATCH 5
+#define MAX_CLIENTS 64
+
+static volatile sig_atomic_t quit = 0;
+
+
+
+static void
+quit_handler (int sig)
+{
+    quit = 1;
+}
+
+
+
+static gint
+listen_unix (const char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen (path) >= sizeof (addr.sun_path))
+    {
+        fprintf (stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path);
+    unlink (path);
+
+    const gint fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind (fd, (struct sockaddr*) &addr, sizeof (addr)) != 0 || listen (fd, 8) != 0)
+    {
+        perror (path);
+        if (fd >= 0)
+            close (fd);
+        return -1;
+    }
+    return fd;
+}
+
+static gint
+listen_tcp (const std::string &host, const std::string &port)
+{
+    struct addrinfo hints, *res;
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+
+    const gint err = getaddrinfo (host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &res);
+    if (err != 0)
+    {
+        fprintf (stderr, "%s:%s: %s\n", host.c_str(), port.c_str(), gai_strerror (err));
+        return -1;
+    }
+
+    gint fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next)
+    {
+        fd = socket (ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        const gint one = 1;
+        setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+        if (bind (fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen (fd, 8) == 0)
+            break;
+        close (fd);
+        fd = -1;
+    }
+    freeaddrinfo (res);
+
+    if (fd < 0)
+        perror ("listen");
+    return fd;
+}
+
+static void
+usage ()
+{
+    fprintf (stderr, "Usage: cpuwaterfall-collector [-i INTERVAL_MS] [-b TICKS_PER_BATCH] ADDRESS\n"
+                     "ADDRESS is unix:/path/to/socket, PORT (localhost only) or HOST:PORT\n");
+}
+
+
+
+int
+main (int argc, char **argv)
+{
+    guint interval_ms = DEFAULT_INTERVAL_MS;
+    guint batch = DEFAULT_BATCH;
+    gint opt;
+
+    while ((opt = getopt (argc, argv, "i:b:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'i': interval_ms = CLAMP (atoi (optarg), 10, 60000); break;
+            case 'b': batch = CLAMP (atoi (optarg), 1, 100); break;
+            default:  usage (); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        usage ();
+        return 1;
+    }
+
+    const std::string address = argv[optind];
+    std::string unix_path;
+    gint listen_fd;
+    if (xfce4::starts_with (address, "unix:"))
+    {
+        unix_path = address.substr (5);
+        listen_fd = listen_unix (unix_path.c_str());
+    }
+    else
+    {
+        const std::string::size_type colon = address.rfind (':');
+        if (colon == std::string::npos)
+            listen_fd = listen_tcp ("", address);
+        else
+            listen_fd = listen_tcp (address.substr (0, colon), address.substr (colon + 1));
+    }
+    if (listen_fd < 0)
+        return 1;
+
+    signal (SIGINT, quit_handler);
+    signal (SIGTERM, quit_handler);
+    signal (SIGPIPE, SIG_IGN);
+
+    CpuRows cpus;
+    std::vector<gfloat> load;
+    if (init_cpu_rows (cpus))
+        load.resize (cpus.size());
+    if (load.empty() || !read_cpu_data (cpus, load.data()))
+    {
+        fprintf (stderr, "cannot read the CPU load\n");
+        return 1;
+    }
+
+    gchar hostname[256] = "";
+    gethostname (hostname, sizeof (hostname) - 1);
+    std::string hello;
+    wire_encode_hello (hello, hostname, cpus.size() - 1);
+
+    std::vector<gint> clients;
+    std::vector<WireTick> ticks;
+    std::string message;
+    gint64 next_tick = g_get_monotonic_time () + interval_ms * (gint64) 1000;
+
+    while (!quit)
+    {
+        std::vector<struct pollfd> fds (1 + clients.size());
+        fds[0].fd = listen_fd;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            fds[i+1].fd = clients[i];
+            fds[i+1].events = POLLIN;
+        }
+
+        const gint64 now = g_get_monotonic_time ();
+        const gint timeout = next_tick > now ? (next_tick - now + 999) / 1000 : 0;
+        if (poll (fds.data(), fds.size(), timeout) < 0 && errno != EINTR)
+        {
+            perror ("poll");
+            break;
+        }
+
+        /* Clients only ever send a hangup */
+        for (size_t i = clients.size(); i-- > 0;)
+        {
+            if (fds[i+1].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                close (clients[i]);
+                clients.erase (clients.begin() + i);
+            }
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            const gint fd = accept4 (listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+            if (fd >= 0 && clients.size() < MAX_CLIENTS &&
+                send (fd, hello.data(), hello.size(), MSG_NOSIGNAL) == (gssize) hello.size())
+            {
+                clients.push_back (fd);
+            }
+            else if (fd >= 0)
+                close (fd);
+        }
+
+        if (g_get_monotonic_time () < next_tick)
+            continue;
+        next_tick += interval_ms * (gint64) 1000;
+
+        if (!read_cpu_data (cpus, load.data()))
+            continue;
+
+        WireTick tick;
+        tick.interval_ms = interval_ms;
+        tick.load.resize (load.size());
+        for (size_t row = 0; row < load.size(); row++)
+            tick.load[row] = CLAMP (lroundf (load[row] * WIRE_SCALE), 0, WIRE_SCALE);
+        ticks.push_back (std::move (tick));
+
+        if (ticks.size() < batch)
+            continue;
+
+        message.clear();
+        wire_encode_batch (message, ticks);
+        ticks.clear();
+
+        /* A client which cannot keep up is dropped */
+        for (size_t i = clients.size(); i-- > 0;)
+        {
+            if (send (clients[i], message.data(), message.size(), MSG_NOSIGNAL) != (gssize) message.size())
+            {
+                close (clients[i]);
+                clients.erase (clients.begin() + i);
+            }
+        }
+    }
+
+    for (gint fd : clients)
+        close (fd);
+    close (listen_fd);
+    if (!unix_path.empty())
+        unlink (unix_path.c_str());
+    return 0;
+}
@@ -0,0 +1,257 @@
+/*  cpuwaterfall-ring.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_RING_H_
+#define _XFCE_CPUWATERFALL_RING_H_
+
+/*
+ * Shared-memory ring of CPU load frames written by cpuwaterfall-sampler,
+ * and by the plugin if it publishes its samples. Plain C with no
+ * dependencies, so that other programs can read it.
+ *
+ * Layout, all offsets from the start of the mapping:
+ *
+ *   struct cwf_ring_header
+ *   uint32_t cpu_ids[num_rows]         at ids_offset, row 0 is the aggregate
+ *   num_slots slots of slot_size bytes at slots_offset, each one:
+ *     struct cwf_ring_slot
+ *     float load[num_rows]             from 0.0 to 1.0
+ *     uint32_t ticks[num_rows]         used and total tick deltas, see loads.h
+ *
+ * Frame n (counting from 0) is stored in slot n % num_slots. There is a
+ * single writer; any number of readers map the ring read-only. A slot is a
+ * seqlock: its seq is odd while frame n is being written and 2n+2 once it
+ * is complete. head is the number of complete frames. The writer signals
+ * each new frame on an eventfd, whose counter thus holds the number of
+ * frames since a reader last drained it.
+ *
+ * The plugin publishes its frames under a POSIX shared memory name, see
+ * cwf_ring_open(), with the rows of its source: cpu_ids[row] is
+ * CWF_ROW_AGGREGATE for rows which are not a CPU of this machine. After
+ * each frame it increments wake, a futex the readers sleep on in
+ * cwf_ring_wait(). When the rows change, it sets CWF_RING_CLOSED and
+ * publishes a new ring under the same name, which the readers open again.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define CWF_RING_MAGIC      0x52465743u     /* "CWFR" */
+#define CWF_RING_VERSION    1
+#define CWF_ROW_AGGREGATE   0xffffffffu     /* cpu_ids[0] */
+#define CWF_RING_CLOSED     1u              /* flags: the writer left the ring */
+
+struct cwf_ring_header
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_rows;
+    uint32_t num_slots;             /* A power of 2 */
+    uint32_t slot_size;
+    uint32_t ids_offset;
+    uint32_t slots_offset;
+    int32_t writer_pid;
+    uint64_t head;                  /* Written atomically */
+    uint32_t flags;                 /* Written atomically */
+    uint32_t wake;                  /* Futex, written atomically */
+};
+
+struct cwf_ring_slot
+{
+    uint64_t seq;                   /* Written atomically */
+    int64_t timestamp_us;           /* CLOCK_REALTIME when sampled */
+    uint32_t interval_us;           /* Covered by the tick deltas */
+    uint32_t flags;                 /* Unused, 0 */
+};
+
+static inline uint32_t
+cwf_ring_slot_size (uint32_t num_rows)
+{
+    const uint32_t size = sizeof (struct cwf_ring_slot) + num_rows * (sizeof (float) + sizeof (uint32_t));
+    return (size + 63) & ~63u;
+}
+
+static inline size_t
+cwf_ring_size (uint32_t num_rows, uint32_t num_slots)
+{
+    const uint32_t ids_size = (num_rows * sizeof (uint32_t) + 63) & ~63u;
+    return 64 + ids_size + (size_t) num_slots * cwf_ring_slot_size (num_rows);
+}
+
+/* The ring is valid if this returns nonzero for the mapped size */
+static inline int
+cwf_ring_check (const void *ring, size_t size)
+{
+    const struct cwf_ring_header *h = (const struct cwf_ring_header*) ring;
+    return size >= sizeof (*h) && h->magic == CWF_RING_MAGIC && h->version == CWF_RING_VERSION &&
+           h->num_rows != 0 && h->num_slots != 0 && (h->num_slots & (h->num_slots - 1)) == 0 &&
+           h->slot_size == cwf_ring_slot_size (h->num_rows) &&
+           (size_t) h->slots_offset + (size_t) h->num_slots * h->slot_size <= size &&
+           (size_t) h->ids_offset + h->num_rows * sizeof (uint32_t) <= h->slots_offset;
+}
+
+static inline const uint32_t*
+cwf_ring_cpu_ids (const void *ring)
+{
+    const struct cwf_ring_header *h = (const struct cwf_ring_header*) ring;
+    return (const uint32_t*) ((const char*) ring + h->ids_offset);
+}
+
+static inline struct cwf_ring_slot*
+cwf_ring_slot_at (const void *ring, uint64_t n)
+{
+    const struct cwf_ring_header *h = (const struct cwf_ring_header*) ring;
+    return (struct cwf_ring_slot*) ((char*) ring + h->slots_offset + (n & (h->num_slots - 1)) * h->slot_size);
+}
+
+static inline float*
+cwf_slot_load (struct cwf_ring_slot *slot)
+{
+    return (float*) (slot + 1);
+}
+
+static inline uint32_t*
+cwf_slot_ticks (struct cwf_ring_slot *slot, uint32_t num_rows)
+{
+    return (uint32_t*) (cwf_slot_load (slot) + num_rows);
+}
+
+static inline uint64_t
+cwf_ring_head (const void *ring)
+{
+    return __atomic_load_n (&((const struct cwf_ring_header*) ring)->head, __ATOMIC_ACQUIRE);
+}
+
+/* Writer: returns the slot for frame n, marked as being written */
+static inline struct cwf_ring_slot*
+cwf_ring_begin (void *ring, uint64_t n)
+{
+    struct cwf_ring_slot *slot = cwf_ring_slot_at (ring, n);
+    __atomic_store_n (&slot->seq, 2 * n + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence (__ATOMIC_RELEASE);
+    return slot;
+}
+
+/* Writer: completes frame n and publishes it */
+static inline void
+cwf_ring_commit (void *ring, struct cwf_ring_slot *slot, uint64_t n)
+{
+    __atomic_store_n (&slot->seq, 2 * n + 2, __ATOMIC_RELEASE);
+    __atomic_store_n (&((struct cwf_ring_header*) ring)->head, n + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Reader: copies frame n (slot_size bytes) into copy. Returns 1 on
+ * success, 0 if the frame is not complete yet or was already overwritten.
+ */
+static inline int
+cwf_ring_read (const void *ring, uint64_t n, void *copy)
+{
+    const struct cwf_ring_header *h = (const struct cwf_ring_header*) ring;
+    const struct cwf_ring_slot *slot = cwf_ring_slot_at (ring, n);
+    if (__atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE) != 2 * n + 2)
+        return 0;
+    memcpy (copy, slot, h->slot_size);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    return __atomic_load_n (&slot->seq, __ATOMIC_RELAXED) == 2 * n + 2;
+}
+
+/* Readers of a named ring, and its writer. In C, these need _GNU_SOURCE. */
+#if defined (__linux__)
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Maps the ring published under a shared memory name read-only. Returns NULL if there is none. */
+static inline void*
+cwf_ring_open (const char *name, size_t *size)
+{
+    const int fd = shm_open (name, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+
+    void *ring = MAP_FAILED;
+    struct stat st;
+    if (fstat (fd, &st) == 0 && st.st_size > 0)
+        ring = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (ring == MAP_FAILED)
+        return NULL;
+
+    /* The writer sets the magic last */
+    if (__atomic_load_n (&((const struct cwf_ring_header*) ring)->magic, __ATOMIC_ACQUIRE) != CWF_RING_MAGIC ||
+        !cwf_ring_check (ring, st.st_size))
+    {
+        munmap (ring, st.st_size);
+        return NULL;
+    }
+    *size = st.st_size;
+    return ring;
+}
+
+static inline void
+cwf_ring_close (const void *ring, size_t size)
+{
+    munmap ((void*) ring, size);
+}
+
+static inline int
+cwf_ring_closed (const void *ring)
+{
+    return (__atomic_load_n (&((const struct cwf_ring_header*) ring)->flags, __ATOMIC_ACQUIRE) & CWF_RING_CLOSED) != 0;
+}
+
+/*
+ * Reader: sleeps until frame n is complete, the ring is closed or about
+ * timeout_ms have passed, -1 to wait forever. Returns nonzero if frame n
+ * is complete.
+ */
+static inline int
+cwf_ring_wait (const void *ring, uint64_t n, int timeout_ms)
+{
+    const struct cwf_ring_header *h = (const struct cwf_ring_header*) ring;
+    struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+    for (;;)
+    {
+        /* A frame published after this load changes wake, so the futex does not sleep */
+        const uint32_t wake = __atomic_load_n (&h->wake, __ATOMIC_ACQUIRE);
+        if (cwf_ring_head (ring) > n)
+            return 1;
+        if (cwf_ring_closed (ring))
+            return 0;
+        if (syscall (SYS_futex, &h->wake, FUTEX_WAIT, wake, timeout_ms < 0 ? NULL : &timeout, NULL, 0) != 0 &&
+            errno == ETIMEDOUT)
+            return cwf_ring_head (ring) > n;
+    }
+}
+
+/* Writer: wakes the readers in cwf_ring_wait(), after cwf_ring_commit() or setting CWF_RING_CLOSED */
+static inline void
+cwf_ring_wake (void *ring)
+{
+    struct cwf_ring_header *h = (struct cwf_ring_header*) ring;
+    __atomic_fetch_add (&h->wake, 1, __ATOMIC_RELEASE);
+    syscall (SYS_futex, &h->wake, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+#endif
+
+#endif /* _XFCE_CPUWATERFALL_RING_H_ */
@@ -70,55 +70,68 @@ lerp_RGBA_table ( xfce4::RGBA *colors, int n, float ratio )
 
 
 
-void
+static void
 get_surf_and_patt(
+    const Ptr<CPUWaterfall> &base,
     cairo_surface_t **surf_ptr,
     cairo_pattern_t **patt_ptr,
     int w,
     int h,
     xfce4::RGBA &bg
 ){
-    static cairo_surface_t *surf=0;
-    static cairo_pattern_t *patt=0;
-    static int pre_w=-1;
-    static int pre_h=-1;
-    
+    // per istanza: più plugin girano nello stesso processo del pannello
+    auto &canvas = base->canvas;
+
     assert(surf_ptr);
     assert(patt_ptr);
 
-    if(pre_w!=w || pre_h!=h || !surf || !patt){
+    if(canvas.w!=w || canvas.h!=h || !canvas.surface || !canvas.pattern){
         // qualcosa è cambiato, rebuild
 
-        pre_w=w;
-        pre_h=h;
+        canvas.w=w;
+        canvas.h=h;
+        canvas.x=0;
 
-        if(patt)cairo_pattern_destroy(patt);
-        if(surf)cairo_surface_destroy(surf);
+        destroy_surf_and_patt(base);
 
-        surf=cairo_image_surface_create(CAIRO_FORMAT_RGB24,w,h);
-        cairo_t *cr = cairo_create(surf);
+        canvas.surface=cairo_image_surface_create(CAIRO_FORMAT_RGB24,w,h);
+        cairo_t *cr = cairo_create(canvas.surface);
         cairo_set_source_rgb(cr,bg.R,bg.G,bg.B);
         cairo_paint(cr);
         cairo_destroy(cr);
-        patt=cairo_pattern_create_for_surface(surf);
-        cairo_pattern_set_extend(patt,CAIRO_EXTEND_REPEAT);
+        canvas.pattern=cairo_pattern_create_for_surface(canvas.surface);
+        cairo_pattern_set_extend(canvas.pattern,CAIRO_EXTEND_REPEAT);
     }
 
-    *surf_ptr=surf;
-    *patt_ptr=patt;
+    *surf_ptr=canvas.surface;
+    *patt_ptr=canvas.pattern;
+}
+
+
+
+void
+destroy_surf_and_patt (const Ptr<CPUWaterfall> &base)
+{
+    auto &canvas = base->canvas;
+    if(canvas.pattern)cairo_pattern_destroy(canvas.pattern);
+    if(canvas.surface)cairo_surface_destroy(canvas.surface);
+    canvas.pattern=NULL;
+    canvas.surface=NULL;
 }
 
 
 
 void
 vline( const Ptr<CPUWaterfall> &base, int y0, int y1, 
-    unsigned char *bgra, int stride, xfce4::RGBA c, float border )
+    unsigned char *bgra, int stride, xfce4::RGBA c, float border,
+    const xfce4::RGBA *frame = NULL )
 {
     const int br = c.R*255;
     const int bg = c.G*255;
     const int bb = c.B*255;
 
-    xfce4::RGBA dim = lerp_RGBA( base->colors[BG_COLOR], c, border );
+    // frame: colore di header/footer imposto (es. core isolati)
+    xfce4::RGBA dim = frame ? *frame : lerp_RGBA( base->colors[BG_COLOR], c, border );
     const int hr = dim.R*255;
     const int hg = dim.G*255;
     const int hb = dim.B*255;
@@ -148,65 +161,326 @@ vline( const Ptr<CPUWaterfall> &base, int y0, int y1,
 }
 
 
-void
-draw_waterfall (const Ptr<CPUWaterfall> &base, cairo_t *cr, gint w, gint h)
+// temperatura: la scala va da TEMPERATURE_MIN al critico del sensore,
+// la tinta (overlay) parte TEMPERATURE_TINT gradi sotto il critico
+#define TEMPERATURE_MIN  30
+#define TEMPERATURE_TINT 30
+
+static float
+temperature_ratio (const Ptr<CPUWaterfall> &base, gint cpu, float from)
 {
-    const int cores = base->history.data.size();
+    if( !base->thermal || cpu<0 || (guint)cpu>=base->thermal->celsius.size() )
+        return 0;
+    const float t = base->thermal->celsius[cpu];
+    const float crit = base->thermal->critical[cpu];
+    if( isnan(t) || crit<=from )
+        return 0;
+    return (t-from)/(crit-from);
+}
 
-    // core 0 = average, cpu load classico
 
-    // bars:
-    // past            now
-    // |average----------|
-    // |core1------------|
-    // |core2------------|
-    // : : :
+// latenza della run queue: ns di attesa per ns trascorso, in scala logaritmica
+// da 1 ms/s (sotto è sfondo) a 10 s/s (dieci task sempre in coda)
+#define RUN_DELAY_MIN 1e-3f
+#define RUN_DELAY_MAX 10.0f
+
+static float
+run_delay_ratio (float delay)
+{
+    if( isnan(delay) || delay<=RUN_DELAY_MIN )
+        return 0;
+    return logf(delay/RUN_DELAY_MIN) / logf(RUN_DELAY_MAX/RUN_DELAY_MIN);
+}
 
-    static int x=0;
-    static cairo_matrix_t mat={0};
-    if(mat.xx==0){
-        // mat = |1 0 0|
-        //       |0 1 0|
-        mat.xx=1;
-        mat.yy=1;
+
+static float
+cpu_run_delay (const Ptr<CPUWaterfall> &base, gint cpu)
+{
+    if( !base->run_delay || cpu<0 || (guint)cpu>=base->run_delay->ratio.size() )
+        return NAN;
+    return base->run_delay->ratio[cpu];
+}
+
+
+// colore di una striscia: carico, temperatura, latenza o carico tinto dalla temperatura
+static xfce4::RGBA
+strip_color (const Ptr<CPUWaterfall> &base, gint cpu, float load)
+{
+    if( base->mode==MODE_TEMPERATURE )
+        return lerp_RGBA_table(base->colors, NUM_GRADIENT_COLORS, temperature_ratio(base,cpu,TEMPERATURE_MIN));
+    if( base->mode==MODE_RUN_DELAY )
+        return lerp_RGBA_table(base->colors, NUM_GRADIENT_COLORS, run_delay_ratio(cpu_run_delay(base,cpu)));
+
+    xfce4::RGBA c = lerp_RGBA_table(base->colors, NUM_GRADIENT_COLORS, load);
+    if( base->has_temperature && base->thermal && cpu>=0 && (guint)cpu<base->thermal->critical.size() ){
+        const float crit = base->thermal->critical[cpu];
+        float heat = temperature_ratio(base,cpu,crit-TEMPERATURE_TINT);
+        if(heat<0)heat=0;
+        if(heat>1)heat=1;
+        c = lerp_RGBA(c, base->colors[FG_COLOR2], heat);
     }
+    return c;
+}
 
-    cairo_surface_t *surf;
-    cairo_pattern_t *patt;
-    get_surf_and_patt(&surf,&patt,w,h,base->colors[BG_COLOR]);
 
-    const int stride = cairo_image_surface_get_stride(surf);
-    unsigned char *bgra_pixmap = cairo_image_surface_get_data(surf);
-    cairo_surface_flush(surf);
+// nessun campione (sorgente ferma o CPU offline): buco col colore di sfondo,
+// tranne nelle modalità temperatura e latenza che non leggono la storia
+static bool
+is_gap (const Ptr<CPUWaterfall> &base, guint8 level)
+{
+    return base->mode==MODE_WATERFALL && level==HISTORY_GAP;
+}
+
+
+static float
+level_ratio (guint8 level)
+{
+    return level==HISTORY_GAP ? 0 : level/(float)(HISTORY_GAP-1);
+}
+
+
+// tabella livello -> colore del gradiente, ricostruita quando cambiano i colori.
+// il buco ha il colore di sfondo
+static const xfce4::RGBA *
+level_colors (const Ptr<CPUWaterfall> &base)
+{
+    auto &canvas = base->canvas;
+
+    bool same=canvas.has_level_colors;
+    for( int i=0; i<NUM_GRADIENT_COLORS && same; i++ )
+        same = canvas.gradient[i].equals(base->colors[i]);
+
+    if(!same){
+        for( int i=0; i<NUM_GRADIENT_COLORS; i++ )
+            canvas.gradient[i]=base->colors[i];
+        for( int level=0; level<HISTORY_GAP; level++ )
+            canvas.level_colors[level]=lerp_RGBA_table(base->colors, NUM_GRADIENT_COLORS, level_ratio(level));
+        canvas.level_colors[HISTORY_GAP]=base->colors[BG_COLOR];
+        canvas.has_level_colors=true;
+    }
+    return canvas.level_colors;
+}
+
+
+// colore di un core: dritto dalla tabella, se non c'è tinta né altra modalità
+static xfce4::RGBA
+level_color (const Ptr<CPUWaterfall> &base, const xfce4::RGBA *lut, gint cpu, guint8 level)
+{
+    if( base->mode==MODE_WATERFALL && !(base->has_temperature && base->thermal) )
+        return lut[level];
+    if( is_gap(base, level) )
+        return base->colors[BG_COLOR];
+    return strip_color(base, cpu, level_ratio(level));
+}
+
+
+// la striscia average in modalità temperatura mostra il core più caldo,
+// in modalità latenza l'attesa media dei core
+static xfce4::RGBA
+average_color (const Ptr<CPUWaterfall> &base, float load)
+{
+    if( base->mode==MODE_RUN_DELAY ){
+        float sum = 0;
+        int n = 0;
+        if( base->run_delay )
+            for( float delay : base->run_delay->ratio )
+                if( !isnan(delay) ){ sum += delay; n++; }
+        return lerp_RGBA_table(base->colors, NUM_GRADIENT_COLORS, n ? run_delay_ratio(sum/n) : 0);
+    }
+    if( base->mode==MODE_TEMPERATURE ){
+        float v = 0;
+        if( base->thermal )
+            for( guint cpu=0; cpu<base->thermal->celsius.size(); cpu++ )
+                v = fmaxf(v, temperature_ratio(base,cpu,TEMPERATURE_MIN));
+        return lerp_RGBA_table(base->colors, NUM_GRADIENT_COLORS, v);
+    }
+    return lerp_RGBA_table(base->colors, NUM_GRADIENT_COLORS, load);
+}
+
+
+// layout delle strisce: in alto la average e le strisce di potenza (RAPL),
+// poi un separatore e una striscia per core; un separatore chiude
+// anche ogni banda della sorgente (es. un host remoto).
+// il tooltip mappa il puntatore sulla striscia con la stessa aritmetica
+static int
+num_power_strips (const Ptr<CPUWaterfall> &base)
+{
+    return base->has_power && base->power ? base->power->domains.size() : 0;
+}
+
+
+static int
+num_top_bars (const Ptr<CPUWaterfall> &base)
+{
+    return (base->has_average ? 1 : 0) + num_power_strips(base);
+}
+
+
+static int
+num_bars (const Ptr<CPUWaterfall> &base)
+{
+    const int cores = base->history.empty() ? 0 : base->history.num_rows;
+    const int top = num_top_bars(base);
+    return top + (top ? 1 : 0) + cores-1 + base->nr_band_separators;
+}
+
+
+static void
+bar_extent (int h, int bars, int bar, int *y0, int *y1)
+{
+    *y0 = h*(bar+0)/bars;
+    *y1 = h*(bar+1)/bars;
+}
+
+
+WaterfallStrip
+waterfall_strip_at (const Ptr<CPUWaterfall> &base, gint h, gint y)
+{
+    WaterfallStrip strip = {STRIP_NONE, 0};
+
+    const int bars = num_bars(base);
+    if( bars<=0 || h<=0 || y<0 || y>=h )
+        return strip;
+
+    int bar = y*bars/h;
+    int y0, y1;
+    bar_extent(h,bars,bar,&y0,&y1);
+    while( bar>0 && y<y0 ) bar_extent(h,bars,--bar,&y0,&y1);
+    while( bar<bars-1 && y>=y1 ) bar_extent(h,bars,++bar,&y0,&y1);
+
+    if(base->has_average){
+        if(bar==0){
+            strip.kind = STRIP_AVERAGE;
+            return strip;
+        }
+        bar--;
+    }
+
+    const int power = num_power_strips(base);
+    if(bar<power){
+        strip.kind = STRIP_POWER;
+        strip.index = bar;
+        return strip;
+    }
+    bar -= power;
 
-    // solo i cores reali
-    int bars=cores-1;   // cores = average pseudocore + cores
+    if(num_top_bars(base)>0){
+        if(bar==0)
+            return strip;   // separatore
+        bar--;
+    }
+
+    // salta i separatori fra le bande
+    for( guint row=1; row<=base->nr_cores; row++ ){
+        if(bar==0){
+            strip.kind = STRIP_CORE;
+            strip.index = row;
+            return strip;
+        }
+        bar--;
+        if( row<base->nr_cores && base->source && base->source->row_ends_band(row) ){
+            if(bar==0)
+                return strip;
+            bar--;
+        }
+    }
+    return strip;
+}
+
+
+// disegna nella colonna x il tick di age tick fa, 0 il più recente
+static void
+draw_column (const Ptr<CPUWaterfall> &base, unsigned char *bgra_pixmap, int stride, int x, int h, gssize age)
+{
+    const int cores = base->history.num_rows;
+
+    // cores = average pseudocore + cores
+    // con la avg: alta il doppio (avg + separatore)
+    const int bars=num_bars(base);
     int bar=0;
 
-    const gssize mask = base->history.mask();
-    const int off = base->history.offset;
+    // il tick di tutti i core, contiguo
+    const History &history = base->history;
+    if( age>0 && history.timestamp(age)==0 ){
+        // prima della storia: solo sfondo
+        vline(base, 0,h, &bgra_pixmap[x*4],stride, base->colors[BG_COLOR], 0.5);
+        return;
+    }
+    const guint8 *column = history.frame(age);
+    const xfce4::RGBA *lut = level_colors(base);
 
     if(base->has_average){
-        bars=cores+1;   // la avg la facciamo alta il doppio
-
-        for( int core=0; core<1; core++, bar++ ) 
-        {
-            // leggiamo solo l'ultimo valore del core
-            CpuLoad *data = base->history.data[core];
-            float v = data[off&mask].value;
-            int y0 = h*(bar+0)/bars;
-            int y1 = h*(bar+1)/bars;
-            vline(
-                base,
-                y0,y1,
-                &bgra_pixmap[y0*stride+x*4],stride,
-                lerp_RGBA_table(base->colors, NUM_COLORS, v),
-                0.5
-            );
+        const guint8 level = history.level(column, 0);
+        int y0, y1;
+        bar_extent(h,bars,bar,&y0,&y1);
+        vline(
+            base,
+            y0,y1,
+            &bgra_pixmap[y0*stride+x*4],stride,
+            is_gap(base, level) ? base->colors[BG_COLOR] : average_color(base, level_ratio(level)),
+            0.5
+        );
+        bar++;
+    }
+
+    // potenza RAPL, watt scalati sul limite del dominio.
+    // non è nella storia: le colonne ridisegnate restano vuote
+    for( int i=0; i<num_power_strips(base); i++, bar++ )
+    {
+        const PowerDomain &domain = base->power->domains[i];
+        float v = domain.max_watts>0 && age==0 ? domain.watts/domain.max_watts : 0;
+        int y0, y1;
+        bar_extent(h,bars,bar,&y0,&y1);
+        vline(
+            base,
+            y0,y1,
+            &bgra_pixmap[y0*stride+x*4],stride,
+            lerp_RGBA_table(base->colors, NUM_GRADIENT_COLORS, v),
+            0.5
+        );
+    }
+
+    if(num_top_bars(base)>0){
+        // separatore
+        int y0, y1;
+        bar_extent(h,bars,bar,&y0,&y1);
+        vline(
+            base,
+            y0,y1,
+            &bgra_pixmap[y0*stride+x*4],stride,
+            base->colors[BG_COLOR],
+            0.5
+        );
+        bar++;
+    }
+
 
+    // cores reali
+    for( int core=1; core<cores; core++, bar++ ) 
+    {
+        const guint8 level = history.level(column, core);
+        int y0, y1;
+        bar_extent(h,bars,bar,&y0,&y1);
+
+        // isolcpus/nohz_full: cornice distinta, col colore 2 se c'è carico
+        const xfce4::RGBA *frame = NULL;
+        const gint cpu = base->source->row_cpu(core);
+        if( cpu>=0 && (guint)cpu<base->cpu_flags.size() && base->cpu_flags[cpu] )
+            frame = level>0 && level!=HISTORY_GAP ? &base->colors[FG_COLOR2] : &base->colors[ISOLATED_COLOR];
+
+        vline(
+            base,
+            y0,y1,
+            &bgra_pixmap[y0*stride+x*4],stride,
+            level_color(base, lut, cpu, level),
+            0.5,
+            frame
+        );
+
+        // fine banda: separatore
+        if( core<cores-1 && base->nr_band_separators && base->source->row_ends_band(core) ){
             bar++;
-            y0 = h*(bar+0)/bars;
-            y1 = h*(bar+1)/bars;
+            bar_extent(h,bars,bar,&y0,&y1);
             vline(
                 base,
                 y0,y1,
@@ -216,31 +490,55 @@ draw_waterfall (const Ptr<CPUWaterfall> &base, cairo_t *cr, gint w, gint h)
             );
         }
     }
+}
 
 
-    // cores reali
-    for( int core=1; core<cores; core++, bar++ ) 
-    {
-        // leggiamo solo l'ultimo valore del core
-        CpuLoad *data = base->history.data[core];
-        float v = data[off&mask].value;
-        int y0 = h*(bar+0)/bars;
-        int y1 = h*(bar+1)/bars;
-        vline(
-            base,
-            y0,y1,
-            &bgra_pixmap[y0*stride+x*4],stride,
-            lerp_RGBA_table(base->colors, NUM_COLORS, v),
-            0.5
-        );
+void
+draw_waterfall (const Ptr<CPUWaterfall> &base, cairo_t *cr, gint w, gint h)
+{
+    const int cores = base->history.empty() ? 0 : base->history.num_rows;
+    if( !base->source || cores==0 )
+        return;
+
+    // riga 0 = aggregato della sorgente (average), poi una riga per core
+
+    // bars:
+    // past            now
+    // |average----------|
+    // |core1------------|
+    // |core2------------|
+    // : : :
+
+    cairo_surface_t *surf;
+    cairo_pattern_t *patt;
+    get_surf_and_patt(base,&surf,&patt,w,h,base->colors[BG_COLOR]);
+    int &x = base->canvas.x;
+
+    const int stride = cairo_image_surface_get_stride(surf);
+    unsigned char *bgra_pixmap = cairo_image_surface_get_data(surf);
+    cairo_surface_flush(surf);
+
+    if( base->repaint_history ){
+        // storia ripristinata dal file: tutte le colonne,
+        // dalla più vecchia, che finisce a sinistra
+        base->repaint_history=false;
+        for( gssize age=w-1; age>0; age-- ){
+            if( age<base->history.cap_pow2 )
+                draw_column(base, bgra_pixmap, stride, x, h, age);
+            x=(x+1)%w;
+        }
+        cairo_surface_mark_dirty(surf);
     }
 
+    draw_column(base, bgra_pixmap, stride, x, h, 0);
+
 //    cairo_surface_mark_dirty(surf);
     cairo_surface_mark_dirty_rectangle(surf,x,0,1,h);
 
     // ruotiamo il pattern
     x=(x+1)%w;
-    mat.x0=x;
+    cairo_matrix_t mat;
+    cairo_matrix_init_translate(&mat,x,0);
 
     cairo_pattern_set_matrix(patt,&mat);
     cairo_set_source(cr,patt);
@@ -28,4 +28,10 @@
 
 void draw_waterfall    (const Ptr<CPUWaterfall> &base, cairo_t *cr, gint w, gint h);
 
+/* Frees the drawing of the instance, see CPUWaterfall::canvas */
+void destroy_surf_and_patt (const Ptr<CPUWaterfall> &base);
+
+/* Returns the strip drawn at height y */
+WaterfallStrip waterfall_strip_at (const Ptr<CPUWaterfall> &base, gint h, gint y);
+
 #endif /* _XFCE_CPUWATERFALL_MODE_H_ */
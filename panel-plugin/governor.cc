@@ -0,0 +1,107 @@
+/*  governor.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <math.h>
+#include <time.h>
+#include "governor.h"
+
+/* Windows under half the budget before the level is lowered */
+#define GOVERNOR_CALM_WINDOWS 3
+
+gint64
+thread_cpu_time ()
+{
+    struct timespec ts;
+    if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return ts.tv_sec * (gint64) 1000000000 + ts.tv_nsec;
+}
+
+void
+init_governor (CpuGovernor &governor)
+{
+    governor.level = GOVERNOR_FULL;
+    governor.window_start = 0;
+    governor.cpu_time = 0;
+    governor.usage = NAN;
+    governor.calm_windows = 0;
+}
+
+bool
+update_governor (CpuGovernor &governor, gint64 now)
+{
+    if (governor.window_start == 0)
+    {
+        governor.window_start = now;
+        governor.cpu_time = 0;
+        return false;
+    }
+
+    const gint64 elapsed = now - governor.window_start;
+    if (elapsed < GOVERNOR_WINDOW_MS * (gint64) 1000)
+        return false;
+
+    governor.usage = governor.cpu_time / (elapsed * 1e3f);
+    governor.window_start = now;
+    governor.cpu_time = 0;
+
+    const GovernorLevel level = governor.level;
+    const gfloat budget = governor.budget / 1e4f;
+    if (governor.budget == 0)
+        governor.level = GOVERNOR_FULL;
+    else if (governor.usage > budget)
+    {
+        governor.calm_windows = 0;
+        if (governor.level < GOVERNOR_QUARTER_RATE)
+            governor.level = (GovernorLevel) (governor.level + 1);
+    }
+    else if (governor.usage < budget / 2 && governor.level > GOVERNOR_FULL)
+    {
+        /* Halving the rate saves about half, restoring it must fit */
+        if (++governor.calm_windows >= GOVERNOR_CALM_WINDOWS)
+        {
+            governor.calm_windows = 0;
+            governor.level = (GovernorLevel) (governor.level - 1);
+        }
+    }
+    else
+        governor.calm_windows = 0;
+
+    return governor.level != level;
+}
+
+guint
+governor_slowdown (const CpuGovernor &governor)
+{
+    switch (governor.level)
+    {
+        case GOVERNOR_HALF_RATE:
+            return 1;
+        case GOVERNOR_QUARTER_RATE:
+            return 2;
+        default:
+            return 0;
+    }
+}
@@ -0,0 +1,60 @@
+/*  governor.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_GOVERNOR_H_
+#define _XFCE_CPUWATERFALL_GOVERNOR_H_
+
+#include <glib.h>
+
+/*
+ * Keeps the CPU time the plugin spends on sampling and drawing under a
+ * budget. The time is measured in windows of GOVERNOR_WINDOW_MS: a window
+ * over the budget raises the level by one, and a few windows well under
+ * it lower the level by one. Each level keeps the savings of the lower ones.
+ */
+enum GovernorLevel
+{
+    GOVERNOR_FULL        = 0,   /* As configured */
+    GOVERNOR_NO_OVERLAYS = 1,   /* No power strips, hot core tint nor task scans */
+    GOVERNOR_HALF_RATE   = 2,   /* Update interval doubled */
+    GOVERNOR_QUARTER_RATE = 3,  /* Update interval quadrupled */
+};
+
+#define GOVERNOR_WINDOW_MS 5000
+
+struct CpuGovernor
+{
+    guint budget;           /* Hundredths of a percent of a CPU, 0 for none */
+    GovernorLevel level;
+    gint64 window_start;    /* Monotonic microseconds, 0 before the first window */
+    gint64 cpu_time;        /* Nanoseconds spent in the current window */
+    gfloat usage;           /* Fraction of a CPU used in the latest window, NAN if unknown */
+    guint calm_windows;     /* Consecutive windows under half the budget */
+};
+
+/* CPU time of the calling thread in nanoseconds */
+gint64 thread_cpu_time ();
+
+void init_governor (CpuGovernor &governor);
+
+/* Closes the window once it is long enough. Returns true if the level has changed. */
+bool update_governor (CpuGovernor &governor, gint64 now);
+
+/* Update intervals are multiplied by 2^governor_slowdown() */
+guint governor_slowdown (const CpuGovernor &governor);
+
+#endif /* _XFCE_CPUWATERFALL_GOVERNOR_H_ */
@@ -0,0 +1,365 @@
+/*  helper.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <libxfce4util/libxfce4util.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include "cpuwaterfall-ring.h"
+#include "os.h"
+#include "source.h"
+
+#if defined (__linux__)
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#ifndef HELPER_DIR
+#define HELPER_DIR "/usr/libexec/xfce4/cpuwaterfall-plugin"
+#endif
+
+/* Delay before restarting a helper which died, doubled while it keeps dying early */
+#define RESTART_DELAY_MS 1000
+#define MAX_RESTART_DELAY_MS 60000
+#define STABLE_RUN_MS 10000
+
+
+
+/* A memory file the helper can size, without a name in /dev/shm if possible */
+static gint
+create_ring_fd ()
+{
+#ifdef HAVE_MEMFD_CREATE
+    const gint fd = memfd_create ("cpuwaterfall-ring", MFD_CLOEXEC);
+    if (fd >= 0)
+        return fd;
+#endif
+    const std::string name = xfce4::sprintf ("/cpuwaterfall-ring-%d-%u", (gint) getpid (), g_random_int ());
+    const gint fd2 = shm_open (name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd2 >= 0)
+        shm_unlink (name.c_str());
+    return fd2;
+}
+
+struct ChildSetup
+{
+    gint fds[3];                        /* Ring, kick and event */
+    bool pin;
+    cpu_set_t cpus;                     /* Housekeeping CPUs, if pin */
+};
+
+/* Runs in the child between fork() and exec(), after GLib has marked every
+ * descriptor but stdin, stdout and stderr close-on-exec: only fds survive.
+ * The CPU set is computed by the parent, reading sysfs is not safe here. */
+static void
+keep_fds_open (gpointer data)
+{
+    const ChildSetup *setup = (const ChildSetup*) data;
+    for (guint i = 0; i < 3; i++)
+        fcntl (setup->fds[i], F_SETFD, 0);
+    if (setup->pin)
+        sched_setaffinity (0, sizeof (setup->cpus), &setup->cpus);
+}
+
+/* Reaps a helper which outlived stop() */
+static void
+helper_exited (GPid pid, gint status, gpointer data)
+{
+    g_info ("sampler helper %d reaped", (gint) pid);
+    g_spawn_close_pid (pid);
+}
+
+
+
+/*
+ * CPU usage sampled by cpuwaterfall-sampler. Every tick the plugin kicks
+ * the helper and consumes the frames it published since the previous
+ * tick, so the waterfall lags one tick behind. If the helper stalls on
+ * /proc or dies, the rows get no sample, which draws a gap, and a dead
+ * helper is restarted.
+ */
+struct HelperSource : DataSource
+{
+    GPid pid = 0;
+    gint ring_fd = -1, kick_fd = -1, event_fd = -1;
+    void *ring = NULL;
+    gsize ring_size = 0;
+    gint64 started = 0;
+    gint64 next_start = 0;
+    gint restart_delay_ms = RESTART_DELAY_MS;
+
+    std::vector<guint32> cpu_ids = {CWF_ROW_AGGREGATE};    /* By row */
+    std::vector<guint32> pending_ids;                       /* From a new ring, applied by update_layout() */
+    guint64 next_frame = 0;
+    std::vector<gchar> copy;
+    std::vector<guint64> used, total;
+    std::vector<guint32> ticks;
+
+    ~HelperSource() override { stop (); }
+
+    guint num_rows () const override { return cpu_ids.size(); }
+    gint row_cpu (guint row) const override { return row == 0 ? -1 : (gint) cpu_ids[row]; }
+    Ptr0<Topology> topology () const override { return read_topology ("/sys"); }
+    bool local_topology () const override { return true; }
+
+    std::string
+    row_name (guint row) const override
+    {
+        return row == 0 ? _("Usage") : xfce4::sprintf (_("CPU %u"), cpu_ids[row]);
+    }
+
+    std::string
+    format_value (gfloat value) const override
+    {
+        return isnan (value) ? "-" : xfce4::sprintf ("%u%%", (guint) roundf (value * 100));
+    }
+
+    bool
+    update_layout () override
+    {
+        if (pending_ids.empty() || pending_ids == cpu_ids)
+            return false;
+        cpu_ids = pending_ids;
+        return true;
+    }
+
+    bool start ();
+    void stop ();
+    bool map_ring ();
+    bool sample (gfloat *frame) override;
+
+    bool
+    sample_ticks (guint32 *out) const override
+    {
+        std::copy (ticks.begin(), ticks.end(), out);
+        return true;
+    }
+
+    /* The sums of the frames of the ring, which are exact below 2^14 ticks per frame and row */
+    bool
+    sample_deltas (guint64 *out_used, guint64 *out_total) const override
+    {
+        std::copy (used.begin(), used.end(), out_used);
+        std::copy (total.begin(), total.end(), out_total);
+        return true;
+    }
+};
+
+bool
+HelperSource::start ()
+{
+    ring_fd = create_ring_fd ();
+    kick_fd = eventfd (0, EFD_CLOEXEC);
+    event_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (ring_fd < 0 || kick_fd < 0 || event_fd < 0)
+    {
+        g_warning ("cannot set up the sampler helper: %s", g_strerror (errno));
+        stop ();
+        return false;
+    }
+
+    const gchar *path = g_getenv ("CPUWATERFALL_SAMPLER");
+    const std::string program = path ? path : HELPER_DIR "/cpuwaterfall-sampler";
+    const std::string ring_arg = xfce4::sprintf ("%d", ring_fd);
+    const std::string kick_arg = xfce4::sprintf ("%d", kick_fd);
+    const std::string event_arg = xfce4::sprintf ("%d", event_fd);
+    gchar *argv[] = {
+        (gchar*) program.c_str(),
+        (gchar*) "-r", (gchar*) ring_arg.c_str(),
+        (gchar*) "-k", (gchar*) kick_arg.c_str(),
+        (gchar*) "-e", (gchar*) event_arg.c_str(),
+        NULL
+    };
+    ChildSetup setup = {{ring_fd, kick_fd, event_fd}, false, {}};
+    setup.pin = housekeeping_cpus (setup.cpus);
+
+    GError *error = NULL;
+    if (!g_spawn_async (NULL, argv, NULL, G_SPAWN_DO_NOT_REAP_CHILD,
+                        keep_fds_open, &setup, &pid, &error))
+    {
+        g_warning ("cannot start %s: %s", program.c_str(), error->message);
+        g_error_free (error);
+        pid = 0;
+        stop ();
+        return false;
+    }
+
+    started = g_get_monotonic_time ();
+    g_info ("sampler helper started, pid %d", (gint) pid);
+
+    /* Ask for the first frame */
+    const guint64 one = 1;
+    if (write (kick_fd, &one, sizeof (one)) != sizeof (one))
+        g_warning ("cannot kick the sampler helper: %s", g_strerror (errno));
+    return true;
+}
+
+void
+HelperSource::stop ()
+{
+    if (pid > 0)
+    {
+        /* A helper stuck on /proc only dies once it leaves the kernel.
+         * It holds no state, and is reaped by the main loop whenever it exits. */
+        kill (pid, SIGKILL);
+        if (waitpid (pid, NULL, WNOHANG) == pid)
+            g_spawn_close_pid (pid);
+        else
+            g_child_watch_add (pid, helper_exited, NULL);
+        pid = 0;
+    }
+    if (ring)
+        munmap (ring, ring_size);
+    ring = NULL;
+    ring_size = 0;
+    for (gint *fd : {&ring_fd, &kick_fd, &event_fd})
+    {
+        if (*fd >= 0)
+            close (*fd);
+        *fd = -1;
+    }
+}
+
+/* The helper sizes the ring once it knows the CPUs; until then there is nothing to map */
+bool
+HelperSource::map_ring ()
+{
+    struct stat st;
+    if (fstat (ring_fd, &st) != 0 || st.st_size < (off_t) sizeof (cwf_ring_header))
+        return false;
+
+    void *map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, ring_fd, 0);
+    if (map == MAP_FAILED)
+        return false;
+    if (__atomic_load_n (&((const cwf_ring_header*) map)->magic, __ATOMIC_ACQUIRE) != CWF_RING_MAGIC ||
+        !cwf_ring_check (map, st.st_size))
+    {
+        munmap (map, st.st_size);
+        return false;
+    }
+
+    ring = map;
+    ring_size = st.st_size;
+    const cwf_ring_header *header = (const cwf_ring_header*) ring;
+    const uint32_t *ids = cwf_ring_cpu_ids (ring);
+    pending_ids.assign (ids, ids + header->num_rows);
+    next_frame = cwf_ring_head (ring) > header->num_slots ? cwf_ring_head (ring) - header->num_slots : 0;
+    copy.resize (header->slot_size);
+    return true;
+}
+
+bool
+HelperSource::sample (gfloat *frame)
+{
+    const gint64 now = g_get_monotonic_time ();
+    const guint num_rows = cpu_ids.size();
+
+    if (pid > 0)
+    {
+        gint status;
+        if (waitpid (pid, &status, WNOHANG) == pid)
+        {
+            g_warning ("sampler helper %d exited with status %d", (gint) pid, status);
+            g_spawn_close_pid (pid);
+            pid = 0;
+            stop ();
+
+            /* A helper which keeps dying right away is restarted less and less often */
+            if (now - started < STABLE_RUN_MS * (gint64) 1000)
+                restart_delay_ms = MIN (2 * restart_delay_ms, MAX_RESTART_DELAY_MS);
+            else
+                restart_delay_ms = RESTART_DELAY_MS;
+            next_start = now + restart_delay_ms * (gint64) 1000;
+        }
+    }
+    if (pid == 0 && now >= next_start && !start ())
+        next_start = now + MAX_RESTART_DELAY_MS * (gint64) 1000;
+
+    used.assign (num_rows, 0);
+    total.assign (num_rows, 0);
+    if (pid > 0 && (ring || map_ring ()) && pending_ids == cpu_ids)
+    {
+        guint64 events;
+        if (read (event_fd, &events, sizeof (events)) == sizeof (events))
+        {
+            const cwf_ring_header *header = (const cwf_ring_header*) ring;
+            const guint64 head = cwf_ring_head (ring);
+            if (head - next_frame > header->num_slots)
+                next_frame = head - header->num_slots;
+
+            for (; next_frame < head; next_frame++)
+            {
+                if (!cwf_ring_read (ring, next_frame, copy.data()))
+                    continue;
+                const uint32_t *frame_ticks = cwf_slot_ticks ((struct cwf_ring_slot*) copy.data(), num_rows);
+                for (guint row = 0; row < num_rows; row++)
+                {
+                    used[row] += ticks_used (frame_ticks[row]);
+                    total[row] += ticks_total (frame_ticks[row]);
+                }
+            }
+        }
+
+        /* Ask for the next frame */
+        const guint64 one = 1;
+        if (write (kick_fd, &one, sizeof (one)) != sizeof (one))
+            g_warning ("cannot kick the sampler helper: %s", g_strerror (errno));
+    }
+
+    ticks.resize (num_rows);
+    for (guint row = 0; row < num_rows; row++)
+    {
+        ticks[row] = encode_ticks (used[row], total[row]);
+        frame[row] = total[row] ? (gfloat) used[row] / total[row] : NAN;
+    }
+    return true;
+}
+
+
+
+Ptr0<DataSource>
+create_helper_source (const std::string &options)
+{
+    auto source = xfce4::make<HelperSource>();
+    if (!source->start ())
+        return nullptr;
+    return source;
+}
+
+#else
+
+Ptr0<DataSource>
+create_helper_source (const std::string &options)
+{
+    g_warning ("the sampler helper is only supported on Linux");
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,620 @@
+/*  history.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "history.h"
+
+/* Span and capacity of the tiers: 8.5 minutes of seconds, 85 minutes of 10 s and 34 hours of minutes */
+static const struct {
+    gint64 span;
+    gssize cap_pow2;
+} tier_sizes[NUM_HISTORY_TIERS] = {
+    {G_USEC_PER_SEC, 512},
+    {10 * G_USEC_PER_SEC, 512},
+    {60 * G_USEC_PER_SEC, 2048},
+};
+
+#define HISTORY_FILE_MAGIC   0x48465743u    /* "CWFH" */
+#define HISTORY_FILE_VERSION 4
+
+/*
+ * The storage: this header, the starts, levels, sums and open accumulators
+ * of every tier, each aligned to 64 bytes, then the ring of ticks. The file
+ * has the byte order and the alignment of the machine. The offsets are
+ * copied into the header after every tick.
+ */
+struct HistoryFileHeader
+{
+    guint32 magic;
+    guint32 version;
+    guint32 num_rows;
+    guint32 format;
+    guint64 layout_id;
+    guint64 size;                   /* Of the storage, in bytes */
+    gint64 cap_pow2;
+    gint64 offset;
+    struct {
+        gint64 span;
+        gint64 cap_pow2;
+        gint64 offset;
+        gint64 open_start;
+    } tiers[NUM_HISTORY_TIERS];
+};
+
+/* Positions in the storage */
+struct StorageLayout
+{
+    gsize starts[NUM_HISTORY_TIERS], levels[NUM_HISTORY_TIERS], sums[NUM_HISTORY_TIERS], open[NUM_HISTORY_TIERS];
+    gsize ring, tick_size;
+    gsize size;
+};
+
+
+
+History::~History()
+{
+    clear_history (*this);
+}
+
+static guint
+format_value_size (HistoryFormat format)
+{
+    switch (format)
+    {
+        case HISTORY_8BIT:  return sizeof (guint8);
+        case HISTORY_16BIT: return sizeof (guint16);
+        default:            return sizeof (guint32);
+    }
+}
+
+static StorageLayout
+storage_layout (guint num_rows, guint value_size, gssize cap_pow2)
+{
+    StorageLayout layout;
+    gsize size = 0;
+    const auto reserve = [&size](gsize bytes) {
+        const gsize at = size;
+        size = (size + bytes + 63) & ~(gsize) 63;
+        return at;
+    };
+
+    reserve (sizeof (HistoryFileHeader));
+    for (guint i = 0; i < NUM_HISTORY_TIERS; i++)
+    {
+        layout.starts[i] = reserve (tier_sizes[i].cap_pow2 * sizeof (gint64));
+        layout.levels[i] = reserve (tier_sizes[i].cap_pow2 * 2 * (gsize) num_rows);
+        layout.sums[i] = reserve (tier_sizes[i].cap_pow2 * (gsize) num_rows * sizeof (TierSums));
+        layout.open[i] = reserve (num_rows * sizeof (TierAccumulator));
+    }
+    layout.tick_size = (sizeof (gint64) + num_rows * (gsize) value_size + 7) & ~(gsize) 7;
+    layout.ring = size;
+    layout.size = size + cap_pow2 * layout.tick_size;
+    return layout;
+}
+
+/* Points the arrays of the history into the storage */
+static void
+attach_storage (History &history, HistoryFileHeader *header, const StorageLayout &layout, bool mapped)
+{
+    guint8 *storage = (guint8*) header;
+    history.header = header;
+    history.storage_size = layout.size;
+    history.mapped = mapped;
+    history.ring = storage + layout.ring;
+    history.tick_size = layout.tick_size;
+    for (guint i = 0; i < NUM_HISTORY_TIERS; i++)
+    {
+        HistoryTier &tier = history.tiers[i];
+        tier.span = tier_sizes[i].span;
+        tier.cap_pow2 = tier_sizes[i].cap_pow2;
+        tier.starts = (gint64*) (storage + layout.starts[i]);
+        tier.levels = storage + layout.levels[i];
+        tier.sums = (TierSums*) (storage + layout.sums[i]);
+        tier.open = (TierAccumulator*) (storage + layout.open[i]);
+    }
+}
+
+/* Copies the offsets into the header, so that the file can be restored at any time */
+static void
+publish_offsets (History &history)
+{
+    HistoryFileHeader *header = history.header;
+    header->offset = history.offset;
+    for (guint i = 0; i < NUM_HISTORY_TIERS; i++)
+    {
+        header->tiers[i].offset = history.tiers[i].offset;
+        header->tiers[i].open_start = history.tiers[i].open_start;
+    }
+}
+
+static void
+free_storage (History &history)
+{
+    if (history.header)
+        munmap (history.header, history.storage_size);
+    history.header = nullptr;
+    history.storage_size = 0;
+    history.mapped = false;
+    history.ring = nullptr;
+    history.tick_size = 0;
+    for (HistoryTier &tier : history.tiers)
+        tier = HistoryTier();
+}
+
+/* A zeroed file of size bytes replacing the one at path, mapped. NULL on failure. */
+static HistoryFileHeader *
+create_file (const std::string &path, gsize size)
+{
+    const std::string tmp_path = path + ".new";
+    const int fd = open (tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return nullptr;
+
+    void *mapping = MAP_FAILED;
+    if (ftruncate (fd, size) == 0)
+        mapping = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    const int saved_errno = errno;
+    close (fd);
+
+    if (mapping != MAP_FAILED && rename (tmp_path.c_str(), path.c_str()) == 0)
+        return (HistoryFileHeader*) mapping;
+
+    if (mapping != MAP_FAILED)
+        munmap (mapping, size);
+    else
+        errno = saved_errno;
+    unlink (tmp_path.c_str());
+    return nullptr;
+}
+
+/* The file at path, mapped, if its header matches the rows, and its layout. NULL otherwise. */
+static HistoryFileHeader *
+open_file (const std::string &path, guint64 layout_id, HistoryFormat format, guint num_rows,
+           StorageLayout &layout, gssize &cap_pow2)
+{
+    const int fd = open (path.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    void *mapping = MAP_FAILED;
+    struct stat st;
+    if (fstat (fd, &st) == 0 && st.st_size >= (off_t) sizeof (HistoryFileHeader))
+        mapping = mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close (fd);
+    if (mapping == MAP_FAILED)
+        return nullptr;
+
+    /* Any capacity will do, the caller resizes it */
+    const HistoryFileHeader *h = (const HistoryFileHeader*) mapping;
+    cap_pow2 = h->cap_pow2;
+    bool valid = h->magic == HISTORY_FILE_MAGIC && h->version == HISTORY_FILE_VERSION &&
+                 h->num_rows == num_rows && h->format == (guint32) format && h->layout_id == layout_id &&
+                 cap_pow2 > 0 && (cap_pow2 & (cap_pow2 - 1)) == 0 && h->offset >= 0 && h->offset < cap_pow2;
+    if (valid)
+    {
+        layout = storage_layout (num_rows, format_value_size (format), cap_pow2);
+        valid = h->size == layout.size && (gsize) st.st_size == layout.size;
+    }
+    for (guint i = 0; i < NUM_HISTORY_TIERS && valid; i++)
+        valid = h->tiers[i].span == tier_sizes[i].span && h->tiers[i].cap_pow2 == tier_sizes[i].cap_pow2 &&
+                h->tiers[i].offset >= 0 && h->tiers[i].offset < tier_sizes[i].cap_pow2;
+
+    if (!valid)
+    {
+        munmap (mapping, st.st_size);
+        return nullptr;
+    }
+    return (HistoryFileHeader*) mapping;
+}
+
+static void
+open_entry (HistoryTier &tier, guint num_rows, gint64 start)
+{
+    tier.open_start = start;
+    for (guint row = 0; row < num_rows; row++)
+    {
+        TierAccumulator &acc = tier.open[row];
+        acc.used = 0;
+        acc.total = 0;
+        acc.min = HISTORY_GAP;
+        acc.max = 0;
+    }
+}
+
+void
+clear_history (History &history)
+{
+    free_storage (history);
+    reset_archive (history.archive, 0);
+    history.cap_pow2 = 0;
+    history.offset = 0;
+}
+
+bool
+reallocate_history (History &history, HistoryFormat format, guint num_rows, gssize cap_pow2)
+{
+    const guint value_size = format_value_size (format);
+    const StorageLayout layout = storage_layout (num_rows, value_size, cap_pow2);
+    const bool use_file = !history.path.empty() && history.layout_id != 0;
+
+    /* Left by the previous instance of the plugin, and taken as it is */
+    if (use_file && history.empty())
+    {
+        StorageLayout file_layout;
+        gssize file_cap;
+        HistoryFileHeader *header = open_file (history.path, history.layout_id, format, num_rows, file_layout, file_cap);
+        if (header)
+        {
+            attach_storage (history, header, file_layout, true);
+            reset_archive (history.archive, num_rows);
+            history.num_rows = num_rows;
+            history.format = format;
+            history.value_size = value_size;
+            history.cap_pow2 = file_cap;
+            history.offset = header->offset;
+            for (guint i = 0; i < NUM_HISTORY_TIERS; i++)
+            {
+                history.tiers[i].offset = header->tiers[i].offset;
+                history.tiers[i].open_start = header->tiers[i].open_start;
+            }
+            set_history_capacity (history, cap_pow2);
+            g_info ("history: restored from %s", history.path.c_str());
+            return true;
+        }
+    }
+
+    HistoryFileHeader *header = nullptr;
+    if (use_file && !(header = create_file (history.path, layout.size)))
+        g_warning ("cannot map the history to %s: %s", history.path.c_str(), g_strerror (errno));
+    const bool mapped = header != nullptr;
+    if (!header)
+    {
+        /* Anonymous, so that it can be resized in place and returned to the system */
+        void *storage = mmap (NULL, layout.size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (storage == MAP_FAILED)
+            g_error ("cannot allocate %" G_GSIZE_FORMAT " bytes of history", layout.size);
+        header = (HistoryFileHeader*) storage;
+    }
+
+    History next;
+    attach_storage (next, header, layout, mapped);
+
+    /* By age, the newest tick at position 0 where offset starts */
+    if (history.num_rows == num_rows && history.format == format)
+    {
+        for (gssize age = 0; age < history.cap_pow2 && age < cap_pow2; age++)
+            memcpy (next.ring + age * layout.tick_size, history.slot (age), layout.tick_size);
+    }
+
+    const bool keep_tiers = history.num_rows == num_rows && history.tiers[0].cap_pow2 != 0;
+    if (history.archive.num_rows != num_rows)
+        reset_archive (history.archive, num_rows);
+    for (guint i = 0; i < NUM_HISTORY_TIERS; i++)
+    {
+        HistoryTier &tier = next.tiers[i];
+        const gsize levels_size = tier.cap_pow2 * 2 * (gsize) num_rows;
+        const gsize sums_size = tier.cap_pow2 * (gsize) num_rows * sizeof (TierSums);
+        if (keep_tiers)
+        {
+            const HistoryTier &old = history.tiers[i];
+            tier.offset = old.offset;
+            memcpy (tier.starts, old.starts, tier.cap_pow2 * sizeof (gint64));
+            memcpy (tier.levels, old.levels, levels_size);
+            memcpy (tier.sums, old.sums, sums_size);
+            memcpy (tier.open, old.open, num_rows * sizeof (TierAccumulator));
+            tier.open_start = old.open_start;
+        }
+        else
+        {
+            memset (tier.levels, HISTORY_GAP, levels_size);
+            memset (tier.sums, 0, sums_size);
+            open_entry (tier, num_rows, 0);
+        }
+    }
+
+    free_storage (history);
+    attach_storage (history, header, layout, mapped);
+    for (guint i = 0; i < NUM_HISTORY_TIERS; i++)
+    {
+        history.tiers[i].offset = next.tiers[i].offset;
+        history.tiers[i].open_start = next.tiers[i].open_start;
+    }
+    next.header = nullptr;          /* Owned by history now */
+    next.mapped = false;
+
+    history.num_rows = num_rows;
+    history.format = format;
+    history.value_size = value_size;
+    history.cap_pow2 = cap_pow2;
+    history.offset = 0;
+
+    header->magic = HISTORY_FILE_MAGIC;
+    header->version = HISTORY_FILE_VERSION;
+    header->num_rows = num_rows;
+    header->format = format;
+    header->layout_id = history.layout_id;
+    header->size = layout.size;
+    header->cap_pow2 = cap_pow2;
+    for (guint i = 0; i < NUM_HISTORY_TIERS; i++)
+    {
+        header->tiers[i].span = history.tiers[i].span;
+        header->tiers[i].cap_pow2 = history.tiers[i].cap_pow2;
+    }
+    publish_offsets (history);
+    return false;
+}
+
+/* Resizes the storage to the layout, in place if the system allows it. Returns false if it did not. */
+static bool
+resize_storage (History &history, const StorageLayout &layout)
+{
+#ifdef MREMAP_MAYMOVE
+    const gsize old_size = history.storage_size;
+    int fd = -1;
+    if (history.mapped)
+    {
+        /* The file grows before the mapping, and shrinks after it */
+        fd = open (history.path.c_str(), O_RDWR | O_CLOEXEC);
+        if (fd < 0 || (layout.size > old_size && ftruncate (fd, layout.size) != 0))
+        {
+            if (fd >= 0)
+                close (fd);
+            return false;
+        }
+    }
+
+    void *storage = mremap (history.header, old_size, layout.size, MREMAP_MAYMOVE);
+    if (fd >= 0)
+    {
+        if (storage != MAP_FAILED && layout.size < old_size && ftruncate (fd, layout.size) != 0)
+            g_warning ("cannot truncate %s: %s", history.path.c_str(), g_strerror (errno));
+        close (fd);
+    }
+    if (storage == MAP_FAILED)
+        return false;
+
+    attach_storage (history, (HistoryFileHeader*) storage, layout, history.mapped);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void
+set_history_capacity (History &history, gssize cap_pow2)
+{
+    const gssize old_cap = history.cap_pow2;
+    if (history.empty() || cap_pow2 == old_cap)
+        return;
+
+    const StorageLayout layout = storage_layout (history.num_rows, history.value_size, cap_pow2);
+    const gsize tick_size = history.tick_size;
+
+    if (cap_pow2 > old_cap)
+    {
+        if (!resize_storage (history, layout))
+        {
+            reallocate_history (history, history.format, history.num_rows, cap_pow2);
+            return;
+        }
+
+        /* The grown part is zeroed. Either the oldest ticks, at the start of
+         * the ring, move after the old end, or the newest ones to the new end. */
+        guint8 *ring = history.ring;
+        const gssize oldest = history.offset;
+        const gssize newest = old_cap - history.offset;
+        if (oldest <= newest)
+        {
+            memcpy (ring + old_cap * tick_size, ring, oldest * tick_size);
+            memset (ring, 0, oldest * tick_size);
+        }
+        else
+        {
+            memcpy (ring + (cap_pow2 - newest) * tick_size, ring + history.offset * tick_size, newest * tick_size);
+            memset (ring + history.offset * tick_size, 0, newest * tick_size);
+            history.offset += cap_pow2 - old_cap;
+        }
+    }
+    else
+    {
+        /* The newest ticks keep their position modulo the new capacity: those
+         * beyond it move to the start of the ring, then the rest is returned */
+        guint8 *ring = history.ring;
+        const gssize mask = cap_pow2 - 1;
+        for (gssize age = 0; age < cap_pow2;)
+        {
+            const gssize pos = (history.offset + age) & (old_cap - 1);
+            const gssize run = MIN (cap_pow2 - age, cap_pow2 - (pos & mask));
+            if (pos >= cap_pow2)
+                memcpy (ring + (pos & mask) * tick_size, ring + pos * tick_size, run * tick_size);
+            age += run;
+        }
+        history.offset &= mask;
+
+        /* If it fails, the storage stays larger than needed */
+        resize_storage (history, layout);
+    }
+
+    history.cap_pow2 = cap_pow2;
+    history.header->cap_pow2 = cap_pow2;
+    history.header->size = history.storage_size;
+    publish_offsets (history);
+}
+
+void
+sync_history (const History &history)
+{
+    if (history.mapped)
+        msync (history.header, history.storage_size, MS_ASYNC);
+}
+
+/* Closes the open entry of a tier and adds it to the open entry of the next one */
+static void
+close_entry (History &history, guint t)
+{
+    const guint num_rows = history.num_rows;
+    HistoryTier &tier = history.tiers[t];
+
+    tier.offset = (tier.offset - 1) & tier.mask();
+    tier.starts[tier.offset] = tier.open_start;
+    guint8 *min = tier.levels + tier.offset * 2 * (gsize) num_rows;
+    guint8 *max = min + num_rows;
+    TierSums *sums = tier.sums + tier.offset * (gsize) num_rows;
+    for (guint row = 0; row < num_rows; row++)
+    {
+        const TierAccumulator &acc = tier.open[row];
+        min[row] = acc.min;
+        max[row] = acc.total ? acc.max : HISTORY_GAP;
+        sums[row].used = acc.used;
+        sums[row].total = acc.total;
+    }
+
+    if (t + 1 < NUM_HISTORY_TIERS)
+    {
+        HistoryTier &next = history.tiers[t + 1];
+        const gint64 start = tier.open_start - tier.open_start % next.span;
+        if (next.open_start != start)
+        {
+            if (next.open_start != 0)
+                close_entry (history, t + 1);
+            open_entry (next, num_rows, start);
+        }
+        for (guint row = 0; row < num_rows; row++)
+        {
+            const TierAccumulator &acc = tier.open[row];
+            TierAccumulator &sum = next.open[row];
+            sum.used += acc.used;
+            sum.total += acc.total;
+            sum.min = MIN (sum.min, acc.min);
+            sum.max = MAX (sum.max, acc.max);
+        }
+    }
+}
+
+/* Adds the ticks of a frame to the open entry of the first tier */
+static void
+aggregate_tick (History &history, gint64 timestamp, const guint32 *ticks, const guint64 *used, const guint64 *total)
+{
+    const guint num_rows = history.num_rows;
+    HistoryTier &tier = history.tiers[0];
+
+    const gint64 start = timestamp - timestamp % tier.span;
+    if (tier.open_start != start)
+    {
+        if (tier.open_start != 0)
+            close_entry (history, 0);
+        open_entry (tier, num_rows, start);
+    }
+
+    for (guint row = 0; row < num_rows; row++)
+    {
+        const guint level = History::quantize_ticks (ticks[row], HISTORY_GAP);
+        if (level != HISTORY_GAP)
+        {
+            TierAccumulator &acc = tier.open[row];
+            acc.used += used ? used[row] : ticks_used (ticks[row]);
+            acc.total += total ? total[row] : ticks_total (ticks[row]);
+            acc.min = MIN (acc.min, level);
+            acc.max = MAX (acc.max, level);
+        }
+    }
+}
+
+void
+record_history (History &history, gint64 timestamp, const guint32 *ticks, const guint64 *used, const guint64 *total)
+{
+    aggregate_tick (history, timestamp, ticks, used, total);
+
+    if (history.archive.retention != 0)
+    {
+        guint8 *levels = archive_append (history.archive, timestamp);
+        for (guint row = 0; row < history.num_rows; row++)
+            levels[row] = History::quantize_ticks (ticks[row], HISTORY_GAP);
+    }
+
+    history.offset = (history.offset - 1) & history.mask();
+    guint8 *slot = history.slot (0);
+    *(gint64*) slot = timestamp;
+
+    void *frame = slot + sizeof (gint64);
+    switch (history.format)
+    {
+        case HISTORY_8BIT:
+            for (guint row = 0; row < history.num_rows; row++)
+                ((guint8*) frame)[row] = History::quantize_ticks (ticks[row], HISTORY_GAP);
+            break;
+        case HISTORY_16BIT:
+            for (guint row = 0; row < history.num_rows; row++)
+                ((guint16*) frame)[row] = History::quantize_ticks (ticks[row], HISTORY_GAP16);
+            break;
+        default:
+            memcpy (frame, ticks, history.num_rows * sizeof (guint32));
+    }
+
+    publish_offsets (history);
+}
+
+gsize
+history_bytes (const History &history)
+{
+    return history.storage_size + archive_bytes (history.archive);
+}
+
+bool
+history_tier_stats (const History &history, guint t, guint row, gint64 since,
+                    guint8 &min, guint8 &mean, guint8 &max)
+{
+    if (t >= NUM_HISTORY_TIERS || row >= history.num_rows)
+        return false;
+    const HistoryTier &tier = history.tiers[t];
+
+    guint64 used = 0, total = 0;
+    min = HISTORY_GAP;
+    max = 0;
+    for (gssize age = 0; age < tier.cap_pow2; age++)
+    {
+        const gint64 start = tier.start (age);
+        if (start == 0 || start < since)
+            break;
+        const TierSums &sums = tier.entry_sums (age, history.num_rows)[row];
+        if (sums.total == 0)
+            continue;
+        const guint8 *entry = tier.entry (age, history.num_rows);
+        min = MIN (min, entry[row]);
+        max = MAX (max, entry[history.num_rows + row]);
+        used += sums.used;
+        total += sums.total;
+    }
+
+    if (total == 0)
+        return false;
+    mean = (used * (HISTORY_GAP - 1) + total / 2) / total;
+    return true;
+}
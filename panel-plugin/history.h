@@ -0,0 +1,229 @@
+/*  history.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_HISTORY_H_
+#define _XFCE_CPUWATERFALL_HISTORY_H_
+
+#include <glib.h>
+#include <string>
+#include "archive.h"
+#include "loads.h"
+
+/* Storage of the history, the values are those of the "HistoryFormat" setting */
+enum HistoryFormat
+{
+    HISTORY_TICKS = 0,      /* Tick deltas in 32 bits, see encode_ticks(): exact up to 2^14 ticks, 14 significant bits above */
+    HISTORY_16BIT = 1,      /* Load quantized to 16 bits */
+    HISTORY_8BIT  = 2,      /* Load quantized to 8 bits */
+};
+
+/* Colour levels of the loads, from 0 to HISTORY_GAP-1 */
+#define HISTORY_LEVELS 256
+#define HISTORY_GAP    255  /* No sample */
+#define HISTORY_GAP16  G_MAXUINT16
+
+/* At the start of the storage, see history.cc */
+struct HistoryFileHeader;
+
+/* Aggregates of 1 s, 10 s and 1 min, each fed by the previous one */
+#define NUM_HISTORY_TIERS 3
+
+/* Of an entry of a tier, for each row */
+struct TierSums
+{
+    guint64 used, total;            /* Tick deltas summed over the entry, gaps excluded */
+};
+
+/* Of the entry of a tier being aggregated, for each row */
+struct TierAccumulator
+{
+    guint64 used, total;            /* See TierSums */
+    guint8 min, max;                /* Levels of the ticks */
+};
+
+/*
+ * Round-robin aggregates of the recorded ticks, RRD style. An entry
+ * covers span microseconds of wall-clock time, aligned to a multiple of
+ * span, and holds the minimum and maximum colour level of every row and
+ * its tick deltas summed over the span, in full, so that the mean of any
+ * number of entries is the exact ratio of their summed ticks. A tick only updates the open
+ * entry of the first tier, which is closed when a tick of the next span
+ * arrives and then added to the open entry of the next tier, so that the
+ * cost per tick is constant.
+ */
+struct HistoryTier
+{
+    gint64 span = 0;                /* Microseconds */
+    gssize cap_pow2 = 0;            /* Capacity in entries. A power of 2. */
+    gssize offset = 0;              /* Position of the newest closed entry */
+    gint64 *starts = nullptr;       /* Per entry: microseconds since 1970-01-01 UTC, or zero */
+    guint8 *levels = nullptr;       /* Per entry: num_rows minimums and num_rows maximums */
+    TierSums *sums = nullptr;       /* Per entry: num_rows sums */
+    gint64 open_start = 0;          /* Of the entry being aggregated, zero if none */
+    TierAccumulator *open = nullptr;    /* num_rows */
+
+    gssize mask() const                     { return cap_pow2 - 1; }
+
+    /* The entry closed age entries ago, 0 being the newest */
+    gint64 start (gssize age) const         { return starts[(offset + age) & mask()]; }
+    const guint8 *entry (gssize age, guint num_rows) const
+    {
+        return levels + ((offset + age) & mask()) * 2 * (gsize) num_rows;
+    }
+    const TierSums *entry_sums (gssize age, guint num_rows) const
+    {
+        return sums + ((offset + age) & mask()) * (gsize) num_rows;
+    }
+};
+
+/*
+ * The recorded frames, newest first, in a circular buffer of cap_pow2
+ * ticks. The layout is time-major: a tick is its timestamp, shared by all
+ * the rows, followed by the num_rows values, so that recording a frame and
+ * drawing the newest column each touch a single span of memory.
+ *
+ * The quantized formats keep only the load, rounded to HISTORY_GAP-1 or
+ * HISTORY_GAP16-1 steps, at a quarter or a half of the memory. Their
+ * averages over time weigh all the samples alike.
+ *
+ * The tiers and the ticks are stored in a single block, after a header
+ * holding the layout and the offsets. The ticks come last, so that the
+ * capacity changes in place. If path is set, the block is a shared
+ * mapping of that file: the ticks are recorded straight into it, and the
+ * next instance of the plugin with the same layout_id restores them.
+ */
+struct History
+{
+    gssize cap_pow2 = 0;            /* Capacity in ticks. A power of 2. */
+    gssize size = 0;                /* Ticks shown, size <= cap_pow2 */
+    gssize offset = 0;              /* Position of the newest tick. Range: from 0 to (cap_pow2 - 1) */
+    guint num_rows = 0;             /* Of every tick, the aggregate row 0 included */
+    HistoryFormat format = HISTORY_TICKS;
+    guint value_size = sizeof (guint32);    /* Bytes per row */
+    guint8 *ring = nullptr;         /* cap_pow2 ticks: timestamp in microseconds since 1970-01-01 UTC
+                                     * or zero, then num_rows values in the format */
+    gsize tick_size = 0;            /* Bytes per tick */
+    HistoryTier tiers[NUM_HISTORY_TIERS];
+    HistoryArchive archive;         /* Kept in memory only, while its retention is set */
+
+    std::string path;               /* Of the file mapped as the storage, empty to keep it in memory */
+    guint64 layout_id = 0;          /* Identifies the rows of the file, zero not to use the file */
+    HistoryFileHeader *header = nullptr;    /* Start of the storage */
+    gsize storage_size = 0;
+    bool mapped = false;            /* header is mapped from path */
+
+    gssize mask() const                     { return cap_pow2 - 1; }
+    bool empty() const                      { return cap_pow2 == 0; }
+
+    /* The tick recorded age ticks ago, 0 being the newest */
+    guint8 *slot (gssize age) const         { return ring + ((offset + age) & mask()) * tick_size; }
+    gint64 timestamp (gssize age) const     { return *(const gint64*) slot (age); }
+    const guint8 *frame (gssize age) const  { return slot (age) + sizeof (gint64); }
+
+    /* The colour level of a row of a frame */
+    guint8 level (const guint8 *frame, guint row) const
+    {
+        switch (format)
+        {
+            case HISTORY_8BIT:
+                return frame[row];
+            case HISTORY_16BIT:
+            {
+                const guint16 v = ((const guint16*) frame)[row];
+                return v == HISTORY_GAP16 ? HISTORY_GAP : (v * (HISTORY_GAP - 1) + (HISTORY_GAP16 - 1) / 2) / (HISTORY_GAP16 - 1);
+            }
+            default:
+                return quantize_ticks (((const guint32*) frame)[row], HISTORY_GAP);
+        }
+    }
+
+    /* Used and total of a row of a frame. The quantized formats give their steps. */
+    void row_ticks (const guint8 *frame, guint row, guint64 &used, guint64 &total) const
+    {
+        switch (format)
+        {
+            case HISTORY_8BIT:
+            {
+                const guint8 v = frame[row];
+                used = v == HISTORY_GAP ? 0 : v;
+                total = v == HISTORY_GAP ? 0 : HISTORY_GAP - 1;
+                break;
+            }
+            case HISTORY_16BIT:
+            {
+                const guint16 v = ((const guint16*) frame)[row];
+                used = v == HISTORY_GAP16 ? 0 : v;
+                total = v == HISTORY_GAP16 ? 0 : HISTORY_GAP16 - 1;
+                break;
+            }
+            default:
+                used = ticks_used (((const guint32*) frame)[row]);
+                total = ticks_total (((const guint32*) frame)[row]);
+        }
+    }
+
+    /* Load of encoded ticks rounded to gap-1 steps, or gap without a sample */
+    static guint quantize_ticks (guint32 ticks, guint gap)
+    {
+        const guint32 used = ticks & TICKS_MASK, total = ticks >> TICKS_BITS & TICKS_MASK;
+        return total ? (used * (gap - 1) + total / 2) / total : gap;
+    }
+
+    History() {}
+    History(const History&) = delete;
+    History& operator=(const History&) = delete;
+    ~History();
+};
+
+/*
+ * Sets the capacity and the format, keeping the newest ticks if the rows and
+ * the format stay the same. The tiers are kept as long as the rows stay the
+ * same. An empty history is restored from its file instead if the header of
+ * the file matches, in which case this returns true.
+ */
+bool reallocate_history (History &history, HistoryFormat format, guint num_rows, gssize cap_pow2);
+
+/*
+ * Sets the capacity, keeping the newest ticks. The storage is resized in
+ * place: growing moves the smaller of the two parts which wrap around the
+ * end of the ring, shrinking moves the kept ticks beyond the new end.
+ */
+void set_history_capacity (History &history, gssize cap_pow2);
+
+/* Drops all the ticks, the tiers, the archive and the storage. The file, if any, is left as it is. */
+void clear_history (History &history);
+
+/* Schedules the write of the mapped file to disk */
+void sync_history (const History &history);
+
+/* Prepends the num_rows tick deltas of a new tick. The tiers sum the exact deltas
+ * used and total if the source has them, the decoded ticks otherwise. */
+void record_history (History &history, gint64 timestamp, const guint32 *ticks,
+                     const guint64 *used = nullptr, const guint64 *total = nullptr);
+
+/* Bytes allocated, the tiers and the archive included */
+gsize history_bytes (const History &history);
+
+/*
+ * Minimum, mean and maximum level of a row over the closed entries of a
+ * tier which start at or after since. The mean is the ratio of the summed
+ * ticks. Returns false if there is none.
+ */
+bool history_tier_stats (const History &history, guint tier, guint row, gint64 since,
+                         guint8 &min, guint8 &mean, guint8 &max);
+
+#endif /* _XFCE_CPUWATERFALL_HISTORY_H_ */
@@ -0,0 +1,341 @@
+/*  io_batch.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include "io_batch.h"
+#include "os.h"
+
+#if defined (__linux__) && defined (HAVE_LINUX_IO_URING_H)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#define USE_IO_URING 1
+
+/* Since Linux 5.14 */
+#ifndef IORING_REGISTER_IOWQ_AFF
+#define IORING_REGISTER_IOWQ_AFF 17
+#endif
+#endif
+
+
+
+BatchReader::BatchReader ()
+{
+}
+
+BatchReader::~BatchReader ()
+{
+    ring_teardown ();
+}
+
+guint
+BatchReader::add (gint fd, guint size)
+{
+    Slot slot;
+    slot.fd = fd;
+    slot.offset = buffer.size();
+    slot.size = size;
+    slot.result = -1;
+    slots.push_back (slot);
+
+    buffer.resize (buffer.size() + size + 1);
+    registered = false;
+    return slots.size() - 1;
+}
+
+void
+BatchReader::clear ()
+{
+    slots.clear();
+    buffer.clear();
+    registered = false;
+}
+
+const gchar*
+BatchReader::data (guint slot) const
+{
+    const Slot &s = slots[slot];
+    return s.result >= 0 ? &buffer[s.offset] : NULL;
+}
+
+bool
+BatchReader::read_all ()
+{
+    if (slots.empty())
+        return true;
+
+    const gint64 start = g_get_monotonic_time ();
+
+    bool ok;
+    if (!ring_read_all ())
+    {
+        ok = true;
+        for (Slot &s : slots)
+        {
+            s.result = pread (s.fd, &buffer[s.offset], s.size, 0);
+            if (s.result < 0)
+                ok = false;
+            stats.syscalls++;
+        }
+    }
+    else
+    {
+        ok = true;
+        for (const Slot &s : slots)
+            if (s.result < 0)
+                ok = false;
+    }
+
+    for (const Slot &s : slots)
+        if (s.result >= 0)
+            buffer[s.offset + s.result] = '\0';
+
+    const gint64 elapsed = g_get_monotonic_time () - start;
+    stats.batches++;
+    stats.reads += slots.size();
+    stats.total_us += elapsed;
+    if (stats.max_us < elapsed)
+        stats.max_us = elapsed;
+
+    return ok;
+}
+
+
+
+#ifdef USE_IO_URING
+
+struct BatchReader::Ring
+{
+    guint entries;
+    void *sq_ptr, *cq_ptr;
+    gsize sq_size, cq_size;
+    struct io_uring_sqe *sqes;
+    gsize sqes_size;
+
+    guint *sq_tail, *sq_mask, *sq_array;
+    guint *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+bool
+BatchReader::ring_setup (guint entries)
+{
+    struct io_uring_params p;
+    memset (&p, 0, sizeof (p));
+
+    const gint fd = syscall (__NR_io_uring_setup, entries, &p);
+    if (fd < 0)
+    {
+        g_info ("io_uring unavailable (%s), reading files one by one", g_strerror (errno));
+        return false;
+    }
+
+    Ring *r = new Ring();
+    r->entries = p.sq_entries;
+    r->sq_size = p.sq_off.array + p.sq_entries * sizeof (guint);
+    r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof (struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->sq_size = r->cq_size = MAX (r->sq_size, r->cq_size);
+
+    r->sq_ptr = mmap (NULL, r->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cq_ptr = r->sq_ptr;
+    else
+        r->cq_ptr = mmap (NULL, r->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    r->sqes_size = p.sq_entries * sizeof (struct io_uring_sqe);
+    void *sqes = mmap (NULL, r->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+    ring = r;
+    ring_fd = fd;
+    if (r->sq_ptr == MAP_FAILED || r->cq_ptr == MAP_FAILED || sqes == MAP_FAILED)
+    {
+        r->sqes = (struct io_uring_sqe*) (sqes == MAP_FAILED ? NULL : sqes);
+        ring_teardown ();
+        return false;
+    }
+    r->sqes = (struct io_uring_sqe*) sqes;
+
+    gchar *sq = (gchar*) r->sq_ptr, *cq = (gchar*) r->cq_ptr;
+    r->sq_tail = (guint*) (sq + p.sq_off.tail);
+    r->sq_mask = (guint*) (sq + p.sq_off.ring_mask);
+    r->sq_array = (guint*) (sq + p.sq_off.array);
+    r->cq_head = (guint*) (cq + p.cq_off.head);
+    r->cq_tail = (guint*) (cq + p.cq_off.tail);
+    r->cq_mask = (guint*) (cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+
+    /* The kernel workers which complete blocking reads keep off the isolated and nohz_full CPUs.
+     * Older kernels run them anywhere. */
+    cpu_set_t cpus;
+    if (housekeeping_cpus (cpus))
+        syscall (__NR_io_uring_register, fd, IORING_REGISTER_IOWQ_AFF, &cpus, sizeof (cpus));
+
+    g_info ("io_uring batch reader: %u entries", r->entries);
+    return true;
+}
+
+void
+BatchReader::ring_teardown ()
+{
+    if (ring)
+    {
+        if (ring->sqes)
+            munmap (ring->sqes, ring->sqes_size);
+        if (ring->cq_ptr != MAP_FAILED && ring->cq_ptr != ring->sq_ptr)
+            munmap (ring->cq_ptr, ring->cq_size);
+        if (ring->sq_ptr != MAP_FAILED)
+            munmap (ring->sq_ptr, ring->sq_size);
+        delete ring;
+        ring = NULL;
+    }
+    if (ring_fd >= 0)
+        close (ring_fd);
+    ring_fd = -1;
+    registered = false;
+}
+
+bool
+BatchReader::ring_register ()
+{
+    /* Unregistering fails harmlessly if nothing is registered */
+    syscall (__NR_io_uring_register, ring_fd, IORING_UNREGISTER_FILES, NULL, 0);
+    syscall (__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+
+    std::vector<gint> fds;
+    for (const Slot &s : slots)
+        fds.push_back (s.fd);
+
+    struct iovec iov;
+    iov.iov_base = buffer.data();
+    iov.iov_len = buffer.size();
+
+    if (syscall (__NR_io_uring_register, ring_fd, IORING_REGISTER_FILES, fds.data(), fds.size()) != 0 ||
+        syscall (__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, &iov, 1) != 0)
+    {
+        g_info ("io_uring registration failed (%s), reading files one by one", g_strerror (errno));
+        return false;
+    }
+
+    registered = true;
+    return true;
+}
+
+/* Returns false if the reads have to be done without io_uring */
+bool
+BatchReader::ring_read_all ()
+{
+    if (ring_disabled)
+        return false;
+
+    if (ring_fd < 0 || ring->entries < slots.size())
+    {
+        ring_teardown ();
+        if (g_getenv ("CPUWATERFALL_NO_IO_URING") || !ring_setup (slots.size()))
+        {
+            ring_disabled = true;
+            return false;
+        }
+    }
+
+    if (!registered && !ring_register ())
+    {
+        ring_teardown ();
+        ring_disabled = true;
+        return false;
+    }
+
+    Ring *r = ring;
+    guint tail = *r->sq_tail;
+    for (guint i = 0; i < slots.size(); i++, tail++)
+    {
+        const guint index = tail & *r->sq_mask;
+        struct io_uring_sqe *sqe = &r->sqes[index];
+        memset (sqe, 0, sizeof (*sqe));
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->flags = IOSQE_FIXED_FILE;
+        sqe->fd = i;
+        sqe->addr = (guint64) (guintptr) &buffer[slots[i].offset];
+        sqe->len = slots[i].size;
+        sqe->off = 0;
+        sqe->buf_index = 0;
+        sqe->user_data = i;
+        r->sq_array[index] = index;
+        slots[i].result = -1;
+    }
+    __atomic_store_n (r->sq_tail, tail, __ATOMIC_RELEASE);
+
+    /* One system call submits all reads and waits for their completion */
+    guint completed = 0;
+    gint submitted = -1;
+    while (completed < slots.size())
+    {
+        const gint ret = syscall (__NR_io_uring_enter, ring_fd, submitted < 0 ? slots.size() : 0,
+                                  slots.size() - completed, IORING_ENTER_GETEVENTS, NULL, 0);
+        stats.syscalls++;
+        if (ret < 0 && errno != EINTR)
+        {
+            g_info ("io_uring_enter failed (%s), reading files one by one", g_strerror (errno));
+            ring_teardown ();
+            ring_disabled = true;
+            return false;
+        }
+        if (ret >= 0 && submitted < 0)
+        {
+            submitted = ret;
+            if (G_UNLIKELY ((guint) submitted != slots.size()))
+            {
+                g_info ("io_uring accepted %d of %zu reads, reading files one by one", submitted, slots.size());
+                ring_teardown ();
+                ring_disabled = true;
+                return false;
+            }
+        }
+
+        guint head = *r->cq_head;
+        const guint cq_tail = __atomic_load_n (r->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != cq_tail; head++)
+        {
+            const struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+            if (cqe->user_data < slots.size())
+                slots[cqe->user_data].result = cqe->res >= 0 ? cqe->res : -1;
+            completed++;
+        }
+        __atomic_store_n (r->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+#else
+
+bool BatchReader::ring_setup (guint entries) { return false; }
+void BatchReader::ring_teardown () {}
+bool BatchReader::ring_register () { return false; }
+bool BatchReader::ring_read_all () { return false; }
+
+#endif
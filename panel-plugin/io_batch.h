@@ -0,0 +1,91 @@
+/*  io_batch.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_IO_BATCH_H_
+#define _XFCE_CPUWATERFALL_IO_BATCH_H_
+
+#include <glib.h>
+#include <vector>
+
+#define BATCH_READ_SIZE 64      /* Enough for one number */
+
+/*
+ * Re-reads a fixed set of small sysfs and procfs files from offset 0,
+ * all of them in one go. On Linux the reads are submitted as a single
+ * io_uring batch with registered descriptors and buffers, so a tick costs
+ * one system call however many files are read. Without io_uring, or if
+ * CPUWATERFALL_NO_IO_URING is set, it falls back to one pread() per file.
+ */
+struct BatchReader
+{
+    struct Stats
+    {
+        guint64 batches;
+        guint64 reads;
+        guint64 syscalls;
+        gint64 total_us;        /* Time spent in read_all() */
+        gint64 max_us;
+    };
+
+    BatchReader ();
+    ~BatchReader ();
+
+    /* Registers a descriptor, which stays owned by the caller. Returns its slot. */
+    guint add (gint fd, guint size = BATCH_READ_SIZE);
+    void clear ();
+    bool empty () const { return slots.empty(); }
+
+    /* Reads all registered descriptors. Returns false if any read failed. */
+    bool read_all ();
+
+    /* Contents of a slot after read_all(), NUL-terminated. NULL if the read failed. */
+    const gchar* data (guint slot) const;
+    gssize length (guint slot) const { return slots[slot].result; }
+
+    bool uses_io_uring () const { return ring_fd >= 0; }
+
+    Stats stats = {};
+
+private:
+    struct Slot
+    {
+        gint fd;
+        guint offset;           /* In buffer */
+        guint size;             /* Without the terminating NUL */
+        gssize result;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<gchar> buffer;
+    bool registered = false;    /* Descriptors and buffer are registered with the ring */
+
+    /* io_uring state, see io_batch.cc. ring_fd < 0 if unused. */
+    struct Ring;
+    Ring *ring = NULL;
+    gint ring_fd = -1;
+    bool ring_disabled = false;
+
+    bool ring_setup (guint entries);
+    void ring_teardown ();
+    bool ring_register ();
+    bool ring_read_all ();
+
+    BatchReader (const BatchReader&) = delete;
+    BatchReader& operator= (const BatchReader&) = delete;
+};
+
+#endif /* _XFCE_CPUWATERFALL_IO_BATCH_H_ */
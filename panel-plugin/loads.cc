@@ -0,0 +1,163 @@
+/*  loads.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#include "loads.h"
+
+#if defined (__x86_64__) && defined (__GNUC__)
+#define HAVE_LOADS_AVX2 1
+#include <immintrin.h>
+#endif
+
+
+
+void
+compute_loads_scalar (const guint64 *used, const guint64 *total,
+                      guint64 *previous_used, guint64 *previous_total,
+                      gfloat *load, guint32 *ticks, gsize n)
+{
+    for (gsize i = 0; i < n; i++)
+    {
+        if (used[i] >= previous_used[i] && total[i] > previous_total[i])
+        {
+            load[i] = (gfloat) (used[i] - previous_used[i]) /
+                      (gfloat) (total[i] - previous_total[i]);
+            if (ticks)
+                ticks[i] = encode_ticks (used[i] - previous_used[i], total[i] - previous_total[i]);
+        }
+        else
+        {
+            load[i] = 0;
+            if (ticks)
+                ticks[i] = 0;
+        }
+
+        previous_used[i] = used[i];
+        previous_total[i] = total[i];
+    }
+}
+
+
+
+#ifdef HAVE_LOADS_AVX2
+/*
+ * Four CPUs per iteration. AVX2 has no 64-bit integer to floating point
+ * conversion, so the deltas are turned into doubles by placing them in
+ * the mantissa of 2^52. Chunks with a delta of 2^52 or more (only seen on
+ * the very first read, when the previous counters are still 0) take the
+ * scalar path. The counters are compared as signed numbers, they stay
+ * below 2^63.
+ */
+__attribute__ ((target ("avx2"))) static void
+compute_loads_avx2 (const guint64 *used, const guint64 *total,
+                    guint64 *previous_used, guint64 *previous_total,
+                    gfloat *load, guint32 *ticks, gsize n)
+{
+    const __m256d two52 = _mm256_set1_pd (4503599627370496.0);
+    const __m256i exponent = _mm256_castpd_si256 (two52);
+    const __m256i high = _mm256_set1_epi64x ((gint64) ~((G_GUINT64_CONSTANT (1) << 52) - 1));
+    const __m256i not_ticks = _mm256_set1_epi64x ((gint64) ~(guint64) TICKS_MASK);
+    const __m256i low_halves = _mm256_setr_epi32 (0, 2, 4, 6, 0, 2, 4, 6);
+
+    gsize i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m256i u = _mm256_loadu_si256 ((const __m256i*) (used + i));
+        const __m256i t = _mm256_loadu_si256 ((const __m256i*) (total + i));
+        const __m256i pu = _mm256_loadu_si256 ((const __m256i*) (previous_used + i));
+        const __m256i pt = _mm256_loadu_si256 ((const __m256i*) (previous_total + i));
+        const __m256i du = _mm256_sub_epi64 (u, pu);
+        const __m256i dt = _mm256_sub_epi64 (t, pt);
+
+        /* used >= previous_used && total > previous_total */
+        const __m256i valid = _mm256_andnot_si256 (_mm256_cmpgt_epi64 (pu, u), _mm256_cmpgt_epi64 (t, pt));
+
+        if (G_UNLIKELY (!_mm256_testz_si256 (_mm256_and_si256 (_mm256_or_si256 (du, dt), valid), high)))
+        {
+            compute_loads_scalar (used + i, total + i, previous_used + i, previous_total + i, load + i,
+                                  ticks ? ticks + i : NULL, 4);
+            continue;
+        }
+
+        const __m256d fu = _mm256_sub_pd (_mm256_castsi256_pd (_mm256_or_si256 (du, exponent)), two52);
+        const __m256d ft = _mm256_sub_pd (_mm256_castsi256_pd (_mm256_or_si256 (dt, exponent)), two52);
+        const __m256d ratio = _mm256_and_pd (_mm256_div_pd (fu, ft), _mm256_castsi256_pd (valid));
+
+        _mm_storeu_ps (load + i, _mm256_cvtpd_ps (ratio));
+        if (ticks)
+        {
+            /* Invalid lanes become 0/0. Deltas which fit need no shift.
+             * Used is clamped to total as in encode_ticks(), the used counter
+             * may advance more than the total when iowait goes backwards. */
+            const __m256i vt = _mm256_and_si256 (dt, valid);
+            const __m256i du_valid = _mm256_and_si256 (du, valid);
+            const __m256i vu = _mm256_blendv_epi8 (du_valid, vt, _mm256_cmpgt_epi64 (du_valid, vt));
+            if (G_LIKELY (_mm256_testz_si256 (vt, not_ticks)))
+            {
+                const __m256i packed = _mm256_or_si256 (vu, _mm256_slli_epi64 (vt, TICKS_BITS));
+                _mm_storeu_si128 ((__m128i*) (ticks + i),
+                                  _mm256_castsi256_si128 (_mm256_permutevar8x32_epi32 (packed, low_halves)));
+            }
+            else
+            {
+                guint64 lane_used[4], lane_total[4];
+                _mm256_storeu_si256 ((__m256i*) lane_used, vu);
+                _mm256_storeu_si256 ((__m256i*) lane_total, vt);
+                for (guint lane = 0; lane < 4; lane++)
+                    ticks[i + lane] = encode_ticks (lane_used[lane], lane_total[lane]);
+            }
+        }
+        _mm256_storeu_si256 ((__m256i*) (previous_used + i), u);
+        _mm256_storeu_si256 ((__m256i*) (previous_total + i), t);
+    }
+
+    compute_loads_scalar (used + i, total + i, previous_used + i, previous_total + i, load + i,
+                          ticks ? ticks + i : NULL, n - i);
+}
+#endif
+
+
+
+LoadsKernel
+loads_kernel_avx2 ()
+{
+#ifdef HAVE_LOADS_AVX2
+    if (__builtin_cpu_supports ("avx2"))
+        return compute_loads_avx2;
+#endif
+    return NULL;
+}
+
+static LoadsKernel
+widest_loads_kernel ()
+{
+    const LoadsKernel avx2 = loads_kernel_avx2 ();
+    return avx2 ? avx2 : compute_loads_scalar;
+}
+
+void
+compute_loads (const guint64 *used, const guint64 *total,
+               guint64 *previous_used, guint64 *previous_total,
+               gfloat *load, guint32 *ticks, gsize n)
+{
+    /* Initialized once, even though the sources are opened in worker threads */
+    static const LoadsKernel kernel = widest_loads_kernel ();
+    kernel (used, total, previous_used, previous_total, load, ticks, n);
+}
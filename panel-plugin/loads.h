@@ -0,0 +1,98 @@
+/*  loads.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_LOADS_H_
+#define _XFCE_CPUWATERFALL_LOADS_H_
+
+#include <glib.h>
+
+/*
+ * The used and total tick deltas of one sample, packed into 32 bits:
+ * 14 bits each and a 4-bit right shift applied to both. Deltas below
+ * 16384 are stored exactly, larger ones keep 14 significant bits, and the
+ * shift restores their magnitude. Unlike a ratio, such samples can be
+ * summed to get the exact utilization of a longer window.
+ * A total of 0 means that there is no sample.
+ */
+#define TICKS_BITS 14
+#define TICKS_MASK ((1u << TICKS_BITS) - 1)
+#define TICKS_MAX_SHIFT 15
+
+static inline guint32
+encode_ticks (guint64 used, guint64 total)
+{
+    guint shift = 0;
+    if (G_UNLIKELY (total > TICKS_MASK))
+    {
+        shift = 64 - __builtin_clzll (total) - TICKS_BITS;
+        if (G_UNLIKELY (shift > TICKS_MAX_SHIFT))
+        {
+            /* Far beyond any tick count, only the ratio is kept */
+            used = (guint64) ((gdouble) used / total * TICKS_MASK);
+            total = TICKS_MASK;
+            shift = TICKS_MAX_SHIFT;
+        }
+        else
+        {
+            used = (used + (G_GUINT64_CONSTANT (1) << (shift - 1))) >> shift;
+            total = MIN ((total + (G_GUINT64_CONSTANT (1) << (shift - 1))) >> shift, TICKS_MASK);
+        }
+    }
+    used = MIN (used, total);
+    return (guint32) used | (guint32) total << TICKS_BITS | shift << (2 * TICKS_BITS);
+}
+
+static inline guint64 ticks_used (guint32 ticks) { return (guint64) (ticks & TICKS_MASK) << (ticks >> (2 * TICKS_BITS)); }
+static inline guint64 ticks_total (guint32 ticks) { return (guint64) (ticks >> TICKS_BITS & TICKS_MASK) << (ticks >> (2 * TICKS_BITS)); }
+
+/* From 0.0 to 1.0, 0 without a sample */
+static inline gfloat
+ticks_ratio (guint32 ticks)
+{
+    const guint32 total = ticks >> TICKS_BITS & TICKS_MASK;
+    return total ? (gfloat) (ticks & TICKS_MASK) / total : 0;
+}
+
+/*
+ * One pass over the cumulative counters of all CPUs:
+ *
+ *   load[i] = (used[i] - previous_used[i]) / (total[i] - previous_total[i])
+ *
+ * or 0 where the used counter went backwards or the total did not advance.
+ * If ticks is not NULL, it receives the deltas as encode_ticks() does, or
+ * 0 where the load is 0 for lack of a valid sample. Afterwards
+ * previous_used and previous_total hold the current counters.
+ *
+ * The arrays are separate and contiguous so that several CPUs are handled
+ * per instruction. compute_loads() picks the widest variant the processor
+ * supports; the others are exposed for the benchmark.
+ */
+typedef void (*LoadsKernel) (const guint64 *used, const guint64 *total,
+                             guint64 *previous_used, guint64 *previous_total,
+                             gfloat *load, guint32 *ticks, gsize n);
+
+void compute_loads (const guint64 *used, const guint64 *total,
+                    guint64 *previous_used, guint64 *previous_total,
+                    gfloat *load, guint32 *ticks, gsize n);
+void compute_loads_scalar (const guint64 *used, const guint64 *total,
+                           guint64 *previous_used, guint64 *previous_total,
+                           gfloat *load, guint32 *ticks, gsize n);
+
+/* NULL if the processor or the compiler lacks it */
+LoadsKernel loads_kernel_avx2 ();
+
+#endif /* _XFCE_CPUWATERFALL_LOADS_H_ */
@@ -32,11 +32,19 @@
 #endif
 
 #include "os.h"
+#include "loads.h"
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -45,7 +53,12 @@ using xfce4::parse_ulong;
 
 #if defined (__linux__) || defined (__FreeBSD_kernel__)
 #define PROC_STAT "/proc/stat"
-#define PROCMAXLNLEN 256 /* should make it */
+#endif
+
+#if defined (__linux__)
+#include <pthread.h>
+#include <sched.h>
+#define PROC_DIR "/proc"
 #endif
 
 #if defined (__FreeBSD__)
@@ -79,68 +92,89 @@ using xfce4::parse_ulong;
 static kstat_ctl_t *kc;
 #endif
 
-#if defined (__linux__) || defined (__FreeBSD_kernel__)
-guint
-detect_cpu_number ()
+#if !defined (__linux__) && !defined (__FreeBSD_kernel__)
+/* The systems below only report the CPUs, row 0 is their mean */
+static void
+compute_cpu_loads (CpuRows &rows, gfloat *load)
 {
-    FILE *fstat = NULL;
-    if (!(fstat = fopen (PROC_STAT, "r")))
-        return 0;
+    const size_t nb_cpu = rows.size() - 1;
+    compute_loads (&rows.used[1], &rows.total[1], &rows.previous_used[1], &rows.previous_total[1],
+                   load + 1, &rows.ticks[1], nb_cpu);
 
-    guint nb_cpu = 0;
-    gchar cpuStr[PROCMAXLNLEN];
-    while (fgets (cpuStr, PROCMAXLNLEN, fstat))
+    guint64 used = 0, total = 0;
+    load[0] = 0;
+    for (size_t i = 1; i <= nb_cpu; i++)
     {
-        if (strncmp (cpuStr, "cpu", 3) != 0)
-            break;
+        load[0] += load[i];
+        used += ticks_used (rows.ticks[i]);
+        total += ticks_total (rows.ticks[i]);
+    }
+    load[0] /= nb_cpu;
+    rows.ticks[0] = encode_ticks (used, total);
+}
+#endif
 
-        gchar *s = cpuStr + 3;
+#if defined (__linux__) || defined (__FreeBSD_kernel__)
+#define BITS_PER_WORD (8 * sizeof (gulong))
+
+/* Returns the line after s, or the end of the string */
+static gchar*
+next_line (gchar *s)
+{
+    gchar *newline = strchr (s, '\n');
+    return newline ? newline + 1 : s + strlen (s);
+}
+
+/* The IDs of the "cpuN" lines, which only list the online CPUs */
+static bool
+detect_cpu_ids (std::vector<guint> &ids, xfce4::ReadBuffer &buffer, gint fd)
+{
+    if (!xfce4::reread_file (fd, buffer))
+        return false;
+
+    for (gchar *line = buffer.c_str(); strncmp (line, "cpu", 3) == 0; line = next_line (line))
+    {
+        gchar *s = line + 3;
         if (!g_ascii_isspace (*s))
-        {
-            gulong cpu = parse_ulong(&s);
-            nb_cpu = MAX(nb_cpu, cpu + 1);
-        }
+            ids.push_back (parse_ulong (&s));
     }
 
-    fclose (fstat);
-    return nb_cpu;
+    return true;
 }
 
 bool
-read_cpu_data (std::vector<CpuData> &data)
+read_cpu_data (CpuRows &rows, gfloat *load)
 {
-    if (G_UNLIKELY(data.size() == 0))
+    if (G_UNLIKELY(rows.size() == 0))
         return false;
 
-    const size_t nb_cpu = data.size()-1;
-    FILE *fStat;
-    gulong used[nb_cpu+1], total[nb_cpu+1];
-
-    if (!(fStat = fopen (PROC_STAT, "r")))
+    if (!xfce4::reread_file (rows.fd, rows.buffer))
         return false;
 
-    for (guint cpu = 0; cpu < nb_cpu+1; cpu++)
-        used[cpu] = total[cpu] = 0;
+    /* Each CPU listed below clears its bit. The counters of the others
+     * stay as they were, which gives them a load of 0. */
+    for (guint id : rows.ids)
+        rows.offline[id / BITS_PER_WORD] |= 1UL << (id % BITS_PER_WORD);
 
-    while (true)
+    for (gchar *line = rows.buffer.c_str(); strncmp (line, "cpu", 3) == 0; line = next_line (line))
     {
-        gchar cpuStr[PROCMAXLNLEN];
-        if (!fgets (cpuStr, PROCMAXLNLEN, fStat))
-        {
-            fclose (fStat);
-            return false;
-        }
-
-        if (strncmp (cpuStr, "cpu", 3) != 0)
-            break;
-
-        gchar *s = cpuStr + 3;
+        gchar *s = line + 3;
 
-        guint cpu;
+        gint row;
         if (g_ascii_isspace (*s))
-            cpu = 0;
+            row = 0;
         else
-            cpu = 1 + parse_ulong (&s);
+        {
+            const gulong id = parse_ulong (&s);
+            if (G_UNLIKELY (id >= rows.id_2_row.size()))
+                continue;
+            row = rows.id_2_row[id];
+            rows.offline[id / BITS_PER_WORD] &= ~(1UL << (id % BITS_PER_WORD));
+        }
+
+        /* A CPU which was not online when the rows were set up */
+        if (G_UNLIKELY (row < 0))
+            continue;
 
         gulong user = parse_ulong (&s);
         gulong nice = parse_ulong (&s);
@@ -150,32 +184,17 @@ read_cpu_data (std::vector<CpuData> &data)
         gulong irq = parse_ulong (&s);
         gulong softirq = parse_ulong (&s);
 
-        if (G_LIKELY (cpu < nb_cpu + 1))
-        {
-            used[cpu] = user + nice + system + irq + softirq;
-            total[cpu] = used[cpu] + idle + iowait;
-        }
-    }
-
-    fclose (fStat);
-
-    for (guint cpu = 0; cpu < nb_cpu + 1; cpu++)
-    {
-        if (used[cpu] >= data[cpu].previous_used && total[cpu] > data[cpu].previous_total)
-            data[cpu].load = (gfloat) (used[cpu] - data[cpu].previous_used) /
-                             (gfloat) (total[cpu] - data[cpu].previous_total);
-        else
-            data[cpu].load = 0;
-
-        data[cpu].previous_used = used[cpu];
-        data[cpu].previous_total = total[cpu];
+        rows.used[row] = user + nice + system + irq + softirq;
+        rows.total[row] = rows.used[row] + idle + iowait;
     }
 
+    compute_loads (rows.used.data(), rows.total.data(), rows.previous_used.data(), rows.previous_total.data(),
+                   load, rows.ticks.data(), rows.size());
     return true;
 }
 
 #elif defined (__FreeBSD__)
-guint
+static guint
 detect_cpu_number ()
 {
     static gint mib[] = {CTL_HW, HW_NCPU};
@@ -189,12 +208,12 @@ detect_cpu_number ()
 }
 
 bool
-read_cpu_data (std::vector<CpuData> &data)
+read_cpu_data (CpuRows &rows, gfloat *load)
 {
-    if (G_UNLIKELY(data.size() == 0))
+    if (G_UNLIKELY(rows.size() == 0))
         return false;
 
-    const size_t nb_cpu = data.size()-1;
+    const size_t nb_cpu = rows.size()-1;
     glong used, total;
     glong *cp_time;
     glong *cp_time1;
@@ -202,7 +221,6 @@ read_cpu_data (std::vector<CpuData> &data)
     unsigned int max_cpu;
     gsize len = sizeof (max_cpu);
 
-    data[0].load = 0;
     if (sysctlbyname ("kern.smp.maxid", &max_cpu, &len, NULL, 0) < 0)
         return false;
 
@@ -223,24 +241,17 @@ read_cpu_data (std::vector<CpuData> &data)
         used = cp_time1[CP_USER] + cp_time1[CP_NICE] + cp_time1[CP_SYS] + cp_time1[CP_INTR];
         total = used + cp_time1[CP_IDLE];
 
-        if (used >= (gint64) data[i].previous_used && total > (gint64) data[i].previous_total)
-            data[i].load = (gfloat) (used - data[i].previous_used) /
-                           (gfloat) (total - data[i].previous_total);
-        else
-            data[i].load = 0;
-
-        data[i].previous_used = used;
-        data[i].previous_total = total;
-        data[0].load += data[i].load;
+        rows.used[i] = used;
+        rows.total[i] = total;
     }
 
-    data[0].load /= nb_cpu;
+    compute_cpu_loads (rows, load);
     g_free (cp_time);
     return true;
 }
 
 #elif defined (__NetBSD__)
-guint
+static guint
 detect_cpu_number ()
 {
     static gint mib[] = {CTL_HW, HW_NCPU};
@@ -254,12 +265,12 @@ detect_cpu_number ()
 }
 
 bool
-read_cpu_data (std::vector<CpuData> &data)
+read_cpu_data (CpuRows &rows, gfloat *load)
 {
-    if (G_UNLIKELY(data.size() == 0))
+    if (G_UNLIKELY(rows.size() == 0))
         return false;
 
-    const size_t nb_cpu = data.size()-1;
+    const size_t nb_cpu = rows.size()-1;
     guint64 cp_time[CPUSTATES * nb_cpu];
     gsize len = nb_cpu * CPUSTATES * sizeof (guint64);
     gint mib[] = {CTL_KERN, KERN_CP_TIME};
@@ -267,30 +278,19 @@ read_cpu_data (std::vector<CpuData> &data)
     if (sysctl (mib, 2, &cp_time, &len, NULL, 0) < 0)
         return false;
 
-    data[0].load = 0;
     for (guint i = 1; i <= nb_cpu; i++)
     {
         guint64 *cp_time1 = cp_time + CPUSTATES * (i - 1);
-        guint64 used = cp_time1[CP_USER] + cp_time1[CP_NICE] + cp_time1[CP_SYS] + cp_time1[CP_INTR];
-        guint64 total = used + cp_time1[CP_IDLE];
-
-        if (used >= data[i].previous_used && total > data[i].previous_total)
-            data[i].load = (gfloat) (used - data[i].previous_used) /
-                           (gfloat) (total - data[i].previous_total);
-        else
-            data[i].load = 0;
-
-        data[i].previous_used = used;
-        data[i].previous_total = total;
-        data[0].load += data[i].load;
+        rows.used[i] = cp_time1[CP_USER] + cp_time1[CP_NICE] + cp_time1[CP_SYS] + cp_time1[CP_INTR];
+        rows.total[i] = rows.used[i] + cp_time1[CP_IDLE];
     }
 
-    data[0].load /= nb_cpu;
+    compute_cpu_loads (rows, load);
     return true;
 }
 
 #elif defined (__OpenBSD__)
-guint
+static guint
 detect_cpu_number ()
 {
     static gint mib[] = {CTL_HW, HW_NCPU};
@@ -304,14 +304,13 @@ detect_cpu_number ()
 }
 
 bool
-read_cpu_data (std::vector<CpuData> &data)
+read_cpu_data (CpuRows &rows, gfloat *load)
 {
-    if (G_UNLIKELY(data.size() == 0))
+    if (G_UNLIKELY(rows.size() == 0))
         return false;
 
-    const size_t nb_cpu = data.size()-1;
+    const size_t nb_cpu = rows.size()-1;
     guint64 cp_time[CPUSTATES];
-    data[0].load = 0;
 
     for (guint i = 1; i <= nb_cpu; i++)
     {
@@ -321,21 +320,11 @@ read_cpu_data (std::vector<CpuData> &data)
         if (sysctl (mib, 3, &cp_time, &len, NULL, 0) < 0)
             return false;
 
-        guint64 used = cp_time[CP_USER] + cp_time[CP_NICE] + cp_time[CP_SYS] + cp_time[CP_INTR];
-        guint64 total = used + cp_time[CP_IDLE];
-
-        if (used >= data[i].previous_used && total > data[i].previous_total)
-            data[i].load = (gfloat) (used - data[i].previous_used) /
-                           (gfloat) (total - data[i].previous_total);
-        else
-            data[i].load = 0;
-
-        data[i].previous_used = used;
-        data[i].previous_total = total;
-        data[0].load += data[i].load;
+        rows.used[i] = cp_time[CP_USER] + cp_time[CP_NICE] + cp_time[CP_SYS] + cp_time[CP_INTR];
+        rows.total[i] = rows.used[i] + cp_time[CP_IDLE];
     }
 
-    data[0].load /= nb_cpu;
+    compute_cpu_loads (rows, load);
     return true;
 }
 
@@ -346,7 +335,7 @@ init_stats ()
     kc = kstat_open ();
 }
 
-guint
+static guint
 detect_cpu_number ()
 {
     kstat_t *ksp;
@@ -365,15 +354,14 @@ detect_cpu_number ()
 }
 
 bool
-read_cpu_data (std::vector<CpuData> &data)
+read_cpu_data (CpuRows &rows, gfloat *load)
 {
-    if (G_UNLIKELY(data.size() == 0))
+    if (G_UNLIKELY(rows.size() == 0))
         return false;
 
-    const size_t nb_cpu = data.size()-1;
+    const size_t nb_cpu = rows.size()-1;
     kstat_t *ksp;
     kstat_named_t *knp;
-    data[0].load = 0;
 
     if (!kc)
         init_stats ();
@@ -394,65 +382,432 @@ read_cpu_data (std::vector<CpuData> &data)
             knp = kstat_data_lookup (ksp, "cpu_nsec_idle");
             guint64 total = used + knp->value.ul;
 
-            if (used >= data[i].previous_used && total > data[i].previous_total)
-                data[i].load = (gfloat) (used - data[i].previous_used) /
-                               (gfloat) (total - data[i].previous_total);
-            else
-                data[i].load = 0;
-
-            data[i].previous_used = used;
-            data[i].previous_total = total;
-            data[0].load += data[i].load;
+            if (G_LIKELY (i <= (gint) nb_cpu))
+            {
+                rows.used[i] = used;
+                rows.total[i] = total;
+            }
             i++;
         }
     }
 
-    data[0].load /= nb_cpu;
+    compute_cpu_loads (rows, load);
     return true;
 }
 #else
 #error "Your OS is not supported."
 #endif
 
+#if !defined (__linux__) && !defined (__FreeBSD_kernel__)
+/* The other systems number their CPUs without holes */
+static bool
+detect_cpu_ids (std::vector<guint> &ids, xfce4::ReadBuffer &buffer, gint fd)
+{
+    const guint nb_cpu = detect_cpu_number ();
+    for (guint id = 0; id < nb_cpu; id++)
+        ids.push_back (id);
+    return true;
+}
+#endif
+
+CpuRows::~CpuRows ()
+{
+    if (fd >= 0)
+        close (fd);
+}
+
+bool
+init_cpu_rows (CpuRows &rows, const gchar *proc_stat)
+{
+#ifdef PROC_STAT
+    rows.path = proc_stat ? proc_stat : PROC_STAT;
+    if (rows.fd >= 0)
+        close (rows.fd);
+    rows.fd = open (rows.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (rows.fd < 0)
+        return false;
+#endif
+
+    std::vector<guint> ids;
+    if (!detect_cpu_ids (ids, rows.buffer, rows.fd) || ids.empty())
+        return false;
+    std::sort (ids.begin(), ids.end());
+    ids.erase (std::unique (ids.begin(), ids.end()), ids.end());
+
+    /* Everything is sized here, the reads do not allocate */
+    const guint bits = 8 * sizeof (gulong);
+    rows.ids = ids;
+    rows.id_2_row.assign (ids.back() + 1, -1);
+    for (guint row = 0; row < ids.size(); row++)
+        rows.id_2_row[ids[row]] = row + 1;
+    rows.offline.assign ((ids.back() + bits) / bits, 0);
+    rows.used.assign (ids.size() + 1, 0);
+    rows.total.assign (ids.size() + 1, 0);
+    rows.previous_used.assign (ids.size() + 1, 0);
+    rows.previous_total.assign (ids.size() + 1, 0);
+    rows.ticks.assign (ids.size() + 1, 0);
+
+    if (ids.back() + 1 != ids.size())
+        g_info ("%u CPUs, highest CPU ID %u", (guint) ids.size(), ids.back());
+    return true;
+}
+
+
+
+/* Parses a file holding a single decimal number, as most sysfs files do */
+static bool
+parse_file_number (const xfce4::ReadBuffer &buffer, gint64 &value)
+{
+    const gchar *s = buffer.c_str();
+    gchar *end;
+    errno = 0;
+    value = g_ascii_strtoll (s, &end, 10);
+    if (errno != 0 || end == s)
+        return false;
+    while (g_ascii_isspace (*end))
+        end++;
+    return *end == '\0';
+}
+
+
+
+#if defined (__linux__)
+/* Removes the task from the per-CPU group it currently belongs to */
+static void
+task_index_unlink (TaskIndex &index, const TaskInfo &task)
+{
+    if (task.processor < 0 || (gsize) task.processor >= index.by_cpu.size())
+        return;
+
+    std::vector<gint> &group = index.by_cpu[task.processor];
+    const gint last = group.back();
+    group[task.slot] = last;
+    index.tasks[last].slot = task.slot;
+    group.pop_back();
+}
+
+static void
+task_index_link (TaskIndex &index, gint tid, TaskInfo &task)
+{
+    if (G_UNLIKELY ((gsize) task.processor >= index.by_cpu.size()))
+        index.by_cpu.resize(task.processor + 1);
+
+    std::vector<gint> &group = index.by_cpu[task.processor];
+    task.slot = group.size();
+    group.push_back(tid);
+}
+
+/* Skips the given number of space-separated fields */
+static const gchar*
+skip_fields (const gchar *s, guint n)
+{
+    while (n--)
+    {
+        while (*s == ' ')
+            s++;
+        while (*s && *s != ' ')
+            s++;
+    }
+    return s;
+}
+
+/*
+ * Parses /proc/<pid>/task/<tid>/stat. The second field (comm) is enclosed in parentheses
+ * and can itself contain spaces and parentheses, therefore the remaining fields
+ * are located relative to the last closing parenthesis.
+ */
+static bool
+parse_task_stat (const gchar *buf, std::string &comm, guint64 &ticks, gint &processor)
+{
+    const gchar *open = strchr (buf, '(');
+    const gchar *close = strrchr (buf, ')');
+    if (G_UNLIKELY (!open || !close || close < open))
+        return false;
+
+    /* Fields 3 (state) to 13 (cmajflt) */
+    const gchar *s = skip_fields (close + 1, 11);
+
+    gchar *end;
+    const guint64 utime = g_ascii_strtoull (s, &end, 10);
+    if (end == s)
+        return false;
+    s = end;
+    const guint64 stime = g_ascii_strtoull (s, &end, 10);
+    if (end == s)
+        return false;
+
+    /* Fields 16 (cutime) to 38 (exit_signal) */
+    s = skip_fields (end, 23);
+    const guint64 cpu = g_ascii_strtoull (s, &end, 10);
+    if (end == s || cpu > G_MAXINT)
+        return false;
+
+    comm.assign (open + 1, close - open - 1);
+    ticks = utime + stime;
+    processor = cpu;
+    return true;
+}
+
+bool
+read_task_data (TaskIndex &index)
+{
+    DIR *proc = opendir (PROC_DIR);
+    if (!proc)
+        return false;
+
+    const guint generation = ++index.generation;
+    const gint64 timestamp = g_get_monotonic_time ();
+    const gint64 interval = index.timestamp ? timestamp - index.timestamp : 0;
+    const gdouble ticks_per_interval = interval * (gdouble) sysconf (_SC_CLK_TCK) / G_USEC_PER_SEC;
+    std::string comm;
+
+    struct dirent *pid_entry;
+    while ((pid_entry = readdir (proc)) != NULL)
+    {
+        if (!g_ascii_isdigit (pid_entry->d_name[0]))
+            continue;
+
+        gchar path[64];
+        g_snprintf (path, sizeof (path), "%s/task", pid_entry->d_name);
+        const gint task_fd = openat (dirfd (proc), path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (task_fd < 0)
+            continue;
+
+        DIR *tasks = fdopendir (task_fd);
+        if (!tasks)
+        {
+            close (task_fd);
+            continue;
+        }
+
+        struct dirent *tid_entry;
+        while ((tid_entry = readdir (tasks)) != NULL)
+        {
+            if (!g_ascii_isdigit (tid_entry->d_name[0]))
+                continue;
+
+            g_snprintf (path, sizeof (path), "%s/stat", tid_entry->d_name);
+            if (!xfce4::read_file_at (task_fd, path, index.buffer))
+                continue;
+
+            guint64 ticks;
+            gint processor;
+            if (!parse_task_stat (index.buffer.c_str(), comm, ticks, processor))
+                continue;
+
+            const gint tid = atoi (tid_entry->d_name);
+            auto it = index.tasks.find (tid);
+            if (it == index.tasks.end())
+            {
+                TaskInfo &task = index.tasks[tid];
+                task.comm = comm;
+                task.previous_ticks = ticks;
+                task.delta = 0;
+                task.load = 0;
+                task.processor = processor;
+                task.generation = generation;
+                task_index_link (index, tid, task);
+            }
+            else
+            {
+                TaskInfo &task = it->second;
+                task.delta = ticks >= task.previous_ticks ? ticks - task.previous_ticks : 0;
+                task.load = ticks_per_interval > 0 ? task.delta / ticks_per_interval : 0;
+                task.previous_ticks = ticks;
+                task.generation = generation;
+                if (task.comm != comm)
+                    task.comm = comm;
+                if (task.processor != processor)
+                {
+                    task_index_unlink (index, task);
+                    task.processor = processor;
+                    task_index_link (index, tid, task);
+                }
+            }
+        }
+
+        closedir (tasks);
+    }
+
+    closedir (proc);
+
+    /* Forget tasks which have exited */
+    for (auto it = index.tasks.begin(); it != index.tasks.end();)
+    {
+        if (it->second.generation != generation)
+        {
+            task_index_unlink (index, it->second);
+            it = index.tasks.erase (it);
+        }
+        else
+            it++;
+    }
+
+    index.interval = interval;
+    index.timestamp = timestamp;
+    return true;
+}
+
+#else
+bool
+read_task_data (TaskIndex &index)
+{
+    return false;
+}
+#endif
+
+
+
+#if defined (__linux__)
+/*
+ * Parses a CPU list such as "0-3,8,10-11" and sets the given flag for each listed CPU.
+ * See also: https://www.kernel.org/doc/html/latest/admin-guide/cputopology.html
+ */
+static bool
+parse_cpu_list (const gchar *s, guint8 flag, std::vector<guint8> &flags)
+{
+    while (true)
+    {
+        while (g_ascii_isspace (*s))
+            s++;
+        if (*s == '\0')
+            return true;
+
+        gchar *end;
+        const guint64 first = g_ascii_strtoull (s, &end, 10);
+        if (end == s)
+            return false;
+        guint64 last = first;
+        s = end;
+        if (*s == '-')
+        {
+            s++;
+            last = g_ascii_strtoull (s, &end, 10);
+            if (end == s || last < first || last > G_MAXINT)
+                return false;
+            s = end;
+        }
+
+        if (flags.size() <= last)
+            flags.resize(last + 1);
+        for (guint64 cpu = first; cpu <= last; cpu++)
+            flags[cpu] |= flag;
+
+        if (*s == ',')
+            s++;
+    }
+}
+
+bool
+read_cpu_flags (const std::string &sysfs_root, std::vector<guint8> &flags)
+{
+    const std::string dir = sysfs_root + "/devices/system/cpu";
+    xfce4::ReadBuffer buffer;
+    bool ok = false;
+
+    flags.clear();
+    if (xfce4::read_file ((dir + "/isolated").c_str(), buffer))
+        ok |= parse_cpu_list (buffer.c_str(), CPU_FLAG_ISOLATED, flags);
+    if (xfce4::read_file ((dir + "/nohz_full").c_str(), buffer))
+        ok |= parse_cpu_list (buffer.c_str(), CPU_FLAG_NOHZ_FULL, flags);
+
+    return ok;
+}
+
+bool
+housekeeping_cpus (cpu_set_t &set)
+{
+    /* The affinity of the main thread, which the plugin leaves alone */
+    std::vector<guint8> flags;
+    if (!read_cpu_flags ("/sys", flags) || sched_getaffinity (getpid (), sizeof (set), &set) != 0)
+        return false;
+
+    bool changed = false;
+    for (gsize cpu = 0; cpu < flags.size() && cpu < CPU_SETSIZE; cpu++)
+    {
+        if (flags[cpu] && CPU_ISSET (cpu, &set))
+        {
+            CPU_CLR (cpu, &set);
+            changed = true;
+        }
+    }
+
+    /* Nothing to do, or no housekeeping CPU left */
+    return changed && CPU_COUNT (&set) != 0;
+}
+
+bool
+pin_thread_to_housekeeping_cpus ()
+{
+    cpu_set_t set;
+    return housekeeping_cpus (set) && pthread_setaffinity_np (pthread_self (), sizeof (set), &set) == 0;
+}
+
+#else
+bool
+read_cpu_flags (const std::string &sysfs_root, std::vector<guint8> &flags)
+{
+    flags.clear();
+    return false;
+}
+
+bool
+pin_thread_to_housekeeping_cpus ()
+{
+    return false;
+}
+#endif
 
 
 static Ptr0<Topology>
-read_topology_linux ()
+read_topology_linux (const std::string &sysfs_root)
 {
     std::unordered_set<gint> core_ids;
     std::unordered_map<guint, gint> logical_cpu_2_core;
+    std::unordered_map<guint, gint> logical_cpu_2_package;
     gint max_core_id = -1;
 
+    /* See also: https://www.kernel.org/doc/html/latest/admin-guide/cputopology.html */
+    const gint sysfs_dir = open ((sysfs_root + "/devices/system/cpu").c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (sysfs_dir < 0)
+        return nullptr;
+
+    /* The files of all CPUs are read into the same buffer */
+    xfce4::ReadBuffer buffer;
+    bool valid = true;
+
     guint num_online_logical_cpus = 0;
-    for (guint logical_cpu = 0; true; logical_cpu++)
+    for (guint logical_cpu = 0; valid; logical_cpu++)
     {
-        /* See also: https://www.kernel.org/doc/html/latest/admin-guide/cputopology.html */
-
-        const char *sysfs_base = "/sys/devices/system/cpu";
+        gchar path[64];
+        struct stat st;
 
-        if (!xfce4::is_directory (xfce4::sprintf ("%s/cpu%d", sysfs_base, logical_cpu)))
+        g_snprintf (path, sizeof (path), "cpu%u", logical_cpu);
+        if (fstatat (sysfs_dir, path, &st, 0) != 0 || !S_ISDIR (st.st_mode))
             break;
 
-        std::string file_contents;
-        if (xfce4::read_file (xfce4::sprintf ("%s/cpu%d/topology/core_id", sysfs_base, logical_cpu), file_contents))
+        g_snprintf (path, sizeof (path), "cpu%u/topology/core_id", logical_cpu);
+        if (xfce4::read_file_at (sysfs_dir, path, buffer))
         {
-            auto core_id_opt = xfce4::parse_long (file_contents, 10);
-            if (core_id_opt.has_value())
+            gint64 core_id;
+            if (parse_file_number (buffer, core_id) && G_LIKELY (core_id >= 0 && core_id <= G_MAXINT))
             {
-                auto core_id = core_id_opt.value();
-                if (G_LIKELY (core_id >= 0 && core_id <= G_MAXINT))
-                {
-                    num_online_logical_cpus++;
-                    core_ids.insert(core_id);
-                    logical_cpu_2_core[logical_cpu] = core_id;
-                    if (max_core_id < core_id)
-                        max_core_id = core_id;
-                }
-                else
-                    return nullptr;
+                num_online_logical_cpus++;
+                core_ids.insert(core_id);
+                logical_cpu_2_core[logical_cpu] = core_id;
+                if (max_core_id < core_id)
+                    max_core_id = core_id;
+
+                gint package = 0;
+                gint64 package_id;
+                g_snprintf (path, sizeof (path), "cpu%u/topology/physical_package_id", logical_cpu);
+                if (xfce4::read_file_at (sysfs_dir, path, buffer) && parse_file_number (buffer, package_id) &&
+                    package_id >= 0 && package_id <= G_MAXINT)
+                    package = package_id;
+                logical_cpu_2_package[logical_cpu] = package;
             }
             else
-                return nullptr;
+                valid = false;
         }
         else
         {
@@ -461,6 +816,10 @@ read_topology_linux ()
         }
     }
 
+    close (sysfs_dir);
+    if (!valid)
+        return nullptr;
+
     const size_t num_cores = core_ids.size();
     const size_t num_logical_cpus = logical_cpu_2_core.size();
 
@@ -478,6 +837,9 @@ read_topology_linux ()
         t->num_online_logical_cpus = num_online_logical_cpus;
         t->num_cores = num_cores;
         t->logical_cpu_2_core.resize(num_logical_cpus);
+        t->logical_cpu_2_package.resize(num_logical_cpus, -1);
+        for (const auto &i : logical_cpu_2_package)
+            t->logical_cpu_2_package[i.first] = i.second;
         {
             for (const auto &i : logical_cpu_2_core)
             {
@@ -519,7 +881,7 @@ read_topology_linux ()
 }
 
 Ptr0<Topology>
-read_topology ()
+read_topology (const std::string &sysfs_root)
 {
     bool is_linux = false;
 
@@ -528,7 +890,575 @@ read_topology ()
 #endif
 
     if (is_linux)
-        return read_topology_linux();
+        return read_topology_linux (sysfs_root);
     else
         return nullptr;
 }
+
+
+
+#if defined (__linux__)
+static bool
+read_power_number (const std::string &path, xfce4::ReadBuffer &buffer, guint64 &value)
+{
+    gint64 number;
+    if (!xfce4::read_file (path.c_str(), buffer) || !parse_file_number (buffer, number) || number < 0)
+        return false;
+
+    value = number;
+    return true;
+}
+
+static std::vector<std::string>
+list_directory (const std::string &path)
+{
+    std::vector<std::string> names;
+    DIR *dir = opendir (path.c_str());
+    if (dir)
+    {
+        struct dirent *entry;
+        while ((entry = readdir (dir)) != NULL)
+            if (entry->d_name[0] != '.')
+                names.push_back (entry->d_name);
+        closedir (dir);
+    }
+    std::sort (names.begin(), names.end());
+    return names;
+}
+
+static bool
+open_power_domain (PowerMeter &meter, const std::string &name, const std::string &energy_path,
+                   guint64 max_energy, guint64 max_power_uw)
+{
+    /* Since Linux 5.10 the counters are readable by root only */
+    const gint fd = open (energy_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    PowerDomain domain = PowerDomain();
+    domain.name = name;
+    domain.fd = fd;
+    domain.max_energy = max_energy;
+    domain.max_watts = max_power_uw / 1e6;
+    meter.domains.push_back (domain);
+    g_info ("power domain %s: %s", name.c_str(), energy_path.c_str());
+    return true;
+}
+
+/*
+ * Intel RAPL, and AMD RAPL since Linux 5.8, expose the domains as powercap zones:
+ * intel-rapl:<package> with subzones intel-rapl:<package>:<n> (core, uncore, dram).
+ */
+static void
+read_powercap_domains (PowerMeter &meter, const std::string &sysfs_root)
+{
+    const std::string base = sysfs_root + "/class/powercap";
+    xfce4::ReadBuffer buffer;
+
+    for (const std::string &zone : list_directory (base))
+    {
+        /* The MMIO interface duplicates the package domain */
+        if (zone.find ("mmio") != std::string::npos)
+            continue;
+
+        const std::string dir = base + "/" + zone;
+        if (!xfce4::read_file ((dir + "/name").c_str(), buffer))
+            continue;
+        std::string name = xfce4::trim (buffer.c_str());
+
+        /* Prefix subzones with the name of their parent zone */
+        const size_t colon = zone.rfind (':');
+        if (colon != std::string::npos && zone.find (':') != colon)
+        {
+            if (xfce4::read_file ((base + "/" + zone.substr (0, colon) + "/name").c_str(), buffer))
+                name = xfce4::trim (buffer.c_str()) + " " + name;
+        }
+
+        guint64 max_energy = G_MAXUINT64, max_power_uw = 0;
+        read_power_number (dir + "/max_energy_range_uj", buffer, max_energy);
+        if (!read_power_number (dir + "/constraint_0_max_power_uw", buffer, max_power_uw))
+            read_power_number (dir + "/constraint_0_power_limit_uw", buffer, max_power_uw);
+
+        open_power_domain (meter, name, dir + "/energy_uj", max_energy, max_power_uw);
+    }
+}
+
+/* The amd_energy hwmon driver, used on AMD before powercap support. Only the socket counters are used. */
+static void
+read_amd_energy_domains (PowerMeter &meter, const std::string &sysfs_root)
+{
+    const std::string base = sysfs_root + "/class/hwmon";
+    xfce4::ReadBuffer buffer;
+
+    for (const std::string &hwmon : list_directory (base))
+    {
+        const std::string dir = base + "/" + hwmon;
+        if (!xfce4::read_file ((dir + "/name").c_str(), buffer) || xfce4::trim (buffer.c_str()) != "amd_energy")
+            continue;
+
+        for (guint i = 1; true; i++)
+        {
+            if (!xfce4::read_file (xfce4::sprintf ("%s/energy%u_label", dir.c_str(), i).c_str(), buffer))
+                break;
+            const std::string label = xfce4::trim (buffer.c_str());
+            if (!xfce4::starts_with (label, "Esocket"))
+                continue;
+
+            /* The driver accumulates the 32-bit hardware counter into 64 bits */
+            const std::string name = "socket-" + label.substr (strlen ("Esocket"));
+            open_power_domain (meter, name, xfce4::sprintf ("%s/energy%u_input", dir.c_str(), i), G_MAXUINT64, 0);
+        }
+    }
+}
+
+PowerMeter::~PowerMeter()
+{
+    for (const PowerDomain &domain : domains)
+        close (domain.fd);
+}
+
+Ptr0<PowerMeter>
+read_power_domains (const std::string &sysfs_root)
+{
+    auto meter = xfce4::make<PowerMeter>();
+
+    read_powercap_domains (*meter, sysfs_root);
+    if (meter->domains.empty())
+        read_amd_energy_domains (*meter, sysfs_root);
+
+    if (meter->domains.empty())
+        return nullptr;
+    return meter;
+}
+
+void
+add_power_reads (PowerMeter &meter, BatchReader &reader)
+{
+    for (PowerDomain &domain : meter.domains)
+        domain.slot = reader.add (domain.fd);
+}
+
+bool
+read_power_data (PowerMeter &meter, const BatchReader &reader)
+{
+    const gint64 now = g_get_monotonic_time ();
+    bool ok = true;
+
+    for (PowerDomain &domain : meter.domains)
+    {
+        const gchar *data = reader.data (domain.slot);
+        if (G_UNLIKELY (!data || reader.length (domain.slot) == 0))
+        {
+            domain.watts = 0;
+            domain.previous_time = 0;
+            ok = false;
+            continue;
+        }
+        const guint64 energy = g_ascii_strtoull (data, NULL, 10);
+
+        if (domain.previous_time != 0 && now > domain.previous_time)
+        {
+            guint64 delta;
+            if (energy >= domain.previous_energy)
+                delta = energy - domain.previous_energy;
+            else
+                delta = domain.max_energy - domain.previous_energy + energy;  /* Wrapped around */
+
+            /* Microjoules per microsecond = watts */
+            domain.watts = delta / (gdouble) (now - domain.previous_time);
+            if (domain.max_watts < domain.watts)
+                domain.max_watts = domain.watts;
+        }
+
+        domain.previous_energy = energy;
+        domain.previous_time = now;
+    }
+
+    return ok;
+}
+
+#else
+PowerMeter::~PowerMeter()
+{
+}
+
+Ptr0<PowerMeter>
+read_power_domains (const std::string &sysfs_root)
+{
+    return nullptr;
+}
+
+void
+add_power_reads (PowerMeter &meter, BatchReader &reader)
+{
+}
+
+bool
+read_power_data (PowerMeter &meter, const BatchReader &reader)
+{
+    return false;
+}
+#endif
+
+
+
+#if defined (__linux__)
+/* Temperature assumed critical when the sensor does not report one */
+#define DEFAULT_CRITICAL_TEMPERATURE 100
+
+/* Longest cpu/online content compared for hotplug detection */
+#define CPU_ONLINE_SIZE 1024
+
+static void
+add_thermal_sensor (Thermal &thermal, const std::string &dir, guint index, const std::vector<guint> &logical_cpus,
+                    xfce4::ReadBuffer &buffer)
+{
+    const gint fd = open (xfce4::sprintf ("%s/temp%u_input", dir.c_str(), index).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+
+    Thermal::Sensor sensor;
+    sensor.fd = fd;
+    sensor.logical_cpus = logical_cpus;
+    sensor.critical = DEFAULT_CRITICAL_TEMPERATURE;
+
+    for (const char *attr : {"crit", "max"})
+    {
+        gint64 millidegrees;
+        if (xfce4::read_file (xfce4::sprintf ("%s/temp%u_%s", dir.c_str(), index, attr).c_str(), buffer) &&
+            parse_file_number (buffer, millidegrees) && millidegrees > 0)
+        {
+            sensor.critical = millidegrees / 1000.0;
+            break;
+        }
+    }
+
+    for (guint cpu : logical_cpus)
+        thermal.critical[cpu] = sensor.critical;
+    thermal.sensors.push_back (sensor);
+}
+
+Thermal::~Thermal()
+{
+    for (const Sensor &sensor : sensors)
+        close (sensor.fd);
+    if (online_fd >= 0)
+        close (online_fd);
+}
+
+Ptr0<Thermal>
+read_thermal_sensors (const std::string &sysfs_root, const Topology &topology)
+{
+    auto thermal = xfce4::make<Thermal>();
+    thermal->online_fd = -1;
+    const guint num_cpus = topology.num_logical_cpus;
+    thermal->celsius.assign (num_cpus, NAN);
+    thermal->critical.assign (num_cpus, DEFAULT_CRITICAL_TEMPERATURE);
+
+    /* Logical CPUs which have a per-core sensor */
+    std::vector<bool> covered (num_cpus, false);
+    struct PackageSensor { std::string dir; guint index; gint package; };
+    std::vector<PackageSensor> package_sensors;
+
+    const std::string base = sysfs_root + "/class/hwmon";
+    xfce4::ReadBuffer buffer;
+    for (const std::string &hwmon : list_directory (base))
+    {
+        const std::string dir = base + "/" + hwmon;
+        if (!xfce4::read_file ((dir + "/name").c_str(), buffer) || xfce4::trim (buffer.c_str()) != "coretemp")
+            continue;
+
+        /* Each coretemp device belongs to one package and has a sensor labelled "Package id N".
+         * Sensor numbers have gaps where core IDs are sparse. */
+        std::vector<std::pair<guint, glong>> core_sensors;
+        gint package = -1;
+        for (const std::string &entry : list_directory (dir))
+        {
+            guint i;
+            gchar suffix[8];
+            if (sscanf (entry.c_str(), "temp%u_%7s", &i, suffix) != 2 || strcmp (suffix, "label") != 0)
+                continue;
+
+            if (!xfce4::read_file ((dir + "/" + entry).c_str(), buffer))
+                continue;
+            std::string label = xfce4::trim (buffer.c_str());
+
+            gchar *s = &label[0];
+            if (xfce4::starts_with (label, "Package id "))
+            {
+                s += strlen ("Package id ");
+                package = xfce4::parse_ulong (&s, 10);
+                package_sensors.push_back (PackageSensor{dir, i, package});
+            }
+            else if (xfce4::starts_with (label, "Core "))
+            {
+                s += strlen ("Core ");
+                core_sensors.push_back (std::make_pair (i, (glong) xfce4::parse_ulong (&s, 10)));
+            }
+        }
+
+        for (const auto &core_sensor : core_sensors)
+        {
+            std::vector<guint> logical_cpus;
+            for (guint cpu = 0; cpu < num_cpus; cpu++)
+            {
+                if (topology.logical_cpu_2_core[cpu] == core_sensor.second &&
+                    (package < 0 || topology.logical_cpu_2_package[cpu] == package))
+                {
+                    logical_cpus.push_back (cpu);
+                    covered[cpu] = true;
+                }
+            }
+            if (!logical_cpus.empty())
+                add_thermal_sensor (*thermal, dir, core_sensor.first, logical_cpus, buffer);
+        }
+    }
+
+    /* CPUs without a per-core sensor fall back to the package sensor */
+    for (const PackageSensor &package_sensor : package_sensors)
+    {
+        std::vector<guint> logical_cpus;
+        for (guint cpu = 0; cpu < num_cpus; cpu++)
+            if (!covered[cpu] && topology.logical_cpu_2_package[cpu] == package_sensor.package)
+                logical_cpus.push_back (cpu);
+        if (!logical_cpus.empty())
+            add_thermal_sensor (*thermal, package_sensor.dir, package_sensor.index, logical_cpus, buffer);
+    }
+
+    if (thermal->sensors.empty())
+        return nullptr;
+
+    thermal->online_fd = open ((sysfs_root + "/devices/system/cpu/online").c_str(), O_RDONLY | O_CLOEXEC);
+    if (thermal->online_fd >= 0 && xfce4::reread_file (thermal->online_fd, buffer))
+    {
+        /* As much as the batched reads compare */
+        thermal->online.assign (buffer.c_str(), MIN (buffer.length, (gsize) CPU_ONLINE_SIZE));
+    }
+
+    g_info ("%zu temperature sensors mapped to %u logical CPUs", thermal->sensors.size(), num_cpus);
+    return thermal;
+}
+
+void
+add_thermal_reads (Thermal &thermal, BatchReader &reader)
+{
+    for (Thermal::Sensor &sensor : thermal.sensors)
+        sensor.slot = reader.add (sensor.fd);
+    if (thermal.online_fd >= 0)
+        thermal.online_slot = reader.add (thermal.online_fd, CPU_ONLINE_SIZE);
+}
+
+bool
+read_thermal_data (Thermal &thermal, const BatchReader &reader)
+{
+    bool ok = true;
+    for (const Thermal::Sensor &sensor : thermal.sensors)
+    {
+        const gchar *data = reader.data (sensor.slot);
+        gchar *end = NULL;
+        const glong millidegrees = data ? g_ascii_strtoll (data, &end, 10) : 0;
+        const gfloat celsius = data && end != data ? millidegrees / 1000.0f : NAN;
+        if (isnan (celsius))
+            ok = false;
+        for (guint cpu : sensor.logical_cpus)
+            thermal.celsius[cpu] = celsius;
+    }
+    return ok;
+}
+
+bool
+cpu_hotplug_detected (const Thermal &thermal, const BatchReader &reader)
+{
+    if (thermal.online_fd < 0)
+        return false;
+
+    const gchar *data = reader.data (thermal.online_slot);
+    if (!data || reader.length (thermal.online_slot) == 0)
+        return false;
+
+    return thermal.online.compare (0, std::string::npos, data, reader.length (thermal.online_slot)) != 0;
+}
+
+#else
+Thermal::~Thermal()
+{
+}
+
+Ptr0<Thermal>
+read_thermal_sensors (const std::string &sysfs_root, const Topology &topology)
+{
+    return nullptr;
+}
+
+void
+add_thermal_reads (Thermal &thermal, BatchReader &reader)
+{
+}
+
+bool
+read_thermal_data (Thermal &thermal, const BatchReader &reader)
+{
+    return false;
+}
+
+bool
+cpu_hotplug_detected (const Thermal &thermal, const BatchReader &reader)
+{
+    return false;
+}
+#endif
+
+
+
+#if defined (__linux__)
+#define PROC_SCHEDSTAT "/proc/schedstat"
+#define RUN_DELAY_UNKNOWN G_MAXUINT64     /* In RunDelay::previous_delay, the CPU was not listed */
+
+/* Shared by the run-delay readers of the process until the last one is gone */
+static std::weak_ptr<SchedStat> process_schedstat;
+
+SchedStat::~SchedStat()
+{
+    if (fd >= 0)
+        close (fd);
+}
+
+Ptr0<SchedStat>
+open_schedstat ()
+{
+    Ptr0<SchedStat> schedstat = process_schedstat.lock();
+    if (schedstat)
+        return schedstat;
+
+    schedstat = xfce4::make<SchedStat>().ptr;
+    schedstat->timestamp = 0;
+    schedstat->fd = open (PROC_SCHEDSTAT, O_RDONLY | O_CLOEXEC);
+    if (schedstat->fd < 0 || !read_schedstat (*schedstat, 0))
+        return nullptr;
+
+    process_schedstat = schedstat;
+    return schedstat;
+}
+
+bool
+read_schedstat (SchedStat &schedstat, gint64 max_age)
+{
+    const gint64 now = g_get_monotonic_time ();
+    if (schedstat.timestamp != 0 && now - schedstat.timestamp < max_age)
+        return true;
+
+    if (!xfce4::reread_file (schedstat.fd, schedstat.buffer))
+        return false;
+    schedstat.timestamp = now;
+
+    std::fill (schedstat.listed.begin(), schedstat.listed.end(), false);
+
+    /* "cpuN" lines: yld_count, legacy, sched_count, sched_goidle, ttwu_count,
+     * ttwu_local, rq_cpu_time, run_delay, pcount. The domain lines are skipped. */
+    bool found = false;
+    for (gchar *line = schedstat.buffer.c_str(); *line; line = next_line (line))
+    {
+        if (strncmp (line, "cpu", 3) != 0 || !g_ascii_isdigit (line[3]))
+            continue;
+
+        gchar *s = line + 3;
+        const gulong id = parse_ulong (&s);
+        if (G_UNLIKELY (id > G_MAXUINT16))
+            continue;
+        for (guint i = 0; i < 7; i++)
+            parse_ulong (&s);
+        const guint64 run_delay = g_ascii_strtoull (s, NULL, 10);
+
+        /* Sized once, unless a CPU with a higher ID comes online */
+        if (G_UNLIKELY (id >= schedstat.run_delay.size()))
+        {
+            schedstat.run_delay.resize (id + 1, 0);
+            schedstat.listed.resize (id + 1, false);
+        }
+        schedstat.run_delay[id] = run_delay;
+        schedstat.listed[id] = true;
+        found = true;
+    }
+
+    return found;
+}
+
+Ptr0<RunDelay>
+open_run_delay ()
+{
+    Ptr0<SchedStat> schedstat = open_schedstat ();
+    if (!schedstat)
+        return nullptr;
+
+    auto delay = xfce4::make<RunDelay>();
+    delay->schedstat = schedstat;
+    delay->previous_delay.resize (schedstat->run_delay.size());
+    for (guint cpu = 0; cpu < schedstat->run_delay.size(); cpu++)
+        delay->previous_delay[cpu] = schedstat->listed[cpu] ? schedstat->run_delay[cpu] : RUN_DELAY_UNKNOWN;
+    delay->previous_time = schedstat->timestamp;
+    delay->ratio.assign (schedstat->run_delay.size(), NAN);
+    return delay;
+}
+
+bool
+read_run_delay_data (RunDelay &delay, gint64 max_age)
+{
+    SchedStat &schedstat = *delay.schedstat;
+    if (!read_schedstat (schedstat, max_age))
+        return false;
+
+    /* Read by an other consumer since our previous call, or not at all */
+    const gint64 elapsed = schedstat.timestamp - delay.previous_time;
+    if (elapsed <= 0)
+        return true;
+
+    const guint num_cpus = schedstat.run_delay.size();
+    if (G_UNLIKELY (delay.previous_delay.size() != num_cpus))
+    {
+        delay.previous_delay.resize (num_cpus, RUN_DELAY_UNKNOWN);
+        delay.ratio.resize (num_cpus, NAN);
+    }
+
+    for (guint cpu = 0; cpu < num_cpus; cpu++)
+    {
+        const guint64 current = schedstat.listed[cpu] ? schedstat.run_delay[cpu] : RUN_DELAY_UNKNOWN;
+        const guint64 previous = delay.previous_delay[cpu];
+        if (current != RUN_DELAY_UNKNOWN && previous != RUN_DELAY_UNKNOWN && current >= previous)
+            delay.ratio[cpu] = (current - previous) / (elapsed * 1e3f);
+        else
+            delay.ratio[cpu] = NAN;
+        delay.previous_delay[cpu] = current;
+    }
+    delay.previous_time = schedstat.timestamp;
+    return true;
+}
+
+#else
+SchedStat::~SchedStat()
+{
+}
+
+Ptr0<SchedStat>
+open_schedstat ()
+{
+    return nullptr;
+}
+
+bool
+read_schedstat (SchedStat &schedstat, gint64 max_age)
+{
+    return false;
+}
+
+Ptr0<RunDelay>
+open_run_delay ()
+{
+    return nullptr;
+}
+
+bool
+read_run_delay_data (RunDelay &delay, gint64 max_age)
+{
+    return false;
+}
+#endif
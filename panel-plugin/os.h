@@ -25,18 +25,49 @@
 #define _XFCE_CPUWATERFALL_OS_H_
 
 #include <glib.h>
+#if defined (__linux__)
+#include <sched.h>
+#endif
+#include <string>
 #include <unordered_map>
 #include <vector>
 #include "xfce4++/util.h"
+#include "io_batch.h"
 
 using xfce4::Ptr0;
 
-struct CpuData
+/*
+ * Logical CPU IDs need not be contiguous: CPUs which are absent or offline
+ * when the plugin starts leave holes. The rows are dense, row 0 is the
+ * aggregate of all CPUs.
+ *
+ * The cumulative counters are kept by row in separate arrays, which
+ * compute_loads() runs over in one vectorized pass.
+ */
+struct CpuRows
 {
-    gfloat load; /* Range: from 0.0 to 1.0 */
-    guint64 previous_used;
-    guint64 previous_total;
-    bool smt_highlight;
+    std::vector<guint64> used, total;
+    std::vector<guint64> previous_used, previous_total;
+    std::vector<guint32> ticks;     /* Deltas of the latest read, see encode_ticks() */
+    std::vector<guint> ids;         /* Ascending, row r > 0 is logical CPU ids[r-1] */
+    std::vector<gint> id_2_row;     /* Indexed by CPU ID, -1 for holes */
+    std::vector<gulong> offline;    /* Bitmap by CPU ID: rows missing from the latest read */
+    std::string path;               /* /proc/stat, or a copy for testing */
+    gint fd = -1;                   /* path, kept open between the reads */
+    xfce4::ReadBuffer buffer;
+
+    CpuRows () {}
+    CpuRows (const CpuRows&) = delete;
+    CpuRows& operator= (const CpuRows&) = delete;
+    ~CpuRows ();
+
+    guint size () const { return used.size(); }
+
+    bool is_offline (guint id) const
+    {
+        const guint bits = 8 * sizeof (gulong);
+        return id / bits < offline.size() && (offline[id / bits] >> (id % bits) & 1);
+    }
 };
 
 struct CpuStats
@@ -60,6 +91,7 @@ struct Topology
     guint num_cores;                      /* Range: <1, num_logical_cpus> */
     guint num_online_cores;               /* Range: <1, num_online_logical_cpus> */
     std::vector<gint> logical_cpu_2_core; /* Maps a logical CPU to its core, or to -1 if offline */
+    std::vector<gint> logical_cpu_2_package; /* Maps a logical CPU to its physical package, or to -1 if offline */
 
     struct CpuCore {
         std::vector<guint> logical_cpus;  /* Logical CPUs in this core. Empty if the core is offline. */
@@ -73,8 +105,139 @@ struct Topology
     gdouble smt_ratio;  /* Equals to (num_online_logical_cpus / num_online_cores), >= 1.0 */
 };
 
-guint detect_cpu_number ();
-bool read_cpu_data (std::vector<CpuData> &data);
-Ptr0<Topology> read_topology ();
+struct TaskInfo
+{
+    std::string comm;
+    guint64 previous_ticks; /* utime + stime at the previous scan */
+    guint64 delta;          /* Ticks consumed between the two latest scans */
+    gfloat load;            /* Fraction of a CPU used between the two latest scans */
+    gint processor;         /* CPU the task last ran on */
+    guint generation;       /* Scan in which the task was last seen */
+    gsize slot;             /* Position of the task in TaskIndex::by_cpu[processor] */
+};
+
+struct TaskIndex
+{
+    /* Maps a task ID (TID) to TaskInfo */
+    std::unordered_map<gint, TaskInfo> tasks;
+
+    /* Task IDs grouped by the CPU they last ran on. Updated incrementally:
+     * a task only moves between the groups when its CPU changes. */
+    std::vector<std::vector<gint>> by_cpu;
+
+    guint generation;
+    gint64 timestamp;       /* Time of the latest scan, in microseconds */
+    gint64 interval;        /* Time between the two latest scans, in microseconds */
+    xfce4::ReadBuffer buffer;
+};
+
+/* Per logical CPU flags, from the kernel command line (isolcpus=, nohz_full=) */
+enum CpuFlags
+{
+    CPU_FLAG_ISOLATED  = 1 << 0,
+    CPU_FLAG_NOHZ_FULL = 1 << 1,
+};
+
+/* An energy counter, such as a RAPL domain exposed via /sys/class/powercap */
+struct PowerDomain
+{
+    std::string name;           /* Human readable, e.g. "package-0" or "package-0 core" */
+    gint fd;                    /* Energy counter in microjoules, re-read each tick */
+    guint slot;                 /* In the BatchReader */
+    guint64 max_energy;         /* The counter wraps around after reaching this value */
+    guint64 previous_energy;
+    gint64 previous_time;       /* Microseconds, or zero before the first reading */
+    gfloat watts;
+    gfloat max_watts;           /* Full scale of the strip: the power limit or the highest reading */
+};
+
+struct PowerMeter
+{
+    std::vector<PowerDomain> domains;
+    ~PowerMeter();
+};
+
+/* Per-core temperatures from the hwmon coretemp driver */
+struct Thermal
+{
+    struct Sensor
+    {
+        gint fd;                        /* tempN_input in millidegrees Celsius, re-read each tick */
+        guint slot;                     /* In the BatchReader */
+        std::vector<guint> logical_cpus;
+        gfloat critical;                /* Degrees Celsius */
+    };
+
+    std::vector<Sensor> sensors;
+    std::vector<gfloat> celsius;        /* Indexed by logical CPU, NAN if unknown */
+    std::vector<gfloat> critical;       /* Indexed by logical CPU */
+
+    /* The mapping is rebuilt when the content of cpu/online changes */
+    gint online_fd;
+    guint online_slot;
+    std::string online;
+
+    ~Thermal();
+};
+
+/* The per-CPU counters of /proc/schedstat, read by each process of the plugin on its own.
+ * The panel runs every plugin instance in its own wrapper process. */
+struct SchedStat
+{
+    gint fd;
+    xfce4::ReadBuffer buffer;           /* The whole file as of the latest read */
+    gint64 timestamp;                   /* Of the latest read, monotonic microseconds */
+    std::vector<guint64> run_delay;     /* Indexed by logical CPU: nanoseconds tasks waited on its run queue */
+    std::vector<bool> listed;           /* Indexed by logical CPU: present in the latest read */
+
+    ~SchedStat();
+};
+
+/* Run-queue latency: nanoseconds tasks waited per nanosecond elapsed, between two reads of SchedStat */
+struct RunDelay
+{
+    Ptr0<SchedStat> schedstat;          /* Non-NULL */
+    std::vector<guint64> previous_delay;
+    gint64 previous_time;
+    std::vector<gfloat> ratio;          /* Indexed by logical CPU, NAN if unknown */
+};
+
+/* Sets up the rows once, proc_stat is NULL for the system's /proc/stat */
+bool init_cpu_rows (CpuRows &rows, const gchar *proc_stat = NULL);
+/* Writes rows.size() loads from 0.0 to 1.0 */
+bool read_cpu_data (CpuRows &rows, gfloat *load);
+bool read_task_data (TaskIndex &index);
+
+/* The readers of sysfs take its root, normally "/sys". A different directory
+ * tree can be used for testing, see fixtures/sysfs and cpuwaterfall-bench --sysfs. */
+bool read_cpu_flags (const std::string &sysfs_root, std::vector<guint8> &flags);
+
+#if defined (__linux__)
+/* The CPUs of the process which are neither isolated nor nohz_full. Returns false
+ * if the process runs on no such CPU, or on nothing else. */
+bool housekeeping_cpus (cpu_set_t &set);
+#endif
+/* Keeps a thread the plugin created off the isolated and nohz_full CPUs, call it from the thread.
+ * The threads of the panel and of GTK keep their affinity. */
+bool pin_thread_to_housekeeping_cpus ();
+Ptr0<Topology> read_topology (const std::string &sysfs_root);
+
+/* Returns nullptr if no energy counter is readable */
+Ptr0<PowerMeter> read_power_domains (const std::string &sysfs_root);
+void add_power_reads (PowerMeter &meter, BatchReader &reader);
+bool read_power_data (PowerMeter &meter, const BatchReader &reader);
+
+/* Maps the "Core N" and "Package id N" sensors to logical CPUs. Returns nullptr if none is found. */
+Ptr0<Thermal> read_thermal_sensors (const std::string &sysfs_root, const Topology &topology);
+void add_thermal_reads (Thermal &thermal, BatchReader &reader);
+bool read_thermal_data (Thermal &thermal, const BatchReader &reader);
+bool cpu_hotplug_detected (const Thermal &thermal, const BatchReader &reader);
+
+/* Returns the reader of the process, nullptr if /proc/schedstat is not readable */
+Ptr0<SchedStat> open_schedstat ();
+/* Re-reads the file unless an other consumer did less than max_age microseconds ago */
+bool read_schedstat (SchedStat &schedstat, gint64 max_age);
+Ptr0<RunDelay> open_run_delay ();
+bool read_run_delay_data (RunDelay &delay, gint64 max_age);
 
 #endif /* _XFCE_CPUWATERFALL_OS_H */
@@ -70,12 +70,19 @@ static GtkWidget* create_drop_down (GtkBox *tab, GtkSizeGroup *sg, const gchar *
                                     const std::vector<std::string> &items, size_t init,
                                     const std::function<void(GtkComboBox*)> &callback);
 static void       setup_update_interval_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions> &data);
+static void       setup_cpu_budget_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base);
+static void       setup_history_format_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base);
+static void       setup_history_file_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base);
+static void       setup_archive_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base);
+static void       setup_recorder_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base);
+static void       setup_publish_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base);
 static void       setup_size_option (GtkBox *vbox, GtkSizeGroup *sg, XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base);
 static void       setup_command_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions> &data);
 static void       setup_color_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions> &data,
                                       CPUWaterfallColorNumber number, const gchar *name, const gchar *tooltip,
                                       const std::function<void(GtkColorButton*)> &callback);
 static void       setup_mode_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions> &data);
+static void       setup_source_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions> &data);
 static void       change_color (GtkColorButton  *button, const Ptr<CPUWaterfall> &base, CPUWaterfallColorNumber number);
 static void       update_sensitivity (const Ptr<CPUWaterfallOptions> &data, bool initial = false);
 
@@ -114,6 +121,13 @@ create_options (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base)
     GtkBox *vbox = create_tab ();
     setup_update_interval_option (vbox, sg, dlg_data);
     setup_size_option (vbox, sg, plugin, base);
+    setup_cpu_budget_option (vbox, sg, base);
+    setup_history_format_option (vbox, sg, base);
+    setup_history_file_option (vbox, sg, base);
+    setup_archive_option (vbox, sg, base);
+    setup_recorder_option (vbox, sg, base);
+    setup_publish_option (vbox, sg, base);
+    setup_source_option (vbox, sg, dlg_data);
 
     gtk_box_pack_start (vbox, gtk_separator_new (GTK_ORIENTATION_HORIZONTAL), FALSE, FALSE, BORDER/2);
     setup_command_option (vbox, sg, dlg_data);
@@ -142,6 +156,11 @@ create_options (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base)
     setup_color_option (vbox2, sg, dlg_data, FG_COLOR2, _("Color 2:"), NULL, [base](GtkColorButton *button) {
         change_color (button, base, FG_COLOR2);
     });
+    setup_color_option (vbox2, sg, dlg_data, ISOLATED_COLOR, _("Isolated CPUs:"),
+                        _("Frame of the CPUs listed in isolcpus= or nohz_full=.\nAny load on them is framed with Color 2."),
+                        [base](GtkColorButton *button) {
+        change_color (button, base, ISOLATED_COLOR);
+    });
     setup_mode_option (vbox2, sg, dlg_data);
 
 
@@ -165,6 +184,16 @@ create_options (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base)
 //            update_sensitivity (dlg_data);
         });
 
+    create_check_box (vbox2, sg, _("Show power (RAPL)"), base->has_power, NULL,
+        [dlg_data](GtkToggleButton *button) {
+            CPUWaterfall::set_power (dlg_data->base, gtk_toggle_button_get_active (button));
+        });
+
+    create_check_box (vbox2, sg, _("Tint hot cores"), base->has_temperature, NULL,
+        [dlg_data](GtkToggleButton *button) {
+            CPUWaterfall::set_temperature (dlg_data->base, gtk_toggle_button_get_active (button));
+        });
+
     GtkWidget *notebook = gtk_notebook_new ();
     gtk_container_set_border_width (GTK_CONTAINER (notebook), BORDER - 2);
     gtk_notebook_append_page (GTK_NOTEBOOK (notebook), GTK_WIDGET (vbox2), gtk_label_new (_("Appearance")));
@@ -305,6 +334,113 @@ setup_size_option (GtkBox *vbox, GtkSizeGroup *sg, XfcePanelPlugin *plugin, cons
 
 
 
+static void
+setup_cpu_budget_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base)
+{
+    GtkBox *hbox = create_option_line (vbox, sg, _("CPU budget (%):"),
+        _("Maximum CPU time of the plugin, in percent of a CPU. When over it, the plugin turns off "
+          "the power strips, the hot core tint and the task list, then lowers the update rate. "
+          "0 for no budget."));
+
+    GtkWidget *budget = gtk_spin_button_new_with_range (0, MAX_CPU_BUDGET / 100.0, 0.05);
+    gtk_spin_button_set_digits (GTK_SPIN_BUTTON (budget), 2);
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (budget), base->governor.budget / 100.0);
+    gtk_box_pack_start (GTK_BOX (hbox), budget, FALSE, FALSE, 0);
+    xfce4::connect (GTK_SPIN_BUTTON (budget), "value-changed", [base](GtkSpinButton *button) {
+        CPUWaterfall::set_cpu_budget (base, (guint) round (gtk_spin_button_get_value (button) * 100));
+    });
+}
+
+
+
+
+static void
+setup_history_format_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base)
+{
+    const std::vector<std::string> items = {
+        _("Exact"),
+        _("16-bit"),
+        _("8-bit"),
+    };
+
+    GtkWidget *combo = create_drop_down (vbox, sg, _("History storage:"), items, base->history.format,
+        [base](GtkComboBox *combo) {
+            CPUWaterfall::set_history_format (base, (HistoryFormat) gtk_combo_box_get_active (combo));
+        });
+    gtk_widget_set_tooltip_text (combo, _("The 8-bit and 16-bit storages keep only the rounded load, "
+                                          "in a quarter or half of the memory. Changing it clears the history."));
+}
+
+
+static void
+setup_history_file_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base)
+{
+    GtkWidget *sync = gtk_spin_button_new_with_range (0, MAX_HISTORY_SYNC, 1);
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (sync), base->history_sync);
+    gtk_widget_set_sensitive (sync, base->persist_history);
+    xfce4::connect (GTK_SPIN_BUTTON (sync), "value-changed", [base](GtkSpinButton *button) {
+        CPUWaterfall::set_history_sync (base, gtk_spin_button_get_value_as_int (button));
+    });
+
+    create_check_box (vbox, sg, _("Keep history across restarts"), base->persist_history, NULL,
+        [base, sync](GtkToggleButton *button) {
+            CPUWaterfall::set_persist_history (base, gtk_toggle_button_get_active (button));
+            gtk_widget_set_sensitive (sync, base->persist_history);
+        });
+
+    GtkBox *hbox = create_option_line (vbox, sg, _("Write history to disk (s):"),
+        _("Seconds between the writes of the history file to disk. With 0, the file is kept "
+          "in memory, where it survives a restart of the panel but not a logout."));
+    gtk_box_pack_start (GTK_BOX (hbox), sync, FALSE, FALSE, 0);
+}
+
+
+static void
+setup_archive_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base)
+{
+    GtkBox *hbox = create_option_line (vbox, sg, _("Full-resolution archive (h):"),
+        _("Hours of every sample kept compressed in memory, for the peak shown in the tooltip. "
+          "0 for none."));
+
+    GtkWidget *hours = gtk_spin_button_new_with_range (0, MAX_ARCHIVE_HOURS, 1);
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (hours), base->archive_hours);
+    gtk_box_pack_start (GTK_BOX (hbox), hours, FALSE, FALSE, 0);
+    xfce4::connect (GTK_SPIN_BUTTON (hours), "value-changed", [base](GtkSpinButton *button) {
+        CPUWaterfall::set_archive_hours (base, gtk_spin_button_get_value_as_int (button));
+    });
+}
+
+
+static void
+setup_recorder_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base)
+{
+    GtkBox *hbox = create_option_line (vbox, sg, _("Flight recorder (MiB):"),
+        _("Disk space for a recording of every sample, in ~/.cache/xfce4/cpuwaterfall. The oldest "
+          "samples are deleted first. Play it back with the source \"Replay recording\". 0 for none."));
+
+    GtkWidget *size = gtk_spin_button_new_with_range (0, MAX_RECORDER_SIZE, 16);
+    gtk_spin_button_set_value (GTK_SPIN_BUTTON (size), base->recorder_size);
+    gtk_box_pack_start (GTK_BOX (hbox), size, FALSE, FALSE, 0);
+    xfce4::connect (GTK_SPIN_BUTTON (size), "value-changed", [base](GtkSpinButton *button) {
+        CPUWaterfall::set_recorder_size (base, gtk_spin_button_get_value_as_int (button));
+    });
+}
+
+
+static void
+setup_publish_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfall> &base)
+{
+    GtkToggleButton *publish;
+    create_check_box (vbox, sg, _("Publish samples in shared memory"), base->publish_samples, &publish,
+        [base](GtkToggleButton *button) {
+            CPUWaterfall::set_publish_samples (base, gtk_toggle_button_get_active (button));
+        });
+    gtk_widget_set_tooltip_text (GTK_WIDGET (publish),
+        _("Other programs can read every sample from /dev/shm/cpuwaterfall-UID-ID instead of "
+          "sampling the CPUs themselves, see cpuwaterfall-ring.h."));
+}
+
+
 
 
 static void
@@ -347,6 +483,45 @@ setup_color_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOption
 }
 
 
+static void
+setup_source_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions> &data)
+{
+    const std::vector<DataSourceType> &types = data_source_types ();
+
+    std::vector<std::string> items;
+    gint selected = 0;
+    for (size_t i = 0; i < types.size(); i++)
+    {
+        items.push_back (_(types[i].label));
+        if (data->base->source_id == types[i].id)
+            selected = i;
+    }
+
+    create_drop_down (vbox, sg, _("Source:"), items, selected,
+        [data](GtkComboBox *combo) {
+            const std::vector<DataSourceType> &types = data_source_types ();
+            gint active = gtk_combo_box_get_active (combo);
+            if (active >= 0 && (size_t) active < types.size())
+                CPUWaterfall::set_source (data->base, types[active].id, data->base->source_options);
+        });
+
+    GtkBox *hbox = create_option_line (vbox, sg, _("Source options:"), NULL);
+    GtkWidget *options = gtk_entry_new ();
+    gtk_entry_set_text (GTK_ENTRY (options), data->base->source_options.c_str());
+    gtk_entry_set_icon_from_icon_name (GTK_ENTRY (options), GTK_ENTRY_ICON_SECONDARY, "help-contents");
+    auto tooltip = std::string() +
+        _("Remote hosts: addresses of cpuwaterfall-collector, e.g. \"unix:/run/cpuwf.sock, buildhost:7634\".") + "\n" +
+        (g_getenv ("CPUWATERFALL_SYNTHETIC") ? std::string() + _("Synthetic load: e.g. \"cpus=1024,pattern=mixed\".") + "\n" : "") +
+        _("Replay recording: e.g. \"path=~/.cache/xfce4/cpuwaterfall/recording-1,speed=10,skip=60\".") + "\n" +
+        _("Press Enter to apply.");
+    gtk_entry_set_icon_tooltip_text (GTK_ENTRY (options), GTK_ENTRY_ICON_SECONDARY, tooltip.c_str());
+    gtk_box_pack_start (GTK_BOX (hbox), options, FALSE, FALSE, 0);
+    xfce4::connect (GTK_ENTRY (options), "activate", [data](GtkEntry *entry) {
+        CPUWaterfall::set_source (data->base, data->base->source_id, xfce4::trim (gtk_entry_get_text (entry)));
+    });
+}
+
+
 static void
 setup_mode_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions> &data)
 {
@@ -354,6 +529,8 @@ setup_mode_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions
     const std::vector<std::string> items = {
         _("Disabled"),
         _("Waterfall"),
+        _("Temperature"),
+        _("Run-queue latency"),
     };
 
     gint selected = 0;
@@ -361,6 +538,8 @@ setup_mode_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions
     {
         case MODE_DISABLED: selected = 0; break;
         case MODE_WATERFALL:  selected = 1; break;
+        case MODE_TEMPERATURE: selected = 2; break;
+        case MODE_RUN_DELAY: selected = 3; break;
     }
 
     create_drop_down (vbox, sg, _("Mode:"), items, selected,
@@ -374,6 +553,8 @@ setup_mode_option (GtkBox *vbox, GtkSizeGroup *sg, const Ptr<CPUWaterfallOptions
             {
                 case MODE_DISABLED:
                 case MODE_WATERFALL:
+                case MODE_TEMPERATURE:
+                case MODE_RUN_DELAY:
                     mode = (CPUWaterfallMode) active;
                     break;
                 default:
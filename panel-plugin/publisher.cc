@@ -0,0 +1,137 @@
+/*  publisher.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "cpuwaterfall-ring.h"
+#include "publisher.h"
+
+#if defined (__linux__)
+
+RingPublisher::~RingPublisher()
+{
+    close_ring (*this);
+}
+
+void
+publish_ring (RingPublisher &publisher, const DataSource &source)
+{
+    close_ring (publisher);
+    if (publisher.name.empty())
+        return;
+
+    /* A new object: readers may still map the previous one, which must not shrink under them */
+    shm_unlink (publisher.name.c_str());
+    const gint fd = shm_open (publisher.name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    const guint num_rows = source.num_rows();
+    const gsize size = cwf_ring_size (num_rows, PUBLISHED_RING_SLOTS);
+    void *ring = MAP_FAILED;
+    if (fd >= 0 && ftruncate (fd, size) == 0)
+        ring = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd >= 0)
+        close (fd);
+    if (ring == MAP_FAILED)
+    {
+        g_warning ("cannot publish the samples in %s: %s", publisher.name.c_str(), g_strerror (errno));
+        if (fd >= 0)
+            shm_unlink (publisher.name.c_str());
+        return;
+    }
+
+    struct cwf_ring_header *header = (struct cwf_ring_header*) ring;
+    header->version = CWF_RING_VERSION;
+    header->num_rows = num_rows;
+    header->num_slots = PUBLISHED_RING_SLOTS;
+    header->slot_size = cwf_ring_slot_size (num_rows);
+    header->ids_offset = 64;
+    header->slots_offset = size - PUBLISHED_RING_SLOTS * header->slot_size;
+    header->writer_pid = getpid ();
+    uint32_t *ids = (uint32_t*) ((char*) ring + header->ids_offset);
+    for (guint row = 0; row < num_rows; row++)
+    {
+        const gint cpu = source.row_cpu (row);
+        ids[row] = cpu >= 0 ? (uint32_t) cpu : CWF_ROW_AGGREGATE;
+    }
+
+    /* Readers check the magic last */
+    __atomic_store_n (&header->magic, CWF_RING_MAGIC, __ATOMIC_RELEASE);
+
+    publisher.ring = ring;
+    publisher.size = size;
+    publisher.num_rows = num_rows;
+    publisher.num_frames = 0;
+    publisher.previous = g_get_monotonic_time ();
+    g_info ("samples published in %s, %u rows", publisher.name.c_str(), num_rows);
+}
+
+void
+publish_frame (RingPublisher &publisher, gint64 timestamp, const guint32 *ticks)
+{
+    if (!publisher.ring)
+        return;
+
+    const gint64 now = g_get_monotonic_time ();
+    struct cwf_ring_slot *slot = cwf_ring_begin (publisher.ring, publisher.num_frames);
+    float *load = cwf_slot_load (slot);
+    for (guint row = 0; row < publisher.num_rows; row++)
+        load[row] = ticks_ratio (ticks[row]);
+    memcpy (cwf_slot_ticks (slot, publisher.num_rows), ticks, publisher.num_rows * sizeof (guint32));
+    slot->timestamp_us = timestamp;
+    slot->interval_us = MIN (now - publisher.previous, (gint64) G_MAXUINT32);
+    slot->flags = 0;
+    cwf_ring_commit (publisher.ring, slot, publisher.num_frames);
+    cwf_ring_wake (publisher.ring);
+
+    publisher.num_frames++;
+    publisher.previous = now;
+}
+
+void
+close_ring (RingPublisher &publisher)
+{
+    if (!publisher.ring)
+        return;
+
+    struct cwf_ring_header *header = (struct cwf_ring_header*) publisher.ring;
+    __atomic_fetch_or (&header->flags, CWF_RING_CLOSED, __ATOMIC_RELEASE);
+    cwf_ring_wake (publisher.ring);
+    munmap (publisher.ring, publisher.size);
+    shm_unlink (publisher.name.c_str());
+    publisher.ring = nullptr;
+}
+
+#else
+
+RingPublisher::~RingPublisher() {}
+
+void
+publish_ring (RingPublisher &publisher, const DataSource &source)
+{
+    if (!publisher.name.empty())
+        g_warning ("publishing the samples is not supported on this system");
+}
+
+void publish_frame (RingPublisher &publisher, gint64 timestamp, const guint32 *ticks) {}
+void close_ring (RingPublisher &publisher) {}
+
+#endif
@@ -0,0 +1,56 @@
+/*  publisher.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_PUBLISHER_H_
+#define _XFCE_CPUWATERFALL_PUBLISHER_H_
+
+#include <glib.h>
+#include <string>
+#include "source.h"
+
+#define PUBLISHED_RING_SLOTS 64
+
+/*
+ * Publishes the frames of the plugin in a shared-memory ring named name,
+ * so that other processes read them without sampling the CPUs again. See
+ * cpuwaterfall-ring.h for the layout and for the functions of the readers.
+ */
+struct RingPublisher
+{
+    std::string name;               /* Of the POSIX shared memory object, empty not to publish */
+    void *ring = nullptr;
+    gsize size = 0;
+    guint num_rows = 0;
+    guint64 num_frames = 0;
+    gint64 previous = 0;            /* Monotonic time of the previous frame */
+
+    RingPublisher() {}
+    RingPublisher(const RingPublisher&) = delete;
+    RingPublisher& operator=(const RingPublisher&) = delete;
+    ~RingPublisher();
+};
+
+/* Closes the ring and publishes a new one for the rows of the source, if the name is set */
+void publish_ring (RingPublisher &publisher, const DataSource &source);
+
+/* Writes the tick deltas of a frame and wakes the readers */
+void publish_frame (RingPublisher &publisher, gint64 timestamp, const guint32 *ticks);
+
+/* Marks the ring as closed and removes its name */
+void close_ring (RingPublisher &publisher);
+
+#endif /* _XFCE_CPUWATERFALL_PUBLISHER_H_ */
@@ -0,0 +1,631 @@
+/*  recorder.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <libxfce4util/libxfce4util.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include "recorder.h"
+#include "wire.h"
+
+#define RECORDING_MAGIC   0x43525743u   /* "CWRC" */
+#define RECORDING_VERSION 1
+
+#define MIN_RECORDING_FILE (64 * 1024)
+#define REPLAY_RELEASE_BYTES (1 << 20)  /* Replayed pages are dropped by this many bytes */
+#define MAX_REPLAY_SPEED 100
+
+/*
+ * A recording file: this header, the NUL-terminated id of the source and
+ * names of the num_rows rows, then the frames. A frame is the varint size of
+ * the rest of it, the zigzag varint difference between its timestamp and the
+ * one of the previous frame (zero before the first one), then the total and
+ * the used tick deltas of every row as varints. Closing the file appends
+ * the index, index_entries entries of RecordingIndexEntry, and sets
+ * index_offset. The file has the byte order of the machine.
+ */
+struct RecordingHeader
+{
+    guint32 magic;
+    guint32 version;
+    guint32 num_rows;
+    guint32 strings_size;           /* Bytes of the source id and of the row names */
+    gfloat min_value;
+    gfloat max_value;
+    guint64 index_offset;           /* Zero while the file is being written */
+    guint64 index_entries;
+};
+
+
+
+FlightRecorder::~FlightRecorder()
+{
+    close_recording (*this);
+}
+
+/* The recording files of dir, oldest first */
+static std::vector<std::string>
+list_directory (const std::string &dir)
+{
+    std::vector<std::string> paths;
+    DIR *d = opendir (dir.c_str());
+    if (d)
+    {
+        struct dirent *entry;
+        while ((entry = readdir (d)) != NULL)
+            if (entry->d_name[0] != '.' && g_str_has_suffix (entry->d_name, RECORDING_SUFFIX))
+                paths.push_back (dir + G_DIR_SEPARATOR_S + entry->d_name);
+        closedir (d);
+    }
+
+    /* The names start with the time of their first frame */
+    std::sort (paths.begin(), paths.end());
+    return paths;
+}
+
+/* Deletes the oldest files of the directory, but the open one, until the rest fits in max_bytes */
+static void
+prune_recordings (const FlightRecorder &recorder)
+{
+    const std::vector<std::string> paths = list_directory (recorder.dir);
+    std::vector<gsize> sizes (paths.size());
+    gsize total = 0;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        struct stat st;
+        sizes[i] = stat (paths[i].c_str(), &st) == 0 ? st.st_size : 0;
+        total += sizes[i];
+    }
+
+    for (size_t i = 0; i < paths.size() && total > recorder.max_bytes; i++)
+    {
+        if (paths[i] == recorder.path)
+            continue;
+        if (unlink (paths[i].c_str()) == 0)
+            total -= sizes[i];
+    }
+}
+
+/* Creates the next file, named after the current time, and writes the header */
+static void
+open_recording_file (FlightRecorder &recorder)
+{
+    const gint64 now = g_get_real_time ();
+    GDateTime *time = g_date_time_new_from_unix_local (now / G_USEC_PER_SEC);
+    gchar *name = g_date_time_format (time, "%Y%m%d-%H%M%S");
+    recorder.path = xfce4::sprintf ("%s/%s.%06d%s", recorder.dir.c_str(), name, (gint) (now % G_USEC_PER_SEC), RECORDING_SUFFIX);
+    g_free (name);
+    g_date_time_unref (time);
+
+    recorder.fd = open (recorder.path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (recorder.fd < 0 || write (recorder.fd, recorder.header.data(), recorder.header.size()) != (ssize_t) recorder.header.size())
+    {
+        g_warning ("cannot record to %s: %s", recorder.path.c_str(), g_strerror (errno));
+        if (recorder.fd >= 0)
+            close (recorder.fd);
+        recorder.fd = -1;
+        return;
+    }
+
+    recorder.file_bytes = recorder.header.size();
+    recorder.num_frames = 0;
+    recorder.last_timestamp = 0;
+    recorder.index.clear();
+    prune_recordings (recorder);
+}
+
+void
+set_recorder (FlightRecorder &recorder, const std::string &dir, gsize max_bytes)
+{
+    close_recording (recorder);
+    recorder.dir = dir;
+    recorder.max_bytes = dir.empty() ? 0 : max_bytes;
+    recorder.header.clear();
+    if (recorder.max_bytes != 0)
+        prune_recordings (recorder);
+}
+
+void
+start_recording (FlightRecorder &recorder, const std::string &source_id, const DataSource &source)
+{
+    close_recording (recorder);
+    if (recorder.max_bytes == 0)
+        return;
+
+    std::string strings = source_id + '\0';
+    for (guint row = 0; row < source.num_rows(); row++)
+        strings += source.row_name (row) + '\0';
+
+    RecordingHeader header = RecordingHeader();
+    header.magic = RECORDING_MAGIC;
+    header.version = RECORDING_VERSION;
+    header.num_rows = source.num_rows();
+    header.strings_size = strings.size();
+    header.min_value = source.min_value();
+    header.max_value = source.max_value();
+
+    recorder.header.assign ((const gchar*) &header, sizeof (header));
+    recorder.header += strings;
+    recorder.num_rows = header.num_rows;
+    open_recording_file (recorder);
+}
+
+void
+record_ticks (FlightRecorder &recorder, gint64 timestamp, const guint32 *ticks,
+              const guint64 *used, const guint64 *total)
+{
+    if (recorder.fd < 0)
+        return;
+
+    if (recorder.num_frames % RECORDING_INDEX_FRAMES == 0)
+        recorder.index.push_back ({recorder.last_timestamp, recorder.file_bytes});
+
+    std::string &frame = recorder.buffer;
+    frame.clear();
+    put_svarint (frame, timestamp - recorder.last_timestamp);
+    for (guint row = 0; row < recorder.num_rows; row++)
+    {
+        put_varint (frame, total ? total[row] : ticks_total (ticks[row]));
+        put_varint (frame, used ? used[row] : ticks_used (ticks[row]));
+    }
+
+    std::string size;
+    put_varint (size, frame.size());
+    frame.insert (0, size);
+
+    if (write (recorder.fd, frame.data(), frame.size()) != (ssize_t) frame.size())
+    {
+        /* The frames written so far are kept, the file is read up to the broken one */
+        g_warning ("cannot record to %s: %s", recorder.path.c_str(), g_strerror (errno));
+        close (recorder.fd);
+        recorder.fd = -1;
+        return;
+    }
+    recorder.file_bytes += frame.size();
+    recorder.num_frames++;
+    recorder.last_timestamp = timestamp;
+
+    if (recorder.file_bytes >= MAX (recorder.max_bytes / RECORDER_FILES, MIN_RECORDING_FILE))
+    {
+        close_recording (recorder);
+        open_recording_file (recorder);
+    }
+}
+
+void
+close_recording (FlightRecorder &recorder)
+{
+    if (recorder.fd < 0)
+        return;
+
+    const gsize index_size = recorder.index.size() * sizeof (RecordingIndexEntry);
+    const guint64 fields[2] = {recorder.file_bytes, recorder.index.size()};
+    if (write (recorder.fd, recorder.index.data(), index_size) != (ssize_t) index_size ||
+        pwrite (recorder.fd, fields, sizeof (fields), offsetof (RecordingHeader, index_offset)) != sizeof (fields))
+    {
+        g_warning ("cannot write the index of %s: %s", recorder.path.c_str(), g_strerror (errno));
+    }
+    close (recorder.fd);
+    recorder.fd = -1;
+}
+
+
+
+Recording::~Recording()
+{
+    if (data)
+        munmap ((void*) data, size);
+}
+
+gsize
+read_recorded_frame (const Recording &recording, gsize offset, gint64 &timestamp,
+                     guint64 *used, guint64 *total)
+{
+    if (offset >= recording.frames_end)
+        return 0;
+
+    const guint8 *p = recording.data + offset;
+    const guint8 *end = recording.data + recording.frames_end;
+    guint64 size;
+    gint64 delta;
+    if (!get_varint (p, end, size) || size > (guint64) (end - p))
+        return 0;
+
+    end = p + size;
+    if (!get_svarint (p, end, delta))
+        return 0;
+    timestamp += delta;
+
+    if (used)
+    {
+        for (guint row = 0; row < recording.num_rows; row++)
+        {
+            guint64 row_total, row_used;
+            if (!get_varint (p, end, row_total) || !get_varint (p, end, row_used))
+                return 0;
+            total[row] += row_total;
+            used[row] += row_used;
+        }
+    }
+    return end - recording.data;
+}
+
+bool
+open_recording (Recording &recording, const std::string &path)
+{
+    const int fd = open (path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    void *mapping = MAP_FAILED;
+    struct stat st;
+    if (fstat (fd, &st) == 0 && st.st_size >= (off_t) sizeof (RecordingHeader))
+        mapping = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd);
+    if (mapping == MAP_FAILED)
+        return false;
+
+    recording.path = path;
+    recording.data = (const guint8*) mapping;
+    recording.size = st.st_size;
+    madvise (mapping, st.st_size, MADV_SEQUENTIAL);
+
+    RecordingHeader h;
+    memcpy (&h, recording.data, sizeof (h));
+    if (h.magic != RECORDING_MAGIC || h.version != RECORDING_VERSION || h.num_rows == 0 ||
+        h.strings_size > recording.size - sizeof (h))
+        return false;
+
+    /* The source id, then the row names */
+    const gchar *s = (const gchar*) recording.data + sizeof (h);
+    const gchar *strings_end = s + h.strings_size;
+    std::vector<std::string> strings;
+    while (s < strings_end && strings.size() <= h.num_rows)
+    {
+        const gchar *nul = (const gchar*) memchr (s, '\0', strings_end - s);
+        if (!nul)
+            return false;
+        strings.push_back (std::string (s, nul));
+        s = nul + 1;
+    }
+    if (strings.size() != h.num_rows + 1)
+        return false;
+
+    recording.source_id = strings[0];
+    recording.row_names.assign (strings.begin() + 1, strings.end());
+    recording.num_rows = h.num_rows;
+    recording.min_value = h.min_value;
+    recording.max_value = h.max_value;
+    recording.frames_start = sizeof (h) + h.strings_size;
+
+    const gsize index_size = h.index_entries * sizeof (RecordingIndexEntry);
+    if (h.index_offset >= recording.frames_start && h.index_offset <= recording.size &&
+        h.index_entries <= recording.size / sizeof (RecordingIndexEntry) &&
+        index_size == recording.size - h.index_offset)
+    {
+        recording.frames_end = h.index_offset;
+        recording.index.resize (h.index_entries);
+        memcpy (recording.index.data(), recording.data + h.index_offset, index_size);
+    }
+    else
+    {
+        /* Not closed, the panel may have crashed */
+        recording.frames_end = recording.size;
+        gint64 timestamp = 0;
+        guint64 num_frames = 0;
+        for (gsize offset = recording.frames_start; offset < recording.frames_end; num_frames++)
+        {
+            const gint64 previous = timestamp;
+            const gsize next = read_recorded_frame (recording, offset, timestamp, nullptr, nullptr);
+            if (next == 0)
+            {
+                recording.frames_end = offset;
+                break;
+            }
+            if (num_frames % RECORDING_INDEX_FRAMES == 0)
+                recording.index.push_back ({previous, offset});
+            offset = next;
+        }
+    }
+    return true;
+}
+
+std::vector<std::string>
+list_recordings (const std::string &path)
+{
+    if (g_file_test (path.c_str(), G_FILE_TEST_IS_DIR))
+        return list_directory (path);
+    return std::vector<std::string> {path};
+}
+
+gsize
+seek_recording (const Recording &recording, gint64 timestamp, gint64 &previous)
+{
+    /* The last entry whose frames before are all older than timestamp */
+    auto entry = std::lower_bound (recording.index.begin(), recording.index.end(), timestamp,
+                                   [](const RecordingIndexEntry &e, gint64 t) { return e.previous < t; });
+    gsize offset = recording.frames_start;
+    previous = 0;
+    if (entry != recording.index.begin())
+    {
+        --entry;
+        offset = entry->offset;
+        previous = entry->previous;
+    }
+
+    while (offset < recording.frames_end)
+    {
+        gint64 t = previous;
+        const gsize next = read_recorded_frame (recording, offset, t, nullptr, nullptr);
+        if (next == 0)
+            break;
+        if (t >= timestamp)
+            return offset;
+        previous = t;
+        offset = next;
+    }
+    return 0;
+}
+
+
+
+/*
+ * Plays back the files of the flight recorder, or a single file, speed
+ * times faster than recorded. Every sample() sums the tick deltas of the
+ * frames recorded since the previous one, as the shared sampler does for
+ * slow subscribers. The idle time between two files is skipped.
+ * The options are, for example, "path=~/.cache/xfce4/cpuwaterfall/recording-1,speed=10,skip=60",
+ * skip being the seconds to skip at the start of the first file.
+ */
+struct ReplaySource : DataSource
+{
+    std::vector<std::string> paths;
+    size_t next_path = 0;
+    guint speed = 1;
+    gint64 skip = 0;                    /* Microseconds */
+
+    Ptr0<Recording> recording;          /* Being played */
+    Ptr0<Recording> shown;              /* Its rows are those of the plugin */
+    gsize offset = 0;                   /* Of the next frame, 0 at the end of recording */
+    gint64 timestamp = 0;               /* Of the frame before offset */
+    gsize released = 0;                 /* Offset up to which the pages were dropped */
+    gint64 replay_time = 0;             /* Recorded time played so far */
+    gint64 wall_time = 0;               /* Monotonic time of the previous sample() */
+    std::vector<guint64> used, total;
+    std::vector<guint32> ticks;
+
+    guint num_rows () const override { return shown->num_rows; }
+    gfloat min_value () const override { return shown->min_value; }
+    gfloat max_value () const override { return shown->max_value; }
+
+    std::string
+    row_name (guint row) const override
+    {
+        if (row != 0)
+            return shown->row_names[row];
+
+        GDateTime *time = g_date_time_new_from_unix_local (replay_time / G_USEC_PER_SEC);
+        gchar *when = g_date_time_format (time, "%x %X");
+        const std::string name = xfce4::sprintf (_("%s, replayed at %ux, %s"), shown->row_names[0].c_str(), speed, when);
+        g_free (when);
+        g_date_time_unref (time);
+        return name;
+    }
+
+    /* Loads are shown as percents, the other values as recorded */
+    std::string
+    format_value (gfloat value) const override
+    {
+        if (shown->min_value == 0 && shown->max_value == 1)
+            return xfce4::sprintf ("%u%%", (guint) roundf (value * 100));
+        return DataSource::format_value (value);
+    }
+
+    /* Opens the next file which can be read. Returns false after the last one. */
+    bool
+    open_next ()
+    {
+        while (next_path < paths.size())
+        {
+            auto next = xfce4::make<Recording>();
+            const std::string &path = paths[next_path++];
+            if (!open_recording (*next, path))
+            {
+                g_warning ("replay: cannot read %s", path.c_str());
+                continue;
+            }
+
+            gint64 previous = 0;
+            offset = next->frames_start < next->frames_end ? next->frames_start : 0;
+            if (skip != 0 && offset != 0)
+            {
+                gint64 first = 0;
+                read_recorded_frame (*next, offset, first, nullptr, nullptr);
+                offset = seek_recording (*next, first + skip, previous);
+                skip = 0;
+            }
+            if (offset == 0)
+                continue;
+
+            recording = next;
+            timestamp = previous;
+            released = 0;
+
+            /* Not waiting for the time the panel was not recording */
+            gint64 first = timestamp;
+            read_recorded_frame (*recording, offset, first, nullptr, nullptr);
+            if (replay_time < first)
+                replay_time = first;
+            g_info ("replay: %s", path.c_str());
+            return true;
+        }
+        return false;
+    }
+
+    bool
+    update_layout () override
+    {
+        if (offset != 0 || !open_next ())
+            return false;
+
+        const bool same_rows = recording->num_rows == shown->num_rows && recording->row_names == shown->row_names &&
+                               recording->min_value == shown->min_value && recording->max_value == shown->max_value;
+        shown = recording;
+        if (same_rows)
+            return false;
+
+        used.assign (shown->num_rows, 0);
+        total.assign (shown->num_rows, 0);
+        ticks.assign (shown->num_rows, 0);
+        return true;
+    }
+
+    bool
+    sample (gfloat *frame) override
+    {
+        const gint64 now = g_get_monotonic_time ();
+        if (wall_time != 0)
+            replay_time += (now - wall_time) * speed;
+        wall_time = now;
+
+        if (offset == 0)
+            return false;
+
+        std::fill (used.begin(), used.end(), 0);
+        std::fill (total.begin(), total.end(), 0);
+        guint num_frames = 0;
+        while (offset != 0)
+        {
+            gint64 t = timestamp;
+            if (read_recorded_frame (*recording, offset, t, nullptr, nullptr) == 0)
+                offset = 0;
+            else if (t > replay_time)
+                break;
+            else
+            {
+                offset = read_recorded_frame (*recording, offset, timestamp, used.data(), total.data());
+                if (offset == recording->frames_end)
+                    offset = 0;
+                num_frames++;
+            }
+        }
+        if (offset == 0)
+            g_info ("replay: end of %s", recording->path.c_str());
+
+        /* The frames played are not needed any more */
+        const gsize played = offset ? offset : recording->frames_end;
+        if (played - released >= REPLAY_RELEASE_BYTES)
+        {
+            const gsize page = sysconf (_SC_PAGESIZE);
+            const gsize until = played / page * page;
+            madvise ((void*) (recording->data + released), until - released, MADV_DONTNEED);
+            released = until;
+        }
+
+        if (num_frames == 0)
+            return false;
+
+        for (guint row = 0; row < shown->num_rows; row++)
+        {
+            ticks[row] = encode_ticks (used[row], total[row]);
+            frame[row] = total[row] ? denormalize ((gfloat) used[row] / total[row]) : NAN;
+        }
+        return true;
+    }
+
+    bool
+    sample_ticks (guint32 *out) const override
+    {
+        std::copy (ticks.begin(), ticks.end(), out);
+        return true;
+    }
+
+    bool
+    sample_deltas (guint64 *out_used, guint64 *out_total) const override
+    {
+        std::copy (used.begin(), used.begin() + shown->num_rows, out_used);
+        std::copy (total.begin(), total.begin() + shown->num_rows, out_total);
+        return true;
+    }
+};
+
+Ptr0<DataSource>
+create_replay_source (const std::string &options)
+{
+    auto source = xfce4::make<ReplaySource>();
+    std::string path;
+
+    const gchar *config = options.empty() ? g_getenv ("CPUWATERFALL_REPLAY") : options.c_str();
+    if (config)
+    {
+        gchar **options = g_strsplit (config, ",", -1);
+        for (gchar **opt = options; *opt; opt++)
+        {
+            const std::string option = *opt;
+            const std::string::size_type eq = option.find ('=');
+            if (eq == std::string::npos)
+                continue;
+            const std::string key = xfce4::trim (option.substr (0, eq));
+            const std::string value = xfce4::trim (option.substr (eq + 1));
+
+            if (key == "path")
+                path = xfce4::starts_with (value, "~/") ? g_get_home_dir () + value.substr (1) : value;
+            else if (key == "speed")
+                source->speed = CLAMP (g_ascii_strtoull (value.c_str(), NULL, 10), 1, MAX_REPLAY_SPEED);
+            else if (key == "skip")
+                source->skip = g_ascii_strtoull (value.c_str(), NULL, 10) * G_USEC_PER_SEC;
+            else
+                g_warning ("replay source: unknown option '%s'", key.c_str());
+        }
+        g_strfreev (options);
+    }
+
+    if (path.empty())
+    {
+        g_warning ("replay source: no path configured");
+        return nullptr;
+    }
+
+    source->paths = list_recordings (path);
+    if (!source->open_next ())
+    {
+        g_warning ("replay source: no recording in %s", path.c_str());
+        return nullptr;
+    }
+    source->shown = source->recording;
+    source->used.assign (source->shown->num_rows, 0);
+    source->total.assign (source->shown->num_rows, 0);
+    source->ticks.assign (source->shown->num_rows, 0);
+
+    g_info ("replay source: %zu files, %u rows, %ux", source->paths.size(), source->shown->num_rows, source->speed);
+    return source;
+}
@@ -0,0 +1,114 @@
+/*  recorder.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_RECORDER_H_
+#define _XFCE_CPUWATERFALL_RECORDER_H_
+
+#include <glib.h>
+#include <string>
+#include <vector>
+#include "source.h"
+
+#define RECORDING_SUFFIX ".cwrec"
+#define RECORDER_FILES 4            /* The budget of a recorder is split between this many files */
+#define RECORDING_INDEX_FRAMES 64   /* Frames per index entry */
+
+/* Every RECORDING_INDEX_FRAMES frames of a recording, see recorder.cc */
+struct RecordingIndexEntry
+{
+    gint64 previous;                /* Timestamp of the frame before offset, zero at the start of the file */
+    guint64 offset;
+};
+
+/*
+ * Flight recorder: appends the tick deltas of every frame to a file of
+ * dir, starting a new file when the rows of the source change or when the
+ * file reaches its share of max_bytes. The oldest files are deleted to stay
+ * within max_bytes.
+ */
+struct FlightRecorder
+{
+    std::string dir;
+    gsize max_bytes = 0;            /* Zero not to record */
+    gint fd = -1;                   /* Of the open file, -1 if none */
+    std::string path;
+    std::string header;             /* Of the open file, for the next one */
+    guint num_rows = 0;
+    gsize file_bytes = 0;
+    guint64 num_frames = 0;         /* In the open file */
+    gint64 last_timestamp = 0;
+    std::vector<RecordingIndexEntry> index;
+    std::string buffer;
+
+    FlightRecorder() {}
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+    ~FlightRecorder();
+};
+
+/* Sets the directory and the budget, closing the open file. Zero max_bytes stops the recording. */
+void set_recorder (FlightRecorder &recorder, const std::string &dir, gsize max_bytes);
+
+/* Starts a new file for the rows of the source, unless the recorder is stopped */
+void start_recording (FlightRecorder &recorder, const std::string &source_id, const DataSource &source);
+
+/* Appends the num_rows tick deltas of a frame: the exact used and total
+ * deltas, or if they are NULL, ticks with the precision of encode_ticks() */
+void record_ticks (FlightRecorder &recorder, gint64 timestamp, const guint32 *ticks,
+                   const guint64 *used, const guint64 *total);
+
+/* Writes the index of the open file and closes it */
+void close_recording (FlightRecorder &recorder);
+
+/* A recording file, mapped read-only. The pages are read as the frames are decoded. */
+struct Recording
+{
+    std::string path;
+    const guint8 *data = nullptr;
+    gsize size = 0;
+    std::string source_id;
+    guint num_rows = 0;
+    std::vector<std::string> row_names;
+    gfloat min_value = 0, max_value = 1;
+    gsize frames_start = 0, frames_end = 0;     /* Offsets of the frames */
+    std::vector<RecordingIndexEntry> index;
+
+    Recording() {}
+    Recording(const Recording&) = delete;
+    Recording& operator=(const Recording&) = delete;
+    ~Recording();
+};
+
+/* Maps the file. Without an index, it was not closed: its frames are scanned up to the first broken one. */
+bool open_recording (Recording &recording, const std::string &path);
+
+/* The recording files of a directory, oldest first, or path itself if it is a file */
+std::vector<std::string> list_recordings (const std::string &path);
+
+/* Offset of the first frame at or after timestamp and the timestamp of the frame before it, 0 if there is none */
+gsize seek_recording (const Recording &recording, gint64 timestamp, gint64 &previous);
+
+/*
+ * Decodes the frame at offset: timestamp goes from the one of the previous
+ * frame to the one of this frame, and the tick deltas of the rows are added
+ * to used and total unless they are NULL. Returns the offset of the next
+ * frame, frames_end after the last one, or 0 on a broken frame.
+ */
+gsize read_recorded_frame (const Recording &recording, gsize offset, gint64 &timestamp,
+                           guint64 *used, guint64 *total);
+
+#endif /* _XFCE_CPUWATERFALL_RECORDER_H_ */
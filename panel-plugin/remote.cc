@@ -0,0 +1,446 @@
+/*  remote.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <libxfce4util/libxfce4util.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "os.h"
+#include "source.h"
+#include "wire.h"
+
+/* Delay between connection attempts to a host which is down */
+#define RECONNECT_INTERVAL_MS 5000
+
+
+
+/* One of the addresses of a host, as resolved by getaddrinfo() */
+struct RemoteAddress
+{
+    gint family, socktype, protocol;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+};
+
+struct RemoteHost
+{
+    std::string address;    /* As configured: unix:/path, HOST or HOST:PORT */
+    std::string name;       /* From the collector's hello, or the address */
+    gint fd = -1;
+    bool connecting = false;
+    bool hello = false;
+    bool resolving = false;                 /* In a worker thread, see resolve_later() */
+    std::vector<RemoteAddress> resolved;    /* Of a HOST address, resolved again after a disconnection */
+    gint64 next_attempt = 0;
+    WireDecoder decoder;
+
+    guint num_cpus = 0;             /* Rows drawn for this host, besides its average */
+    guint pending_num_cpus = 0;     /* From the latest hello, applied by update_layout() */
+
+    /* Sum of the loads received since the previous sample */
+    std::vector<gdouble> sum;
+    guint num_ticks = 0;
+    std::vector<gfloat> last;       /* size == num_cpus + 1 */
+
+    ~RemoteHost() { disconnect (); }
+
+    void
+    disconnect ()
+    {
+        if (fd >= 0)
+            close (fd);
+        fd = -1;
+        connecting = false;
+        hello = false;
+        decoder = WireDecoder();
+        resolved.clear();
+        num_ticks = 0;
+        next_attempt = g_get_monotonic_time () + RECONNECT_INTERVAL_MS * (gint64) 1000;
+    }
+};
+
+
+
+/* Resolves a HOST or HOST:PORT address. Blocks on the DNS, see resolve_later(). */
+static std::vector<RemoteAddress>
+resolve (const std::string &address)
+{
+    std::string host = address, port = xfce4::sprintf ("%d", WIRE_DEFAULT_PORT);
+    const std::string::size_type colon = address.rfind (':');
+    if (colon != std::string::npos)
+    {
+        host = address.substr (0, colon);
+        port = address.substr (colon + 1);
+    }
+
+    std::vector<RemoteAddress> addresses;
+    struct addrinfo hints, *res;
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo (host.c_str(), port.c_str(), &hints, &res) != 0)
+        return addresses;
+
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next)
+    {
+        if (ai->ai_addrlen > sizeof (RemoteAddress::addr))
+            continue;
+        RemoteAddress a;
+        a.family = ai->ai_family;
+        a.socktype = ai->ai_socktype;
+        a.protocol = ai->ai_protocol;
+        memcpy (&a.addr, ai->ai_addr, ai->ai_addrlen);
+        a.addr_len = ai->ai_addrlen;
+        addresses.push_back (a);
+    }
+    freeaddrinfo (res);
+    return addresses;
+}
+
+/* Resolves the address of the host in a worker thread, the DNS may not answer for a while */
+static void
+resolve_later (const Ptr0<RemoteHost> &host)
+{
+    struct Resolution {
+        std::vector<RemoteAddress> addresses;
+    };
+    auto resolution = xfce4::make<Resolution>();
+    const std::string address = host->address;
+    const std::weak_ptr<RemoteHost> weak = host;
+
+    host->resolving = true;
+    xfce4::run_in_thread ([address, resolution]() {
+        pin_thread_to_housekeeping_cpus ();
+        resolution->addresses = resolve (address);
+    },
+    [weak, resolution]() {
+        /* The source is gone */
+        Ptr0<RemoteHost> host = weak.lock();
+        if (!host)
+            return;
+
+        host->resolving = false;
+        if (resolution->addresses.empty())
+        {
+            g_info ("remote host %s: cannot resolve the address", host->address.c_str());
+            host->disconnect ();
+        }
+        else
+        {
+            host->resolved = resolution->addresses;
+            host->next_attempt = 0;
+        }
+    });
+}
+
+/* Starts a non-blocking connection to a unix:/path address or to a resolved host. Returns the socket, or -1. */
+static gint
+connect_to (const RemoteHost &host, bool *in_progress)
+{
+    *in_progress = false;
+
+    if (xfce4::starts_with (host.address, "unix:"))
+    {
+        struct sockaddr_un addr;
+        const std::string path = host.address.substr (5);
+        if (path.size() >= sizeof (addr.sun_path))
+            return -1;
+
+        memset (&addr, 0, sizeof (addr));
+        addr.sun_family = AF_UNIX;
+        strcpy (addr.sun_path, path.c_str());
+
+        const gint fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd >= 0 && connect (fd, (struct sockaddr*) &addr, sizeof (addr)) == 0)
+            return fd;
+        if (fd >= 0)
+            close (fd);
+        return -1;
+    }
+
+    gint fd = -1;
+    for (const RemoteAddress &a : host.resolved)
+    {
+        fd = socket (a.family, a.socktype | SOCK_CLOEXEC | SOCK_NONBLOCK, a.protocol);
+        if (fd < 0)
+            continue;
+        if (connect (fd, (const struct sockaddr*) &a.addr, a.addr_len) == 0)
+            break;
+        if (errno == EINPROGRESS)
+        {
+            *in_progress = true;
+            break;
+        }
+        close (fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+
+
+/*
+ * Per-core loads of the hosts listed in the source options, separated by
+ * commas or spaces. Each host is a band made of its average row followed
+ * by one row per CPU. Row 0 is the average of the connected hosts.
+ */
+struct RemoteSource : DataSource
+{
+    std::vector<Ptr0<RemoteHost>> hosts;
+
+    guint
+    num_rows () const override
+    {
+        guint rows = 1;
+        for (const auto &host : hosts)
+            rows += 1 + host->num_cpus;
+        return rows;
+    }
+
+    /* Finds the host of a row. Sets *index to 0 for the host's average row, to 1+cpu otherwise. */
+    const RemoteHost*
+    host_of (guint row, guint *index) const
+    {
+        if (row == 0)
+            return NULL;
+        row--;
+        for (const auto &host : hosts)
+        {
+            if (row <= host->num_cpus)
+            {
+                *index = row;
+                return host.get();
+            }
+            row -= 1 + host->num_cpus;
+        }
+        return NULL;
+    }
+
+    std::string
+    row_name (guint row) const override
+    {
+        guint index;
+        const RemoteHost *host = host_of (row, &index);
+        if (!host)
+            return _("All hosts");
+        if (index == 0)
+            return host->fd >= 0 ? host->name : xfce4::sprintf (_("%s (disconnected)"), host->name.c_str());
+        return xfce4::sprintf (_("%s: CPU %u"), host->name.c_str(), index - 1);
+    }
+
+    bool
+    row_ends_band (guint row) const override
+    {
+        guint index;
+        const RemoteHost *host = host_of (row, &index);
+        return host && index == host->num_cpus;
+    }
+
+    std::string
+    format_value (gfloat value) const override
+    {
+        if (isnan (value))
+            return "-";
+        return xfce4::sprintf ("%u%%", (guint) roundf (value * 100));
+    }
+
+    bool
+    update_layout () override
+    {
+        bool changed = false;
+        for (auto &host : hosts)
+        {
+            if (host->num_cpus != host->pending_num_cpus)
+            {
+                host->num_cpus = host->pending_num_cpus;
+                host->sum.assign (host->num_cpus + 1, 0);
+                host->last.assign (host->num_cpus + 1, NAN);
+                host->num_ticks = 0;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    void
+    receive (const Ptr0<RemoteHost> &ptr)
+    {
+        RemoteHost &host = *ptr;
+        const gint64 now = g_get_monotonic_time ();
+
+        if (host.fd < 0)
+        {
+            if (now < host.next_attempt || host.resolving)
+                return;
+            if (!xfce4::starts_with (host.address, "unix:") && host.resolved.empty())
+            {
+                resolve_later (ptr);
+                return;
+            }
+            host.fd = connect_to (host, &host.connecting);
+            if (host.fd < 0)
+            {
+                host.disconnect ();
+                return;
+            }
+        }
+
+        if (host.connecting)
+        {
+            struct pollfd pfd = {host.fd, POLLOUT, 0};
+            if (poll (&pfd, 1, 0) <= 0)
+                return;
+            gint err = 0;
+            socklen_t len = sizeof (err);
+            if (getsockopt (host.fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0)
+            {
+                host.disconnect ();
+                return;
+            }
+            host.connecting = false;
+        }
+
+        gchar buf[16384];
+        while (true)
+        {
+            const gssize n = recv (host.fd, buf, sizeof (buf), MSG_DONTWAIT);
+            if (n > 0)
+            {
+                host.decoder.feed (buf, n);
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            if (n < 0 && errno == EINTR)
+                continue;
+            g_info ("remote host %s: connection closed", host.address.c_str());
+            host.disconnect ();
+            return;
+        }
+
+        WireMessage message;
+        gint r;
+        while ((r = host.decoder.next (message)) > 0)
+        {
+            if (message.type == WIRE_HELLO)
+            {
+                host.hello = true;
+                host.name = message.hostname.empty() ? host.address : message.hostname;
+                host.pending_num_cpus = message.num_cpus;
+                g_info ("remote host %s: %s, %u CPUs", host.address.c_str(), host.name.c_str(), message.num_cpus);
+            }
+            else if (message.type == WIRE_BATCH && host.hello && host.num_cpus == host.pending_num_cpus)
+            {
+                for (const WireTick &tick : message.ticks)
+                {
+                    if (tick.load.size() != host.num_cpus + 1)
+                        continue;
+                    for (size_t row = 0; row < tick.load.size(); row++)
+                        host.sum[row] += tick.load[row];
+                    host.num_ticks++;
+                }
+            }
+        }
+        if (r < 0)
+        {
+            g_warning ("remote host %s: corrupt stream", host.address.c_str());
+            host.disconnect ();
+        }
+    }
+
+    bool
+    sample (gfloat *frame) override
+    {
+        gfloat total = 0;
+        guint num_connected = 0;
+
+        guint row = 1;
+        for (auto &host : hosts)
+        {
+            receive (host);
+
+            /* Batched ticks are averaged into one sample */
+            if (host->num_ticks > 0)
+            {
+                for (guint i = 0; i <= host->num_cpus; i++)
+                {
+                    host->last[i] = host->sum[i] / (host->num_ticks * (gdouble) WIRE_SCALE);
+                    host->sum[i] = 0;
+                }
+                host->num_ticks = 0;
+            }
+            else if (host->fd < 0)
+            {
+                std::fill (host->last.begin(), host->last.end(), NAN);
+            }
+
+            for (guint i = 0; i <= host->num_cpus; i++)
+                frame[row++] = host->last[i];
+
+            if (!host->last.empty() && !isnan (host->last[0]))
+            {
+                total += host->last[0];
+                num_connected++;
+            }
+        }
+
+        frame[0] = num_connected ? total / num_connected : NAN;
+        return true;
+    }
+};
+
+
+
+Ptr0<DataSource>
+create_remote_source (const std::string &options)
+{
+    auto source = xfce4::make<RemoteSource>();
+
+    gchar **addresses = g_strsplit_set (options.c_str(), ", ", -1);
+    for (gchar **address = addresses; *address; address++)
+    {
+        if (**address == '\0')
+            continue;
+        auto host = xfce4::make<RemoteHost>();
+        host->address = host->name = *address;
+        host->last.assign (1, NAN);
+        host->sum.assign (1, 0);
+        source->hosts.push_back (host);
+    }
+    g_strfreev (addresses);
+
+    if (source->hosts.empty())
+    {
+        g_warning ("remote source: no host configured");
+        return nullptr;
+    }
+    return source;
+}
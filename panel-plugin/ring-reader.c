@@ -0,0 +1,160 @@
+/*  ring-reader.c
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * cpuwaterfall-ring-reader: example reader of the samples published by the
+ * plugin with "Publish samples in shared memory", built with
+ * "make cpuwaterfall-ring-reader". It needs nothing but cpuwaterfall-ring.h.
+ *
+ * For every frame it prints the aggregate load, the busiest CPU and how
+ * long after the sample it got the frame. It follows the plugin when the
+ * rows change or when the panel restarts.
+ *
+ * Usage: cpuwaterfall-ring-reader NAME
+ *   NAME is the shared memory object, /cpuwaterfall-UID-ID where ID is
+ *   the number of the plugin in the panel.
+ */
+
+/* For syscall() and the POSIX functions of cpuwaterfall-ring.h */
+#define _GNU_SOURCE
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "cpuwaterfall-ring.h"
+
+#if defined (__linux__)
+
+static int64_t
+real_time_us (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_REALTIME, &ts);
+    return ts.tv_sec * (int64_t) 1000000 + ts.tv_nsec / 1000;
+}
+
+/* The writer may have died without closing the ring */
+static int
+writer_gone (const struct cwf_ring_header *h)
+{
+    return kill (h->writer_pid, 0) != 0 && errno == ESRCH;
+}
+
+static void
+print_frame (struct cwf_ring_slot *slot, const uint32_t *ids, uint32_t num_rows, uint64_t missed)
+{
+    const float *load = cwf_slot_load (slot);
+    uint32_t busiest = 0;
+    for (uint32_t row = 1; row < num_rows; row++)
+        if (busiest == 0 || load[row] > load[busiest])
+            busiest = row;
+
+    const time_t seconds = slot->timestamp_us / 1000000;
+    struct tm tm;
+    char when[16];
+    localtime_r (&seconds, &tm);
+    strftime (when, sizeof (when), "%H:%M:%S", &tm);
+
+    printf ("%s.%03d  usage %5.1f%%", when, (int) (slot->timestamp_us % 1000000 / 1000), 100 * load[0]);
+    if (busiest != 0 && ids[busiest] != CWF_ROW_AGGREGATE)
+        printf ("  busiest CPU %u %5.1f%%", ids[busiest], 100 * load[busiest]);
+    else if (busiest != 0)
+        printf ("  busiest row %u %5.1f%%", busiest, 100 * load[busiest]);
+    printf ("  +%lld us", (long long) (real_time_us () - slot->timestamp_us));
+    if (missed)
+        printf ("  (%llu frames missed)", (unsigned long long) missed);
+    printf ("\n");
+    fflush (stdout);
+}
+
+/* Reads the frames of a ring until the writer leaves it */
+static void
+follow (const void *ring)
+{
+    const struct cwf_ring_header *h = (const struct cwf_ring_header*) ring;
+    const uint32_t *ids = cwf_ring_cpu_ids (ring);
+    struct cwf_ring_slot *copy = (struct cwf_ring_slot*) malloc (h->slot_size);
+    uint64_t n = cwf_ring_head (ring);
+    uint64_t missed = 0;
+
+    printf ("%u rows, written by process %d\n", h->num_rows, h->writer_pid);
+    while (!cwf_ring_closed (ring))
+    {
+        if (!cwf_ring_wait (ring, n, 1000))
+        {
+            if (writer_gone (h))
+                break;
+            continue;
+        }
+
+        /* Too slow: skip to the oldest frame which is still there */
+        const uint64_t head = cwf_ring_head (ring);
+        if (head - n > h->num_slots)
+        {
+            missed += head - n - h->num_slots;
+            n = head - h->num_slots;
+        }
+
+        if (cwf_ring_read (ring, n, copy))
+        {
+            print_frame (copy, ids, h->num_rows, missed);
+            missed = 0;
+        }
+        else
+            missed++;
+        n++;
+    }
+    free (copy);
+}
+
+int
+main (int argc, char **argv)
+{
+    if (argc != 2)
+    {
+        fprintf (stderr, "Usage: cpuwaterfall-ring-reader NAME\n");
+        return 1;
+    }
+
+    for (;;)
+    {
+        size_t size;
+        const void *ring = cwf_ring_open (argv[1], &size);
+        if (!ring)
+        {
+            /* Not published yet */
+            sleep (1);
+            continue;
+        }
+        follow (ring);
+        cwf_ring_close (ring, size);
+    }
+    return 0;
+}
+
+#else
+
+int
+main (int argc, char **argv)
+{
+    fprintf (stderr, "cpuwaterfall-ring-reader: not supported on this system\n");
+    return 1;
+}
+
+#endif
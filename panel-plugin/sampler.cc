@@ -0,0 +1,183 @@
+/*  sampler.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * cpuwaterfall-sampler: reads the per-CPU load on behalf of the plugin's
+ * "CPU usage (separate process)" source, so that a stalled /proc read
+ * blocks this process instead of the panel. Frames are published in a
+ * shared-memory ring, see cpuwaterfall-ring.h.
+ *
+ * Usage: cpuwaterfall-sampler -r RING_FD -k KICK_FD -e EVENT_FD
+ *   The plugin passes a memory file, which the sampler sizes and fills,
+ *   and two eventfds: one frame is sampled per read of KICK_FD, and
+ *   EVENT_FD is incremented after each frame.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpuwaterfall-ring.h"
+#include "os.h"
+
+#if defined (__linux__)
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+#define RING_SLOTS 64
+
+static volatile sig_atomic_t quit = 0;
+
+
+
+static void
+quit_handler (int sig)
+{
+    quit = 1;
+}
+
+static void
+usage ()
+{
+    fprintf (stderr, "Usage: cpuwaterfall-sampler -r RING_FD -k KICK_FD -e EVENT_FD\n");
+}
+
+
+
+int
+main (int argc, char **argv)
+{
+    gint ring_fd = -1, kick_fd = -1, event_fd = -1;
+    gint opt;
+
+    while ((opt = getopt (argc, argv, "r:k:e:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r': ring_fd = atoi (optarg); break;
+            case 'k': kick_fd = atoi (optarg); break;
+            case 'e': event_fd = atoi (optarg); break;
+            default:  usage (); return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (ring_fd < 0 || kick_fd < 0 || event_fd < 0 || optind != argc)
+    {
+        usage ();
+        return 1;
+    }
+
+    /* Nobody reads the ring once the panel is gone */
+    prctl (PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid () == 1)
+        return 0;
+
+    /* Without SA_RESTART, so that the blocking read of the kicks returns */
+    struct sigaction sa;
+    memset (&sa, 0, sizeof (sa));
+    sa.sa_handler = quit_handler;
+    sigaction (SIGINT, &sa, NULL);
+    sigaction (SIGTERM, &sa, NULL);
+
+    CpuRows cpus;
+    if (!init_cpu_rows (cpus))
+    {
+        fprintf (stderr, "cpuwaterfall-sampler: cannot read the CPU load\n");
+        return 1;
+    }
+
+    const guint num_rows = cpus.size();
+    const size_t size = cwf_ring_size (num_rows, RING_SLOTS);
+    void *ring = MAP_FAILED;
+    if (ftruncate (ring_fd, size) == 0)
+        ring = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+    if (ring == MAP_FAILED)
+    {
+        perror ("cpuwaterfall-sampler: ring");
+        return 1;
+    }
+
+    struct cwf_ring_header *header = (struct cwf_ring_header*) ring;
+    header->version = CWF_RING_VERSION;
+    header->num_rows = num_rows;
+    header->num_slots = RING_SLOTS;
+    header->slot_size = cwf_ring_slot_size (num_rows);
+    header->ids_offset = 64;
+    header->slots_offset = size - RING_SLOTS * header->slot_size;
+    header->writer_pid = getpid ();
+    header->head = 0;
+    uint32_t *ids = (uint32_t*) ((char*) ring + header->ids_offset);
+    ids[0] = CWF_ROW_AGGREGATE;
+    for (guint row = 1; row < num_rows; row++)
+        ids[row] = cpus.ids[row-1];
+
+    /* The baseline for the first frame's deltas */
+    std::vector<gfloat> load (num_rows);
+    read_cpu_data (cpus, load.data());
+    gint64 previous = g_get_monotonic_time ();
+
+    /* Readers check the magic last */
+    __atomic_store_n (&header->magic, CWF_RING_MAGIC, __ATOMIC_RELEASE);
+
+    guint64 frame = 0;
+    while (!quit)
+    {
+        guint64 kicks;
+        if (read (kick_fd, &kicks, sizeof (kicks)) != sizeof (kicks))
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            perror ("cpuwaterfall-sampler: kick");
+            break;
+        }
+
+        struct cwf_ring_slot *slot = cwf_ring_begin (ring, frame);
+        if (!read_cpu_data (cpus, cwf_slot_load (slot)))
+            continue;
+
+        const gint64 now = g_get_monotonic_time ();
+        slot->timestamp_us = g_get_real_time ();
+        slot->interval_us = MIN (now - previous, (gint64) G_MAXUINT32);
+        slot->flags = 0;
+        memcpy (cwf_slot_ticks (slot, num_rows), cpus.ticks.data(), num_rows * sizeof (guint32));
+        cwf_ring_commit (ring, slot, frame);
+        previous = now;
+        frame++;
+
+        const guint64 one = 1;
+        if (write (event_fd, &one, sizeof (one)) != sizeof (one) && errno != EAGAIN)
+            break;
+    }
+
+    munmap (ring, size);
+    return 0;
+}
+
+#else
+
+int
+main (int argc, char **argv)
+{
+    fprintf (stderr, "cpuwaterfall-sampler: not supported on this system\n");
+    return 1;
+}
+
+#endif
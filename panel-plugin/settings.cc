@@ -36,6 +36,7 @@ static const xfce4::RGBA default_colors[NUM_COLORS] =
     [BG_COLOR]         = {1.0, 1.0, 1.0, 1.0},
     [FG_COLOR1]        = {0.0, 0.0, 0.0, 1.0},
     [FG_COLOR2]        = {1.0, 0.0, 0.0, 1.0},
+    [ISOLATED_COLOR]   = {0.0, 0.5, 1.0, 1.0},
 };
 
 
@@ -44,6 +45,7 @@ static const gchar *const color_keys[NUM_COLORS] =
     [BG_COLOR]         = "Background",
     [FG_COLOR1]        = "Foreground1",
     [FG_COLOR2]        = "Foreground2",
+    [ISOLATED_COLOR]   = "IsolatedColor",
 };
 
 
@@ -56,9 +58,20 @@ read_settings (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base)
     bool border = true;
     bool frame = false;
     bool has_average = true;
+    bool has_power = false;
+    bool has_temperature = false;
+    gint cpu_budget = 0;
+    HistoryFormat history_format = HISTORY_TICKS;
+    bool persist_history = true;
+    gint history_sync = 0;
+    gint archive_hours = 0;
+    gint recorder_size = 0;
+    bool publish_samples = false;
 
     xfce4::RGBA colors[NUM_COLORS];
     std::string command;
+    std::string source = data_source_types()[0].id;
+    std::string source_options;
     bool in_terminal = true;
     bool startup_notification = false;
 
@@ -78,17 +91,35 @@ read_settings (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base)
             Ptr0<std::string> value;
 
             rate = (CPUWaterfallUpdateRate) rc->read_int_entry ("UpdateInterval", rate);
+            mode = (CPUWaterfallMode) rc->read_int_entry ("Mode", mode);
             size = rc->read_int_entry ("Size", size);
             frame = rc->read_int_entry ("Frame", frame);
             in_terminal = rc->read_int_entry ("InTerminal", in_terminal);
             startup_notification = rc->read_int_entry ("StartupNotification", startup_notification);
             border = rc->read_int_entry ("Border", border);
             has_average = rc->read_int_entry ("has_average", has_average);
+            has_power = rc->read_int_entry ("has_power", has_power);
+            has_temperature = rc->read_int_entry ("has_temperature", has_temperature);
+            cpu_budget = rc->read_int_entry ("CpuBudget", cpu_budget);
+            history_format = (HistoryFormat) rc->read_int_entry ("HistoryFormat", history_format);
+            persist_history = rc->read_int_entry ("PersistHistory", persist_history);
+            history_sync = rc->read_int_entry ("HistorySync", history_sync);
+            archive_hours = rc->read_int_entry ("ArchiveHours", archive_hours);
+            recorder_size = rc->read_int_entry ("RecorderSize", recorder_size);
+            publish_samples = rc->read_int_entry ("PublishSamples", publish_samples);
 
             if ((value = rc->read_entry ("Command", NULL))) {
                 command = *value;
             }
 
+            if ((value = rc->read_entry ("Source", NULL))) {
+                source = *value;
+            }
+
+            if ((value = rc->read_entry ("SourceOptions", NULL))) {
+                source_options = *value;
+            }
+
             for (guint i = 0; i < NUM_COLORS; i++)
             {
                 if ((value = rc->read_entry (color_keys[i], NULL)))
@@ -108,6 +139,8 @@ read_settings (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base)
         {
             case MODE_DISABLED:
             case MODE_WATERFALL:
+            case MODE_TEMPERATURE:
+            case MODE_RUN_DELAY:
                 break;
             default:
                 mode = MODE_WATERFALL;
@@ -127,6 +160,28 @@ read_settings (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base)
 
         if (G_UNLIKELY (size <= 0))
             size = 10;
+
+        if (G_UNLIKELY (cpu_budget < 0 || cpu_budget > MAX_CPU_BUDGET))
+            cpu_budget = 0;
+
+        switch (history_format)
+        {
+            case HISTORY_TICKS:
+            case HISTORY_16BIT:
+            case HISTORY_8BIT:
+                break;
+            default:
+                history_format = HISTORY_TICKS;
+        }
+
+        if (G_UNLIKELY (history_sync < 0 || history_sync > MAX_HISTORY_SYNC))
+            history_sync = 0;
+
+        if (G_UNLIKELY (archive_hours < 0 || archive_hours > MAX_ARCHIVE_HOURS))
+            archive_hours = 0;
+
+        if (G_UNLIKELY (recorder_size < 0 || recorder_size > MAX_RECORDER_SIZE))
+            recorder_size = 0;
     }
 
     CPUWaterfall::set_border (base, border);
@@ -136,11 +191,21 @@ read_settings (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base)
     CPUWaterfall::set_command (base, command);
     CPUWaterfall::set_in_terminal (base, in_terminal);
     CPUWaterfall::set_frame (base, frame);
+    CPUWaterfall::set_source (base, source, source_options);
     CPUWaterfall::set_mode (base, mode);
     CPUWaterfall::set_size (base, size);
     CPUWaterfall::set_startup_notification (base, startup_notification);
     CPUWaterfall::set_update_rate(base, rate);
     CPUWaterfall::set_average(base, has_average);
+    CPUWaterfall::set_power(base, has_power);
+    CPUWaterfall::set_temperature(base, has_temperature);
+    CPUWaterfall::set_cpu_budget(base, cpu_budget);
+    CPUWaterfall::set_history_format(base, history_format);
+    CPUWaterfall::set_history_sync(base, history_sync);
+    CPUWaterfall::set_persist_history(base, persist_history);
+    CPUWaterfall::set_archive_hours(base, archive_hours);
+    CPUWaterfall::set_recorder_size(base, recorder_size);
+    CPUWaterfall::set_publish_samples(base, publish_samples);
 }
 
 
@@ -161,6 +226,8 @@ write_settings (XfcePanelPlugin *plugin, const Ptr<const CPUWaterfall> &base)
 
     rc->write_int_entry ("UpdateInterval", base->update_interval);
     rc->write_int_entry ("Mode", base->mode);
+    rc->write_entry ("Source", base->source_id);
+    rc->write_default_entry ("SourceOptions", base->source_options, "");
     rc->write_int_entry ("Size", base->size);
     rc->write_int_entry ("Frame", base->has_frame ? 1 : 0);
     rc->write_int_entry ("Border", base->has_border ? 1 : 0);
@@ -168,6 +235,15 @@ write_settings (XfcePanelPlugin *plugin, const Ptr<const CPUWaterfall> &base)
     rc->write_int_entry ("InTerminal", base->command_in_terminal ? 1 : 0);
     rc->write_int_entry ("StartupNotification", base->command_startup_notification ? 1 : 0);
     rc->write_int_entry ("has_average", base->has_average ? 1 : 0);
+    rc->write_int_entry ("has_power", base->has_power ? 1 : 0);
+    rc->write_int_entry ("has_temperature", base->has_temperature ? 1 : 0);
+    rc->write_default_int_entry ("CpuBudget", base->governor.budget, 0);
+    rc->write_default_int_entry ("HistoryFormat", base->history.format, HISTORY_TICKS);
+    rc->write_default_int_entry ("PersistHistory", base->persist_history ? 1 : 0, 1);
+    rc->write_default_int_entry ("HistorySync", base->history_sync, 0);
+    rc->write_default_int_entry ("ArchiveHours", base->archive_hours, 0);
+    rc->write_default_int_entry ("RecorderSize", base->recorder_size, 0);
+    rc->write_default_int_entry ("PublishSamples", base->publish_samples ? 1 : 0, 0);
 
     for (guint i=0; i<NUM_COLORS; i++)
     {
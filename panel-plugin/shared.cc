@@ -0,0 +1,771 @@
+/*  shared.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
+#include "cpuwaterfall-ring.h"
+#include "governor.h"
+#include "os.h"
+#include "publisher.h"
+#include "shared.h"
+
+#if defined (__linux__)
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+struct SharedSource
+{
+    std::string id, options;
+    Ptr0<DataSource> source;
+    Ptr0<Topology> topology;
+    bool opening;
+    std::vector<SourceSubscription*> subscribers;
+    guint timeout_id;
+    guint interval_ms;              /* Of the timer */
+    std::vector<gfloat> frame;
+    std::vector<guint32> ticks;
+    std::vector<guint64> used, total;   /* Exact deltas of ticks, if has_deltas */
+    bool has_deltas;
+    std::vector<gfloat> sum_frame;  /* Delivered to the slower subscribers */
+    std::vector<guint32> sum_ticks;
+
+    ~SharedSource();
+};
+
+/* The sources of this process by ID and options, until their last subscriber is gone.
+ * The panel runs each instance in its own wrapper process, where it is the only subscriber
+ * unless the plugin is loaded into the panel itself. See SessionSource for the sharing
+ * between the processes. */
+static std::map<std::pair<std::string, std::string>, std::weak_ptr<SharedSource>> shared_sources;
+
+static void update_timer (SharedSource &shared);
+
+
+
+SharedSource::~SharedSource()
+{
+    if (timeout_id)
+        g_source_remove (timeout_id);
+    shared_sources.erase (std::make_pair (id, options));
+}
+
+SourceSubscription::~SourceSubscription()
+{
+    if (shared)
+    {
+        auto &subscribers = shared->subscribers;
+        subscribers.erase (std::remove (subscribers.begin(), subscribers.end(), this), subscribers.end());
+        update_timer (*shared);
+    }
+}
+
+
+
+static void
+reset_sums (SourceSubscription &subscription, guint num_rows)
+{
+    subscription.num_samples = 0;
+    subscription.used.assign (num_rows, 0);
+    subscription.total.assign (num_rows, 0);
+}
+
+/* Delivers the latest frame, or the mean of the frames since the previous delivery */
+static void
+deliver (SharedSource &shared, SourceSubscription &subscription)
+{
+    const DataSource &source = *shared.source;
+    const guint num_rows = shared.frame.size();
+
+    if (subscription.num_samples == 1)
+    {
+        if (shared.has_deltas)
+            subscription.sampled (shared.frame.data(), shared.ticks.data(),
+                                  shared.used.data(), shared.total.data(), subscription.new_layout);
+        else
+            subscription.sampled (shared.frame.data(), shared.ticks.data(), nullptr, nullptr, subscription.new_layout);
+    }
+    else
+    {
+        for (guint row = 0; row < num_rows; row++)
+        {
+            const guint64 used = subscription.used[row], total = subscription.total[row];
+            shared.sum_ticks[row] = encode_ticks (used, total);
+            shared.sum_frame[row] = total ? source.denormalize ((gfloat) used / total) : shared.frame[row];
+        }
+        subscription.sampled (shared.sum_frame.data(), shared.sum_ticks.data(),
+                              subscription.used.data(), subscription.total.data(), subscription.new_layout);
+    }
+
+    subscription.new_layout = false;
+    reset_sums (subscription, num_rows);
+}
+
+static xfce4::TimeoutResponse
+sample_cb (SharedSource *shared)
+{
+    DataSource &source = *shared->source;
+    const gint64 cpu_start = thread_cpu_time ();
+
+    if (source.update_layout ())
+    {
+        const guint num_rows = source.num_rows();
+        shared->frame.assign (num_rows, source.min_value());
+        shared->ticks.assign (num_rows, 0);
+        shared->used.assign (num_rows, 0);
+        shared->total.assign (num_rows, 0);
+        shared->sum_frame.resize (num_rows);
+        shared->sum_ticks.resize (num_rows);
+        for (SourceSubscription *subscription : shared->subscribers)
+        {
+            subscription->new_layout = true;
+            reset_sums (*subscription, num_rows);
+        }
+    }
+
+    if (!source.timed_sample (shared->frame.data()))
+        return xfce4::TIMEOUT_AGAIN;
+
+    const guint num_rows = shared->frame.size();
+    if (!source.sample_ticks (shared->ticks.data()))
+        for (guint row = 0; row < num_rows; row++)
+            shared->ticks[row] = source.value_ticks (shared->frame[row]);
+    shared->has_deltas = source.sample_deltas (shared->used.data(), shared->total.data());
+
+    /* The subscribers share the cost of sampling, and account for their own handlers */
+    guint num_attached = 0;
+    for (const SourceSubscription *subscription : shared->subscribers)
+        num_attached += subscription->attached;
+    const gint64 cpu_time = thread_cpu_time () - cpu_start;
+    for (SourceSubscription *subscription : shared->subscribers)
+        if (subscription->attached)
+            subscription->cpu_time += cpu_time / num_attached;
+
+    /* A subscriber is due if its time is nearer than the next tick */
+    const gint64 now = g_get_monotonic_time ();
+    const gint64 half_tick = shared->interval_ms * (gint64) 500;
+
+    for (SourceSubscription *subscription : shared->subscribers)
+    {
+        if (!subscription->attached)
+            continue;
+
+        for (guint row = 0; row < num_rows; row++)
+        {
+            subscription->used[row] += shared->has_deltas ? shared->used[row] : ticks_used (shared->ticks[row]);
+            subscription->total[row] += shared->has_deltas ? shared->total[row] : ticks_total (shared->ticks[row]);
+        }
+        subscription->num_samples++;
+
+        if (now + half_tick >= subscription->due)
+        {
+            subscription->due += subscription->interval_ms * (gint64) 1000;
+            if (subscription->due <= now)
+                subscription->due = now + subscription->interval_ms * (gint64) 1000;
+            deliver (*shared, *subscription);
+        }
+    }
+
+    return xfce4::TIMEOUT_AGAIN;
+}
+
+/* Runs the timer at the interval of the fastest subscriber, if any */
+static void
+update_timer (SharedSource &shared)
+{
+    guint interval_ms = 0;
+    for (const SourceSubscription *subscription : shared.subscribers)
+        if (subscription->attached && (interval_ms == 0 || interval_ms > subscription->interval_ms))
+            interval_ms = subscription->interval_ms;
+
+    if (!shared.source)
+        interval_ms = 0;
+    if (interval_ms == shared.interval_ms)
+        return;
+
+    if (shared.timeout_id)
+    {
+        g_source_remove (shared.timeout_id);
+        shared.timeout_id = 0;
+    }
+
+    shared.interval_ms = interval_ms;
+    if (interval_ms != 0)
+    {
+        shared.source->set_interval (interval_ms);
+
+        /* The subscribers own the source, and its destructor removes the timer */
+        SharedSource *raw = &shared;
+        shared.timeout_id = xfce4::timeout_add (interval_ms, [raw]() { return sample_cb (raw); });
+        g_info ("source '%s': sampled every %u ms for %zu subscribers",
+                shared.id.c_str(), interval_ms, shared.subscribers.size());
+    }
+}
+
+static void
+attach (SharedSource &shared, SourceSubscription &subscription)
+{
+    subscription.attached = true;
+    subscription.new_layout = false;
+    subscription.due = g_get_monotonic_time () + subscription.interval_ms * (gint64) 1000;
+    reset_sums (subscription, shared.frame.size());
+    update_timer (shared);
+
+    /* Called last and through a copy, the handler may destroy the subscription */
+    const auto opened = subscription.opened;
+    opened (shared.source, shared.topology);
+}
+
+/* Attaches the subscribers which are still waiting for the source */
+static void
+attach_waiting (const Ptr<SharedSource> &shared)
+{
+    const std::vector<SourceSubscription*> waiting = shared->subscribers;
+    for (SourceSubscription *subscription : waiting)
+    {
+        const auto &subscribers = shared->subscribers;
+        if (std::find (subscribers.begin(), subscribers.end(), subscription) != subscribers.end() && !subscription->attached)
+            attach (*shared, *subscription);
+    }
+}
+
+#if defined (__linux__)
+#define SESSION_SLOTS 32                /* Processes which can ask for an interval */
+#define SESSION_DEFAULT_INTERVAL_MS 1000
+#define SESSION_STALL_INTERVALS 3       /* Without a frame, before a gap is drawn and the ring is opened again */
+#define SESSION_OPEN_TIMEOUT_MS 5000    /* For the first ring of the writer */
+
+/*
+ * The lock file of a source shared by the processes of the session, in the
+ * runtime directory. The process which holds its flock() samples the source.
+ * Every process maps the file and asks for its interval in a slot, and the
+ * writer samples at the shortest interval of the living processes.
+ */
+struct SessionRequests
+{
+    struct {
+        gint32 pid;                     /* Zero if the slot is free */
+        guint32 interval_ms;
+    } slots[SESSION_SLOTS];
+};
+
+struct SessionLock
+{
+    gint fd = -1;
+    SessionRequests *requests = nullptr;
+
+    ~SessionLock();
+};
+
+/* Samples the source in a thread of its own and publishes the frames, while the process holds the lock */
+struct SessionWriter
+{
+    std::string id, options, ring_name;
+    Ptr0<SessionLock> lock;
+    GMutex mutex;
+    GCond cond;                         /* Signalled on stop and on a new interval */
+    bool stop = false;
+    std::atomic<bool> failed;           /* The source cannot be opened */
+
+    SessionWriter() : failed (false) { g_mutex_init (&mutex); g_cond_init (&cond); }
+    ~SessionWriter() { g_mutex_clear (&mutex); g_cond_clear (&cond); }
+};
+
+/*
+ * A CPU usage source sampled once for all the plugin processes of the
+ * session. Each process reads the frames from the ring of the writer, which
+ * may be this process. If the writer exits or dies, the kernel releases its
+ * lock and the next process to take it becomes the writer. If the writer
+ * stalls, the readers draw a gap instead of blocking.
+ */
+struct SessionSource : DataSource
+{
+    std::string id, options, ring_name;
+    Ptr0<SessionLock> lock;
+    gint slot = -1;                     /* In lock->requests, -1 if none was free */
+    Ptr0<SessionWriter> writer;         /* Non-NULL once this process took the lock */
+    guint interval_ms = SESSION_DEFAULT_INTERVAL_MS;
+
+    const void *ring = nullptr;
+    gsize ring_size = 0;
+    gint64 ring_opened = 0;             /* Monotonic */
+    gint64 last_frame = 0;              /* Monotonic time a frame was last read */
+    std::vector<guint32> cpu_ids = {CWF_ROW_AGGREGATE};    /* By row */
+    std::vector<guint32> pending_ids;                       /* From a new ring, applied by update_layout() */
+    guint64 next_frame = 0;
+    std::vector<gchar> copy;
+    std::vector<guint64> used, total;
+    std::vector<guint32> ticks;
+
+    ~SessionSource() override;
+
+    guint num_rows () const override { return cpu_ids.size(); }
+    gint row_cpu (guint row) const override { return row == 0 ? -1 : (gint) cpu_ids[row]; }
+    Ptr0<Topology> topology () const override { return read_topology ("/sys"); }
+    bool local_topology () const override { return true; }
+
+    std::string
+    row_name (guint row) const override
+    {
+        return row == 0 ? _("Usage") : xfce4::sprintf (_("CPU %u"), cpu_ids[row]);
+    }
+
+    std::string
+    format_value (gfloat value) const override
+    {
+        return isnan (value) ? "-" : xfce4::sprintf ("%u%%", (guint) roundf (value * 100));
+    }
+
+    bool
+    update_layout () override
+    {
+        if (pending_ids.empty() || pending_ids == cpu_ids)
+            return false;
+        cpu_ids = pending_ids;
+        return true;
+    }
+
+    bool take_lock ();
+    bool open_ring ();
+    void set_interval (guint interval_ms) override;
+    bool sample (gfloat *frame) override;
+
+    bool
+    sample_ticks (guint32 *out) const override
+    {
+        std::copy (ticks.begin(), ticks.end(), out);
+        return true;
+    }
+
+    /* The sums of the frames of the ring, which are exact below 2^14 ticks per frame and row */
+    bool
+    sample_deltas (guint64 *out_used, guint64 *out_total) const override
+    {
+        std::copy (used.begin(), used.end(), out_used);
+        std::copy (total.begin(), total.end(), out_total);
+        return true;
+    }
+};
+
+SessionLock::~SessionLock()
+{
+    if (requests)
+        munmap (requests, sizeof (*requests));
+    if (fd >= 0)
+        close (fd);
+}
+
+static Ptr0<SessionLock>
+open_session_lock (const std::string &path)
+{
+    auto lock = xfce4::make<SessionLock>();
+    struct stat st;
+
+    /* The processes size the file alike, a second ftruncate() changes nothing */
+    lock->fd = open (path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock->fd < 0 || fstat (lock->fd, &st) != 0 ||
+        (st.st_size < (off_t) sizeof (SessionRequests) && ftruncate (lock->fd, sizeof (SessionRequests)) != 0))
+        return nullptr;
+
+    void *map = mmap (NULL, sizeof (SessionRequests), PROT_READ | PROT_WRITE, MAP_SHARED, lock->fd, 0);
+    if (map == MAP_FAILED)
+        return nullptr;
+    lock->requests = (SessionRequests*) map;
+    return lock;
+}
+
+static bool
+process_alive (gint32 pid)
+{
+    return pid > 0 && (kill (pid, 0) == 0 || errno == EPERM);
+}
+
+/* Takes a free slot, or the slot of a process which died without freeing it */
+static gint
+claim_request_slot (SessionRequests &requests, guint interval_ms)
+{
+    const gint32 self = getpid ();
+    for (gint i = 0; i < SESSION_SLOTS; i++)
+    {
+        gint32 pid = __atomic_load_n (&requests.slots[i].pid, __ATOMIC_ACQUIRE);
+        if ((pid == 0 || !process_alive (pid)) &&
+            __atomic_compare_exchange_n (&requests.slots[i].pid, &pid, self, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            __atomic_store_n (&requests.slots[i].interval_ms, interval_ms, __ATOMIC_RELEASE);
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* The shortest interval asked for by a living process */
+static guint
+requested_interval (const SessionRequests &requests)
+{
+    guint interval_ms = 0;
+    for (const auto &slot : requests.slots)
+    {
+        const gint32 pid = __atomic_load_n (&slot.pid, __ATOMIC_ACQUIRE);
+        const guint ms = __atomic_load_n (&slot.interval_ms, __ATOMIC_ACQUIRE);
+        if (ms != 0 && process_alive (pid) && (interval_ms == 0 || interval_ms > ms))
+            interval_ms = ms;
+    }
+    return interval_ms ? interval_ms : SESSION_DEFAULT_INTERVAL_MS;
+}
+
+static void
+run_session_writer (const Ptr<SessionWriter> &writer)
+{
+    Ptr0<DataSource> source = create_data_source (writer->id, writer->options);
+    if (!source)
+        writer->failed = true;
+    else
+    {
+        RingPublisher publisher;
+        publisher.name = writer->ring_name;
+        publish_ring (publisher, *source);
+
+        std::vector<gfloat> frame (source->num_rows(), source->min_value());
+        std::vector<guint32> ticks (source->num_rows());
+        gint64 last = 0;
+
+        g_mutex_lock (&writer->mutex);
+        while (!writer->stop)
+        {
+            /* A process asking for a shorter interval signals the condition */
+            const gint64 interval = requested_interval (*writer->lock->requests) * (gint64) 1000;
+            const gint64 due = last + interval;
+            const gint64 now = g_get_monotonic_time ();
+            if (now < due)
+            {
+                g_cond_wait_until (&writer->cond, &writer->mutex, due);
+                continue;
+            }
+            last = now - due < interval ? due : now;
+            g_mutex_unlock (&writer->mutex);
+
+            if (source->update_layout ())
+            {
+                frame.assign (source->num_rows(), source->min_value());
+                ticks.assign (source->num_rows(), 0);
+                publish_ring (publisher, *source);
+            }
+            if (source->timed_sample (frame.data()))
+            {
+                if (!source->sample_ticks (ticks.data()))
+                    for (guint row = 0; row < ticks.size(); row++)
+                        ticks[row] = source->value_ticks (frame[row]);
+                publish_frame (publisher, g_get_real_time (), ticks.data());
+            }
+
+            g_mutex_lock (&writer->mutex);
+        }
+        g_mutex_unlock (&writer->mutex);
+        close_ring (publisher);
+    }
+
+    /* The lock file may stay open in this process, the lock must not */
+    flock (writer->lock->fd, LOCK_UN);
+}
+
+SessionSource::~SessionSource()
+{
+    if (writer)
+    {
+        /* The thread exits after its current sample, which may be stuck on /proc */
+        g_mutex_lock (&writer->mutex);
+        writer->stop = true;
+        g_cond_signal (&writer->cond);
+        g_mutex_unlock (&writer->mutex);
+    }
+    if (slot >= 0)
+        __atomic_store_n (&lock->requests->slots[slot].pid, 0, __ATOMIC_RELEASE);
+    if (ring)
+        cwf_ring_close (ring, ring_size);
+}
+
+/* Becomes the writer if no process holds the lock */
+bool
+SessionSource::take_lock ()
+{
+    if (writer || flock (lock->fd, LOCK_EX | LOCK_NB) != 0)
+        return false;
+
+    auto w = xfce4::make<SessionWriter>();
+    w->id = id;
+    w->options = options;
+    w->ring_name = ring_name;
+    w->lock = lock;
+    writer = w;
+    xfce4::run_in_thread ([w]() {
+        pin_thread_to_housekeeping_cpus ();
+        run_session_writer (w);
+    }, []() {});
+    g_info ("source '%s': sampled by process %d for the session", id.c_str(), (gint) getpid ());
+    return true;
+}
+
+bool
+SessionSource::open_ring ()
+{
+    gsize size;
+    void *map = cwf_ring_open (ring_name.c_str(), &size);
+    if (!map)
+        return false;
+
+    ring = map;
+    ring_size = size;
+    ring_opened = g_get_monotonic_time ();
+    const cwf_ring_header *header = (const cwf_ring_header*) ring;
+    const uint32_t *ids = cwf_ring_cpu_ids (ring);
+    pending_ids.assign (ids, ids + header->num_rows);
+    next_frame = cwf_ring_head (ring);
+    copy.resize (header->slot_size);
+    return true;
+}
+
+void
+SessionSource::set_interval (guint ms)
+{
+    interval_ms = ms;
+    if (slot >= 0)
+        __atomic_store_n (&lock->requests->slots[slot].interval_ms, ms, __ATOMIC_RELEASE);
+    if (writer)
+    {
+        g_mutex_lock (&writer->mutex);
+        g_cond_signal (&writer->cond);
+        g_mutex_unlock (&writer->mutex);
+    }
+}
+
+bool
+SessionSource::sample (gfloat *frame)
+{
+    const gint64 now = g_get_monotonic_time ();
+    const gint64 stall = SESSION_STALL_INTERVALS * interval_ms * (gint64) 1000;
+
+    take_lock ();
+
+    /* A writer which left closed its ring. One which died left it open, and its successor publishes another. */
+    if (ring && (cwf_ring_closed (ring) || now - MAX (last_frame, ring_opened) > stall))
+    {
+        cwf_ring_close (ring, ring_size);
+        ring = nullptr;
+    }
+    if (!ring)
+        open_ring ();
+
+    const guint num_rows = cpu_ids.size();
+    guint num_frames = 0;
+    used.assign (num_rows, 0);
+    total.assign (num_rows, 0);
+    if (ring && pending_ids == cpu_ids)
+    {
+        const cwf_ring_header *header = (const cwf_ring_header*) ring;
+        const guint64 head = cwf_ring_head (ring);
+        if (head - next_frame > header->num_slots)
+            next_frame = head - header->num_slots;
+
+        for (; next_frame < head; next_frame++)
+        {
+            if (!cwf_ring_read (ring, next_frame, copy.data()))
+                continue;
+            const uint32_t *frame_ticks = cwf_slot_ticks ((struct cwf_ring_slot*) copy.data(), num_rows);
+            for (guint row = 0; row < num_rows; row++)
+            {
+                used[row] += ticks_used (frame_ticks[row]);
+                total[row] += ticks_total (frame_ticks[row]);
+            }
+            num_frames++;
+        }
+    }
+
+    /* A frame a little late goes into the next sample, a stalled writer leaves a gap */
+    if (num_frames != 0)
+        last_frame = now;
+    else if (now - last_frame < stall)
+        return false;
+
+    ticks.resize (num_rows);
+    for (guint row = 0; row < num_rows; row++)
+    {
+        ticks[row] = encode_ticks (used[row], total[row]);
+        frame[row] = total[row] ? (gfloat) used[row] / total[row] : NAN;
+    }
+    return true;
+}
+
+/* The sources of the CPU usage of this machine are sampled once for the session */
+static Ptr0<DataSource>
+open_session_source (const std::string &id, const std::string &options)
+{
+    if (id != "cpu" && id != "helper")
+        return create_data_source (id, options);
+
+    const guint hash = g_str_hash (options.c_str());
+    gchar *dir = g_build_filename (g_get_user_runtime_dir (), "xfce4", "cpuwaterfall", NULL);
+    Ptr0<SessionLock> lock;
+    if (g_mkdir_with_parents (dir, 0700) == 0)
+        lock = open_session_lock (xfce4::sprintf ("%s/session-%s-%08x.lock", dir, id.c_str(), hash));
+    g_free (dir);
+    if (!lock)
+    {
+        g_warning ("source '%s' is not shared with the other plugin processes: %s", id.c_str(), g_strerror (errno));
+        return create_data_source (id, options);
+    }
+
+    auto source = xfce4::make<SessionSource>();
+    source->id = id;
+    source->options = options;
+    source->ring_name = xfce4::sprintf ("/cpuwaterfall-%u-%s-%08x", (guint) getuid (), id.c_str(), hash);
+    source->lock = lock;
+    source->slot = claim_request_slot (*lock->requests, source->interval_ms);
+    source->take_lock ();
+
+    /* The rows come from the first ring of the writer */
+    const gint64 timeout = g_get_monotonic_time () + SESSION_OPEN_TIMEOUT_MS * (gint64) 1000;
+    while (!source->open_ring ())
+    {
+        if ((source->writer && source->writer->failed) || g_get_monotonic_time () > timeout)
+            return nullptr;
+        g_usleep (10 * 1000);
+    }
+    source->update_layout ();
+    source->last_frame = g_get_monotonic_time ();
+    return source;
+}
+
+#else
+
+static Ptr0<DataSource>
+open_session_source (const std::string &id, const std::string &options)
+{
+    return create_data_source (id, options);
+}
+
+#endif
+
+static Ptr<SharedSource>
+open_shared_source (const std::string &id, const std::string &options)
+{
+    auto shared = xfce4::make<SharedSource>();
+    shared->id = id;
+    shared->options = options;
+    shared->opening = true;
+    shared_sources[std::make_pair (id, options)] = shared.ptr;
+
+    struct Opening {
+        Ptr0<DataSource> source;
+        Ptr0<Topology> topology;
+        gint64 duration;
+    };
+    auto opening = xfce4::make<Opening>();
+
+    const std::weak_ptr<SharedSource> weak = shared.ptr;
+    xfce4::run_in_thread ([id, options, opening]() {
+        pin_thread_to_housekeeping_cpus ();
+        const gint64 start = g_get_monotonic_time ();
+        if ((opening->source = open_session_source (id, options)))
+            opening->topology = opening->source->topology ();
+        opening->duration = g_get_monotonic_time () - start;
+    },
+    [weak, opening]() {
+        /* All the subscribers are gone */
+        Ptr0<SharedSource> shared = weak.lock();
+        if (!shared)
+            return;
+
+        shared->opening = false;
+        if ((shared->source = opening->source))
+        {
+            g_info ("source '%s' opened in %.1f ms", shared->id.c_str(), opening->duration / 1e3);
+            const DataSource &source = *shared->source;
+            shared->topology = opening->topology;
+            shared->frame.assign (source.num_rows(), source.min_value());
+            shared->ticks.assign (source.num_rows(), 0);
+            shared->used.assign (source.num_rows(), 0);
+            shared->total.assign (source.num_rows(), 0);
+            shared->sum_frame.resize (source.num_rows());
+            shared->sum_ticks.resize (source.num_rows());
+        }
+        attach_waiting (shared.toPtr());
+    });
+
+    return shared;
+}
+
+Ptr<SourceSubscription>
+subscribe_source (const std::string &id, const std::string &options, guint interval_ms,
+                  const std::function<SourceSubscription::OpenedHandler> &opened,
+                  const std::function<SourceSubscription::SampledHandler> &sampled)
+{
+    Ptr0<SharedSource> shared;
+    auto it = shared_sources.find (std::make_pair (id, options));
+    if (it != shared_sources.end())
+        shared = it->second.lock();
+    if (!shared)
+        shared = open_shared_source (id, options);
+
+    auto subscription = xfce4::make<SourceSubscription>();
+    subscription->opened = opened;
+    subscription->sampled = sampled;
+    subscription->interval_ms = interval_ms;
+    subscription->cpu_time = 0;
+    subscription->shared = shared;
+    shared->subscribers.push_back (&*subscription);
+
+    /* An opened source is attached later as well, the caller may not be ready for the handler yet */
+    if (!shared->opening)
+    {
+        const std::weak_ptr<SharedSource> weak = shared;
+        xfce4::invoke_later ([weak]() {
+            Ptr0<SharedSource> shared = weak.lock();
+            if (shared)
+                attach_waiting (shared.toPtr());
+        });
+    }
+
+    return subscription;
+}
+
+void
+set_subscription_interval (const Ptr<SourceSubscription> &subscription, guint interval_ms)
+{
+    if (subscription->interval_ms == interval_ms)
+        return;
+
+    subscription->interval_ms = interval_ms;
+    subscription->due = g_get_monotonic_time () + interval_ms * (gint64) 1000;
+    if (subscription->shared)
+        update_timer (*subscription->shared);
+}
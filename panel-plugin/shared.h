@@ -0,0 +1,80 @@
+/*  shared.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_SHARED_H_
+#define _XFCE_CPUWATERFALL_SHARED_H_
+
+#include <glib.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include "xfce4++/util.h"
+#include "source.h"
+
+using xfce4::Ptr;
+
+struct SharedSource;
+
+/*
+ * A subscription to a data source shared by all the plugin instances of the
+ * process which use the same source settings. The source is opened and
+ * sampled once, by a single timer running at the interval of the fastest
+ * subscriber. Slower subscribers get the tick deltas summed over their own
+ * interval. Destroying the last subscription closes the source.
+ *
+ * The panel runs every instance in its own wrapper process. The CPU usage
+ * sources are also shared between these processes: one of them samples the
+ * source in a thread and publishes the frames in a ring, the others read the
+ * ring, see SessionSource in shared.cc.
+ */
+struct SourceSubscription
+{
+    /* Called once in the main loop, with a NULL source if it cannot be opened.
+     * This handler may destroy the subscription. */
+    typedef void OpenedHandler (const Ptr0<DataSource> &source, const Ptr0<Topology> &topology);
+
+    /* Called every interval_ms after the opening, new_layout if the rows of
+     * the source have changed since the previous call. used and total are the
+     * exact tick deltas behind ticks, NULL if the source has none (see
+     * DataSource::sample_deltas()). Must not destroy the subscription. */
+    typedef void SampledHandler (const gfloat *frame, const guint32 *ticks,
+                                 const guint64 *used, const guint64 *total, bool new_layout);
+
+    std::function<OpenedHandler> opened;
+    std::function<SampledHandler> sampled;
+    guint interval_ms;
+
+    /* Maintained by the shared sampler */
+    Ptr0<SharedSource> shared;
+    bool attached;                  /* opened() has been called */
+    bool new_layout;
+    gint64 due;                     /* Time of the next sampled() call, monotonic */
+    guint num_samples;              /* Summed in used and total */
+    std::vector<guint64> used, total;
+    gint64 cpu_time;                /* Share of the sampling, in thread CPU nanoseconds. Reset by the subscriber. */
+
+    ~SourceSubscription();
+};
+
+/* Subscribes to the source, opening it in the background unless another subscriber already did */
+Ptr<SourceSubscription> subscribe_source (const std::string &id, const std::string &options, guint interval_ms,
+                                          const std::function<SourceSubscription::OpenedHandler> &opened,
+                                          const std::function<SourceSubscription::SampledHandler> &sampled);
+
+void set_subscription_interval (const Ptr<SourceSubscription> &subscription, guint interval_ms);
+
+#endif /* _XFCE_CPUWATERFALL_SHARED_H_ */
@@ -0,0 +1,386 @@
+/*  source.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/* The fixes file has to be included before any other #include directives */
+#include "xfce4++/util/fixes.h"
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <libxfce4util/libxfce4util.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "source.h"
+#include "os.h"
+
+
+
+std::string
+DataSource::format_value (gfloat value) const
+{
+    return xfce4::sprintf ("%.2f", value);
+}
+
+
+
+bool
+DataSource::timed_sample (gfloat *frame)
+{
+    const gint64 start = g_get_monotonic_time ();
+    const bool ok = sample (frame);
+    const gint64 elapsed = g_get_monotonic_time () - start;
+
+    timing_.num_samples++;
+    timing_.total_us += elapsed;
+    timing_.last_us = elapsed;
+    if (timing_.max_us < elapsed)
+        timing_.max_us = elapsed;
+
+    return ok;
+}
+
+
+
+gfloat
+DataSource::normalize (gfloat value) const
+{
+    const gfloat min = min_value ();
+    const gfloat max = max_value ();
+    if (G_UNLIKELY (isnan (value) || max <= min))
+        return 0;
+    return CLAMP ((value - min) / (max - min), 0.0f, 1.0f);
+}
+
+guint32
+DataSource::value_ticks (gfloat value) const
+{
+    if (G_UNLIKELY (isnan (value)))
+        return 0;
+    return encode_ticks (lroundf (normalize (value) * VALUE_TICKS), VALUE_TICKS);
+}
+
+
+
+/* CPU usage from /proc/stat or its equivalent */
+struct CpuUsageSource : DataSource
+{
+    CpuRows cpus;
+    std::vector<guint64> last_used, last_total;    /* Counters before the latest read */
+
+    guint num_rows () const override { return cpus.size(); }
+    gint row_cpu (guint row) const override { return row == 0 ? -1 : (gint) cpus.ids[row-1]; }
+    Ptr0<Topology> topology () const override { return read_topology ("/sys"); }
+    bool local_topology () const override { return true; }
+
+    std::string
+    row_name (guint row) const override
+    {
+        if (row == 0)
+            return _("Usage");
+        const guint id = cpus.ids[row-1];
+        return xfce4::sprintf (cpus.is_offline (id) ? _("CPU %u (offline)") : _("CPU %u"), id);
+    }
+
+    std::string
+    format_value (gfloat value) const override
+    {
+        return xfce4::sprintf ("%u%%", (guint) roundf (value * 100));
+    }
+
+    bool
+    sample (gfloat *frame) override
+    {
+        /* The loads go straight into the frame */
+        last_used = cpus.previous_used;
+        last_total = cpus.previous_total;
+        return read_cpu_data (cpus, frame);
+    }
+
+    bool
+    sample_ticks (guint32 *ticks) const override
+    {
+        std::copy (cpus.ticks.begin(), cpus.ticks.end(), ticks);
+        return true;
+    }
+
+    bool
+    sample_deltas (guint64 *used, guint64 *total) const override
+    {
+        const guint num_rows = cpus.size();
+        if (last_used.size() != num_rows)
+            return false;
+
+        /* As compute_loads() does, a counter going back is no sample */
+        for (guint row = 0; row < num_rows; row++)
+        {
+            const bool valid = cpus.used[row] >= last_used[row] && cpus.total[row] > last_total[row];
+            total[row] = valid ? cpus.total[row] - last_total[row] : 0;
+            used[row] = valid ? MIN (cpus.used[row] - last_used[row], total[row]) : 0;
+        }
+
+        /* Where row 0 is not read, compute_cpu_loads() sums the CPUs into it */
+        if (total[0] == 0 && cpus.ticks[0] != 0)
+            for (guint row = 1; row < num_rows; row++)
+            {
+                used[0] += used[row];
+                total[0] += total[row];
+            }
+        return true;
+    }
+};
+
+static Ptr0<DataSource>
+create_cpu_usage_source (const std::string &options)
+{
+    auto source = xfce4::make<CpuUsageSource>();
+    if (!init_cpu_rows (source->cpus))
+        return nullptr;
+
+    /* Read CPU data once in order to initialize
+     * cpus.previous_used[] and cpus.previous_total[]
+     * with the current HWMs. HWM = High Water Mark.
+     * The loads since boot are thrown away. */
+    std::vector<gfloat> load (source->cpus.size());
+    read_cpu_data (source->cpus, load.data());
+
+    return source;
+}
+
+
+
+/*
+ * Emulated machine for testing the plugin's scaling without the hardware.
+ * Configured by the source options or the environment variable
+ * CPUWATERFALL_SYNTHETIC, for example "cpus=4096,smt=2,pattern=mixed,seed=1".
+ * The patterns are:
+ *   square  - square waves, the period depends on the CPU
+ *   walk    - random walks
+ *   hotspot - mostly idle, a few cores at full load which move every few seconds
+ *   mixed   - each CPU gets one of the above
+ */
+enum SyntheticPattern
+{
+    PATTERN_SQUARE,
+    PATTERN_WALK,
+    PATTERN_HOTSPOT,
+    PATTERN_MIXED,
+};
+
+#define SYNTHETIC_DEFAULT_CPUS 64
+#define SYNTHETIC_MAX_CPUS (64*1024)
+#define SYNTHETIC_HOTSPOT_TICKS 25
+
+struct SyntheticSource : DataSource
+{
+    guint num_cpus;
+    guint smt;                  /* Threads per core */
+    SyntheticPattern pattern;
+    guint32 rand_state;
+    guint64 tick;
+    std::vector<gfloat> walk;   /* Indexed by CPU */
+    std::vector<bool> hot;      /* Indexed by core */
+    Ptr0<Topology> fake_topology;
+
+    guint num_rows () const override { return num_cpus + 1; }
+    gint row_cpu (guint row) const override { return (gint) row - 1; }
+    Ptr0<Topology> topology () const override { return fake_topology; }
+
+    std::string
+    row_name (guint row) const override
+    {
+        return row == 0 ? _("Usage") : xfce4::sprintf (_("CPU %u"), row - 1);
+    }
+
+    std::string
+    format_value (gfloat value) const override
+    {
+        return xfce4::sprintf ("%u%%", (guint) roundf (value * 100));
+    }
+
+    /* xorshift32, random enough and cheap at thousands of rows per tick */
+    gfloat
+    random ()
+    {
+        rand_state ^= rand_state << 13;
+        rand_state ^= rand_state >> 17;
+        rand_state ^= rand_state << 5;
+        return (rand_state >> 8) * (1.0f / (1 << 24));
+    }
+
+    SyntheticPattern
+    pattern_of (guint cpu) const
+    {
+        return pattern == PATTERN_MIXED ? (SyntheticPattern) (cpu / smt % 3) : pattern;
+    }
+
+    bool
+    sample (gfloat *frame) override
+    {
+        const guint num_cores = hot.size();
+        if (tick % SYNTHETIC_HOTSPOT_TICKS == 0)
+        {
+            /* About one core in 16 is hot */
+            for (guint core = 0; core < num_cores; core++)
+                hot[core] = random () < 1.0f / 16;
+        }
+
+        gfloat sum = 0;
+        for (guint cpu = 0; cpu < num_cpus; cpu++)
+        {
+            gfloat load;
+            switch (pattern_of (cpu))
+            {
+                case PATTERN_SQUARE:
+                {
+                    const guint period = 8 + cpu % 57;
+                    load = (tick + cpu) % period < period / 2 ? 0.9f : 0.1f;
+                    break;
+                }
+                case PATTERN_WALK:
+                    walk[cpu] = CLAMP (walk[cpu] + 0.2f * (random () - 0.5f), 0.0f, 1.0f);
+                    load = walk[cpu];
+                    break;
+                case PATTERN_HOTSPOT:
+                default:
+                    load = hot[cpu / smt] ? 1.0f : 0.05f * random ();
+                    break;
+            }
+            frame[cpu + 1] = load;
+            sum += load;
+        }
+        frame[0] = sum / num_cpus;
+
+        tick++;
+        return true;
+    }
+};
+
+static Ptr0<Topology>
+create_synthetic_topology (guint num_cpus, guint smt)
+{
+    auto t = xfce4::make<Topology>();
+    const guint num_cores = (num_cpus + smt - 1) / smt;
+
+    t->num_logical_cpus = t->num_online_logical_cpus = num_cpus;
+    t->num_cores = t->num_online_cores = num_cores;
+    t->logical_cpu_2_core.resize (num_cpus);
+    t->logical_cpu_2_package.resize (num_cpus);
+    for (guint cpu = 0; cpu < num_cpus; cpu++)
+    {
+        /* 64 cores per package */
+        const guint core = cpu / smt;
+        t->logical_cpu_2_core[cpu] = core;
+        t->logical_cpu_2_package[cpu] = core / 64;
+        t->cores[core].logical_cpus.push_back (cpu);
+    }
+    t->smt = smt > 1;
+    t->smt_ratio = (gdouble) num_cpus / num_cores;
+    return t;
+}
+
+static Ptr0<DataSource>
+create_synthetic_source (const std::string &options)
+{
+    auto source = xfce4::make<SyntheticSource>();
+    source->num_cpus = SYNTHETIC_DEFAULT_CPUS;
+    source->smt = 2;
+    source->pattern = PATTERN_MIXED;
+    source->rand_state = 1;
+
+    const gchar *config = options.empty() ? g_getenv ("CPUWATERFALL_SYNTHETIC") : options.c_str();
+    if (config)
+    {
+        gchar **options = g_strsplit (config, ",", -1);
+        for (gchar **opt = options; *opt; opt++)
+        {
+            const std::string option = *opt;
+            const std::string::size_type eq = option.find ('=');
+            if (eq == std::string::npos)
+                continue;
+            const std::string key = xfce4::trim (option.substr (0, eq));
+            const std::string value = xfce4::trim (option.substr (eq + 1));
+
+            if (key == "cpus")
+                source->num_cpus = CLAMP (g_ascii_strtoull (value.c_str(), NULL, 10), 1, SYNTHETIC_MAX_CPUS);
+            else if (key == "smt")
+                source->smt = CLAMP (g_ascii_strtoull (value.c_str(), NULL, 10), 1, 8);
+            else if (key == "seed")
+                source->rand_state = MAX (g_ascii_strtoull (value.c_str(), NULL, 10), 1);
+            else if (key == "pattern")
+            {
+                if (value == "square")
+                    source->pattern = PATTERN_SQUARE;
+                else if (value == "walk")
+                    source->pattern = PATTERN_WALK;
+                else if (value == "hotspot")
+                    source->pattern = PATTERN_HOTSPOT;
+                else
+                    source->pattern = PATTERN_MIXED;
+            }
+            else
+                g_warning ("synthetic source: unknown option '%s'", key.c_str());
+        }
+        g_strfreev (options);
+    }
+
+    source->walk.assign (source->num_cpus, 0.5f);
+    source->hot.assign ((source->num_cpus + source->smt - 1) / source->smt, false);
+    source->fake_topology = create_synthetic_topology (source->num_cpus, source->smt);
+
+    g_info ("synthetic source: %u CPUs, %u threads per core", source->num_cpus, source->smt);
+    return source;
+}
+
+
+
+/* For testing: cpuwaterfall-bench opens it by its ID, the properties
+ * dialog only lists it if CPUWATERFALL_SYNTHETIC is set */
+static const DataSourceType synthetic_source_type = {
+    "synthetic", N_("Synthetic load (testing)"), create_synthetic_source
+};
+
+const std::vector<DataSourceType>&
+data_source_types ()
+{
+    static const std::vector<DataSourceType> types = [] {
+        std::vector<DataSourceType> list = {
+            {"cpu", N_("CPU usage"), create_cpu_usage_source},
+            {"remote", N_("Remote hosts"), create_remote_source},
+            {"helper", N_("CPU usage (separate process)"), create_helper_source},
+            {"replay", N_("Replay recording"), create_replay_source},
+        };
+        if (g_getenv ("CPUWATERFALL_SYNTHETIC"))
+            list.push_back (synthetic_source_type);
+        return list;
+    }();
+    return types;
+}
+
+Ptr0<DataSource>
+create_data_source (const std::string &id, const std::string &options)
+{
+    if (id == synthetic_source_type.id)
+        return synthetic_source_type.create (options);
+    for (const DataSourceType &type : data_source_types ())
+        if (id == type.id)
+            return type.create (options);
+    return nullptr;
+}
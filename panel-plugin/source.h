@@ -0,0 +1,136 @@
+/*  source.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_SOURCE_H_
+#define _XFCE_CPUWATERFALL_SOURCE_H_
+
+#include <glib.h>
+#include <string>
+#include <vector>
+#include "xfce4++/util.h"
+#include "loads.h"
+
+#define VALUE_TICKS 10000       /* Below 2^TICKS_BITS, so stored exactly */
+
+using xfce4::Ptr0;
+
+struct Topology;
+
+/*
+ * A source of samples drawn as one strip per row.
+ *
+ * Row 0 is the aggregate of the other rows and is drawn as the average bar.
+ * The plugin allocates a frame of num_rows() values and passes it to
+ * sample() on every tick. The frame is then written to the history as
+ * tick deltas, see sample_ticks().
+ * A source can change its rows only in update_layout().
+ */
+struct DataSource
+{
+    struct Timing
+    {
+        guint64 num_samples;
+        gint64 total_us;        /* Time spent in sample() */
+        gint64 max_us;
+        gint64 last_us;
+
+        gdouble mean_us () const { return num_samples ? (gdouble) total_us / num_samples : 0; }
+    };
+
+    virtual ~DataSource() {}
+
+    /* Number of rows including the aggregate row */
+    virtual guint num_rows () const = 0;
+    virtual std::string row_name (guint row) const = 0;
+
+    /* Rows can be grouped in bands, for example one band per host.
+     * A separator is drawn after the last row of a band. */
+    virtual bool row_ends_band (guint row) const { return false; }
+
+    /* Called before each sample(). Returns true if the rows changed,
+     * in which case the plugin reallocates the frame and the history. */
+    virtual bool update_layout () { return false; }
+
+    /* Logical CPU shown in a row, or -1. Per-CPU overlays (isolated CPUs,
+     * temperatures, tasks) are only drawn for rows which map to a CPU. */
+    virtual gint row_cpu (guint row) const { return -1; }
+
+    /* Topology of the CPUs returned by row_cpu(), or nullptr */
+    virtual Ptr0<Topology> topology () const { return nullptr; }
+
+    /* The topology is read from this machine, whose sensors can be mapped to the rows */
+    virtual bool local_topology () const { return false; }
+
+    /* Range of the sample values. The renderer maps it to the colour gradient. */
+    virtual gfloat min_value () const { return 0; }
+    virtual gfloat max_value () const { return 1; }
+    virtual std::string format_value (gfloat value) const;
+
+    /* Fills frame[0] to frame[num_rows()-1]. Returns false if no sample is available. */
+    virtual bool sample (gfloat *frame) = 0;
+
+    /* The interval between the calls of sample(), for sources which sample in the background */
+    virtual void set_interval (guint interval_ms) {}
+
+    /* Sources which count time, like CPU usage, fill the used and total
+     * tick deltas of the latest sample (see encode_ticks()) so that the
+     * history can be aggregated exactly. The other sources return false
+     * and the history gets their normalized values as a fraction of
+     * VALUE_TICKS, see value_ticks(). */
+    virtual bool sample_ticks (guint32 *ticks) const { return false; }
+
+    /* The exact used and total deltas behind sample_ticks(), which keeps
+     * 14 significant bits of each. Sources without them return false. */
+    virtual bool sample_deltas (guint64 *used, guint64 *total) const { return false; }
+
+    /* Calls sample() and accounts the time spent in it */
+    bool timed_sample (gfloat *frame);
+    const Timing& timing () const { return timing_; }
+
+    /* Maps a sample value to the range from 0.0 to 1.0 and back */
+    gfloat normalize (gfloat value) const;
+    gfloat denormalize (gfloat ratio) const { return min_value () + ratio * (max_value () - min_value ()); }
+
+    /* A sample value as tick deltas, no sample if it is NaN */
+    guint32 value_ticks (gfloat value) const;
+
+private:
+    Timing timing_ = {};
+};
+
+struct DataSourceType
+{
+    const char *id;         /* Stored in the settings */
+    const char *label;      /* Untranslated, shown in the properties dialog */
+    Ptr0<DataSource> (*create) (const std::string &options);
+};
+
+/* The sources of the properties dialog, the first entry is the default source.
+ * create_data_source() also opens the synthetic source, see source.cc. */
+const std::vector<DataSourceType>& data_source_types ();
+Ptr0<DataSource> create_data_source (const std::string &id, const std::string &options);
+
+/* Hosts running cpuwaterfall-collector, see remote.cc */
+Ptr0<DataSource> create_remote_source (const std::string &options);
+
+/* CPU usage read by cpuwaterfall-sampler, see helper.cc */
+Ptr0<DataSource> create_helper_source (const std::string &options);
+
+/* Recordings of the flight recorder played back, see recorder.cc */
+Ptr0<DataSource> create_replay_source (const std::string &options);
+
+#endif /* _XFCE_CPUWATERFALL_SOURCE_H_ */
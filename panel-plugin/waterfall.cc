@@ -31,9 +31,19 @@
 #include "plugin.h"
 #include "properties.h"
 #include <libxfce4ui/libxfce4ui.h>
+#include <glib/gstdio.h>
+#include <algorithm>
+#include <errno.h>
 #include <math.h>
+#include <unistd.h>
 #include "xfce4++/util.h"
 
+/* Minimum time between two scans of the running tasks, while the pointer hovers the plugin */
+#define TASK_SCAN_INTERVAL_MS 1000
+
+/* Number of tasks listed in the tooltip of a core */
+#define TOOLTIP_NUM_TASKS 5
+
 
 
 using xfce4::PluginSize;
@@ -44,13 +54,16 @@ using xfce4::TooltipTime;
 
 /* vim: !sort -k3 */
 static void          about_cb       ();
+static void          apply_governor (const Ptr<CPUWaterfall> &base);
 static Propagation   command_cb     (GdkEventButton *event, const Ptr<CPUWaterfall> &base);
 static Ptr<CPUWaterfall> create_gui   (XfcePanelPlugin *plugin);
 static Propagation   draw_area_cb   (cairo_t *cr, const Ptr<CPUWaterfall> &base);
 static void          mode_cb        (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base);
+static void          rebuild_batch  (const Ptr<CPUWaterfall> &base);
+static void          remap_thermal  (const Ptr<CPUWaterfall> &base);
 static void          shutdown       (const Ptr<CPUWaterfall> &base);
 static PluginSize    size_cb        (XfcePanelPlugin *plugin, guint size, const Ptr<CPUWaterfall> &base);
-static TooltipTime   tooltip_cb     (GtkTooltip *tooltip, const Ptr<CPUWaterfall> &base);
+static TooltipTime   tooltip_cb     (GtkWidget *widget, gint x, gint y, GtkTooltip *tooltip, const Ptr<CPUWaterfall> &base);
 static void          update_tooltip (const Ptr<CPUWaterfall> &base);
 
 
@@ -73,17 +86,8 @@ cpuwaterfall_construct (XfcePanelPlugin *plugin)
     xfce4::connect_configure_plugin(plugin, [base](XfcePanelPlugin *p) { create_options(p, base); });
     xfce4::connect_mode_changed    (plugin, [base](XfcePanelPlugin *p, XfcePanelPluginMode mode) { mode_cb(p, base); });
     xfce4::connect_size_changed    (plugin, [base](XfcePanelPlugin *p, guint size) { return size_cb(p, size, base); });
-}
 
-
-
-static guint
-init_cpu_data (std::vector<CpuData> &data)
-{
-    guint cpuNr = detect_cpu_number ();
-    if (cpuNr != 0)
-        data.resize(cpuNr+1);
-    return cpuNr;
+    g_info ("startup: widgets created in %.1f ms", (g_get_monotonic_time () - base->startup_time) / 1e3);
 }
 
 
@@ -95,19 +99,18 @@ create_gui (XfcePanelPlugin *plugin)
     GtkOrientation orientation;
     auto base = xfce4::make<CPUWaterfall>();
 
+    base->startup_time = g_get_monotonic_time ();
     orientation = xfce_panel_plugin_get_orientation (plugin);
-    if ((base->nr_cores = init_cpu_data (base->cpu_data)) == 0)
-        fprintf (stderr,"Cannot init cpu data !\n");
 
-    /* Read CPU data twice in order to initialize
-     * cpu_data[].previous_used and cpu_data[].previous_total
-     * with the current HWMs. HWM = High Water Mark. */
-    read_cpu_data (base->cpu_data);
-    read_cpu_data (base->cpu_data);
+    /* The source is opened in the background by read_settings(), see set_source() */
 
-    base->topology = read_topology ();
+    /* Marks the isolated and nohz_full CPUs. The threads and helpers of the
+     * plugin keep off them, see pin_thread_to_housekeeping_cpus(). */
+    read_cpu_flags ("/sys", base->cpu_flags);
 
     base->plugin = plugin;
+    base->tooltip_strip.kind = STRIP_NONE;
+    init_governor (base->governor);
 
     base->ebox = ebox = gtk_event_box_new ();
     gtk_event_box_set_visible_window (GTK_EVENT_BOX (ebox), FALSE);
@@ -117,12 +120,25 @@ create_gui (XfcePanelPlugin *plugin)
     xfce4::connect_button_press (ebox, [base](GtkWidget*, GdkEventButton *event) -> Propagation {
         return command_cb (event, base);
     });
+    xfce4::connect_enter_notify (ebox, [base](GtkWidget*, GdkEventCrossing*) -> Propagation {
+        /* The tooltip text is only kept up to date while the pointer hovers the plugin */
+        base->pointer_inside = true;
+        update_tooltip (base);
+        return xfce4::PROPAGATE;
+    });
+    xfce4::connect_leave_notify (ebox, [base](GtkWidget*, GdkEventCrossing*) -> Propagation {
+        /* The task index is only maintained while the pointer hovers the plugin */
+        base->pointer_inside = false;
+        base->tooltip_strip.kind = STRIP_NONE;
+        base->tasks = TaskIndex();
+        return xfce4::PROPAGATE;
+    });
 
     base->box = gtk_box_new (orientation, 0);
     gtk_container_add (GTK_CONTAINER (ebox), base->box);
     gtk_widget_set_has_tooltip (base->box, TRUE);
     xfce4::connect_query_tooltip (base->box, [base](GtkWidget *widget, gint x, gint y, bool keyboard, GtkTooltip *tooltip) {
-        return tooltip_cb (tooltip, base);
+        return tooltip_cb (widget, x, y, tooltip, base);
     });
 
     base->frame_widget = frame = gtk_frame_new (NULL);
@@ -181,11 +197,31 @@ ebox_revalidate (const Ptr<CPUWaterfall> &base)
 
 
 
+static void
+log_source_timing (const std::string &id, const Ptr0<DataSource> &source)
+{
+    if (source)
+    {
+        const DataSource::Timing &t = source->timing();
+        g_info ("source '%s': %" G_GUINT64_FORMAT " samples, %.1f us mean, %" G_GINT64_FORMAT " us max",
+                id.c_str(), t.num_samples, t.mean_us(), t.max_us);
+    }
+}
+
+
+
 CPUWaterfall::~CPUWaterfall()
 {
     g_info ("%s", __PRETTY_FUNCTION__);
-    for (auto hist_data : history.data)
-        g_free (hist_data);
+    log_source_timing (opened_id, source);
+    if (batch.stats.batches != 0)
+    {
+        const BatchReader::Stats &s = batch.stats;
+        g_info ("%s reads: %" G_GUINT64_FORMAT " batches, %" G_GUINT64_FORMAT " files, %" G_GUINT64_FORMAT " syscalls, "
+                "%.1f us mean, %" G_GINT64_FORMAT " us max",
+                batch.uses_io_uring() ? "io_uring" : "pread", s.batches, s.reads, s.syscalls,
+                s.total_us / (gdouble) s.batches, s.max_us);
+    }
 }
 
 
@@ -197,11 +233,16 @@ shutdown (const Ptr<CPUWaterfall> &base)
     base->ebox = NULL;
     g_object_unref (base->tooltip_text);
     base->tooltip_text = NULL;
-    if (base->timeout_id)
-    {
-        g_source_remove (base->timeout_id);
-        base->timeout_id = 0;
-    }
+    destroy_surf_and_patt (base);
+
+    /* The handlers of the subscriptions hold references to base */
+    base->subscription = nullptr;
+    base->opening = nullptr;
+
+    if (base->history_sync != 0)
+        sync_history (base->history);
+    close_recording (base->recorder);
+    close_ring (base->publisher);
 }
 
 
@@ -215,43 +256,37 @@ queue_draw (const Ptr<CPUWaterfall> &base)
 
 
 
-static void
+/*
+ * The history keeps about twice the width, one tick per column at the
+ * effective update interval, so that small changes of the width fit without
+ * a resize. The width is counted in ticks, so the capacity is the same at
+ * every rate and every slowdown of the governor. Only a change of the width
+ * resizes the ring, in place.
+ */
+void
 resize_history (const Ptr<CPUWaterfall> &base, gssize history_size)
 {
-    const guint fastest = get_update_interval_ms (RATE_100MS);
-    const guint slowest = get_update_interval_ms (RATE_2S);
-    const gssize old_cap_pow2 = base->history.cap_pow2;
+    History &history = base->history;
 
     gssize cap_pow2 = 1;
-    while (cap_pow2 < MAX_SIZE * slowest / fastest)
-        cap_pow2 <<= 1;
-    while (cap_pow2 < history_size * slowest / fastest)
+    while (cap_pow2 < 2 * MAX (history_size, (gssize) MIN_SIZE))
         cap_pow2 <<= 1;
 
-    if (cap_pow2 != old_cap_pow2)
+    if (cap_pow2 != history.cap_pow2)
     {
-        const std::vector<CpuLoad*> old_data = std::move(base->history.data);
-        const gssize old_mask = base->history.mask();
-        const gssize old_offset = base->history.offset;
-
-        base->history.cap_pow2 = cap_pow2;
-        base->history.data.resize(base->nr_cores + 1);
-        base->history.offset = 0;
-        for (guint core = 0; core < base->nr_cores + 1; core++)
+        const gint64 start = g_get_monotonic_time ();
+        if (history.empty() || history.num_rows != base->nr_cores + 1)
         {
-            base->history.data[core] = (CpuLoad*) g_malloc0 (cap_pow2 * sizeof (CpuLoad));
-            if (!old_data.empty())
-            {
-                for (gssize i = 0; i < old_cap_pow2 && i < cap_pow2; i++)
-                    base->history.data[core][i] = old_data[core][(old_offset + i) & old_mask];
-                g_free (old_data[core]);
-            }
+            if (reallocate_history (history, history.format, base->nr_cores + 1, cap_pow2))
+                base->repaint_history = true;
         }
-
-        xfce4::trim_memory ();
+        else
+            set_history_capacity (history, cap_pow2);
+        g_info ("history: %" G_GSSIZE_FORMAT " ticks, %.1f MiB, resized in %.2f ms", history.cap_pow2,
+                history_bytes (history) / 1048576.0, (g_get_monotonic_time () - start) / 1e3);
     }
 
-    base->history.size = history_size;
+    history.size = history_size;
 }
 
 
@@ -285,10 +320,7 @@ size_cb (XfcePanelPlugin *plugin, guint plugin_size, const Ptr<CPUWaterfall> &ba
     if (G_UNLIKELY (history < 0 || history > MAX_HISTORY_SIZE))
         history = MAX_HISTORY_SIZE;
 
-    if (history > base->history.cap_pow2)
-        resize_history (base, history);
-    else
-        base->history.size = history;
+    resize_history (base, history);
 
     gtk_widget_set_size_request (GTK_WIDGET (base->frame_widget), frame_h, frame_v);
 
@@ -316,31 +348,291 @@ mode_cb (XfcePanelPlugin *plugin, const Ptr<CPUWaterfall> &base)
 
 
 
-static xfce4::TimeoutResponse
-update_cb (const Ptr<CPUWaterfall> &base)
+/* Identifies the rows in the history file: FNV-1a of the source settings and of the CPU of every row */
+static guint64
+history_layout_id (const Ptr<CPUWaterfall> &base)
+{
+    guint64 hash = 14695981039346656037ull;
+    const auto add = [&hash](const void *data, gsize size) {
+        for (gsize i = 0; i < size; i++)
+            hash = (hash ^ ((const guint8*) data)[i]) * 1099511628211ull;
+    };
+
+    add (base->source_id.c_str(), base->source_id.size() + 1);
+    add (base->source_options.c_str(), base->source_options.size() + 1);
+    for (guint row = 0; row <= base->nr_cores; row++)
+    {
+        const gint cpu = base->source->row_cpu (row);
+        add (&cpu, sizeof (cpu));
+    }
+    return hash ? hash : 1;
+}
+
+/* Starts a recording file for the rows of the source. A replay is not recorded again. */
+static void
+restart_recording (const Ptr<CPUWaterfall> &base)
+{
+    if (base->source && base->opened_id != "replay")
+        start_recording (base->recorder, base->opened_id, *base->source);
+    else
+        close_recording (base->recorder);
+}
+
+/* Sizes the frame and the history for the rows of the source */
+static void
+reset_rows (const Ptr<CPUWaterfall> &base)
+{
+    const DataSource &source = *base->source;
+
+    base->nr_cores = source.num_rows() - 1;
+    base->frame.assign (base->nr_cores + 1, source.min_value());
+    base->frame_ticks.assign (base->nr_cores + 1, 0);
+    base->nr_band_separators = 0;
+    for (guint row = 1; row < base->nr_cores; row++)
+        if (source.row_ends_band (row))
+            base->nr_band_separators++;
+
+    /* The old rows mean nothing to the new layout, unless the file of the previous run has the same one */
+    clear_history (base->history);
+    base->history.layout_id = history_layout_id (base);
+    resize_history (base, base->history.size);
+    restart_recording (base);
+    publish_ring (base->publisher, source);
+
+    base->tooltip_strip.kind = STRIP_NONE;
+    queue_draw (base);
+}
+
+
+
+void
+record_frame (const Ptr<CPUWaterfall> &base, const gfloat *frame, const guint32 *ticks,
+              const guint64 *used, const guint64 *total)
+{
+    if (frame != base->frame.data())
+        std::copy (frame, frame + base->nr_cores + 1, base->frame.begin());
+    if (ticks != base->frame_ticks.data())
+        std::copy (ticks, ticks + base->nr_cores + 1, base->frame_ticks.begin());
+
+    const gint64 timestamp = g_get_real_time ();
+    if (!base->history.empty())
+    {
+        /* Prepend the current sample to the history */
+        record_history (base->history, timestamp, base->frame_ticks.data(), used, total);
+    }
+    record_ticks (base->recorder, timestamp, base->frame_ticks.data(), used, total);
+    publish_frame (base->publisher, timestamp, base->frame_ticks.data());
+}
+
+bool
+record_sample (const Ptr<CPUWaterfall> &base)
 {
-    if (!read_cpu_data (base->cpu_data))
-        return xfce4::TIMEOUT_AGAIN;
+    if (!base->source)
+        return false;
 
-    if (!base->history.data.empty())
+    if (base->source->update_layout ())
     {
-        const gint64 timestamp = g_get_real_time ();
+        reset_rows (base);
+        remap_thermal (base);
+    }
+
+    const DataSource &source = *base->source;
+    if (!base->source->timed_sample (base->frame.data()))
+        return false;
 
-        /* Prepend the current CPU load to the history */
-        base->history.offset = (base->history.offset - 1) & base->history.mask();
+    if (!source.sample_ticks (base->frame_ticks.data()))
         for (guint core = 0; core < base->nr_cores + 1; core++)
+            base->frame_ticks[core] = source.value_ticks (base->frame[core]);
+
+    const guint num_rows = base->nr_cores + 1;
+    base->frame_used.resize (num_rows);
+    base->frame_total.resize (num_rows);
+    if (source.sample_deltas (base->frame_used.data(), base->frame_total.data()))
+        record_frame (base, base->frame.data(), base->frame_ticks.data(), base->frame_used.data(), base->frame_total.data());
+    else
+        record_frame (base, base->frame.data(), base->frame_ticks.data(), nullptr, nullptr);
+    return true;
+}
+
+
+
+gfloat
+history_ratio (const Ptr<CPUWaterfall> &base, guint row, gssize samples)
+{
+    const History &history = base->history;
+    if (row >= history.num_rows || history.empty())
+        return NAN;
+
+    guint64 used = 0, total = 0;
+    for (gssize age = 0; age < MIN (samples, history.cap_pow2); age++)
+    {
+        if (history.timestamp (age) == 0)
+            break;
+        guint64 row_used, row_total;
+        history.row_ticks (history.frame (age), row, row_used, row_total);
+        used += row_used;
+        total += row_total;
+    }
+    return total ? (gfloat) used / total : NAN;
+}
+
+
+
+/* The interval of the update rate, slowed down if over the CPU budget */
+static guint
+update_interval_ms (const Ptr<CPUWaterfall> &base)
+{
+    return get_update_interval_ms (base->update_interval) << governor_slowdown (base->governor);
+}
+
+
+
+static void
+update_cb (const Ptr<CPUWaterfall> &base, const gfloat *frame, const guint32 *ticks,
+           const guint64 *used, const guint64 *total, bool new_layout)
+{
+    const gint64 cpu_start = thread_cpu_time ();
+
+    if (new_layout)
+    {
+        reset_rows (base);
+        remap_thermal (base);
+    }
+    record_frame (base, frame, ticks, used, total);
+
+    if (G_UNLIKELY (base->startup_time != 0))
+    {
+        g_info ("startup: first sample after %.1f ms", (g_get_monotonic_time () - base->startup_time) / 1e3);
+        base->startup_time = 0;
+    }
+
+    /* Energy counters and temperatures are fetched together */
+    if (!base->batch.empty())
+        base->batch.read_all ();
+
+    if (base->has_power && base->power)
+        read_power_data (*base->power, base->batch);
+
+    if (base->thermal)
+    {
+        /* Core IDs may change when CPUs go on- or offline */
+        if (cpu_hotplug_detected (*base->thermal, base->batch))
+        {
+            g_info ("CPU hotplug detected, rebuilding temperature sensor mapping");
+            remap_thermal (base);
+        }
+        else
+            read_thermal_data (*base->thermal, base->batch);
+    }
+
+    if (base->history_sync != 0 && base->history.mapped)
+    {
+        const gint64 now = g_get_monotonic_time ();
+        if (now - base->history_synced >= base->history_sync * G_USEC_PER_SEC)
         {
-            CpuLoad load;
-            load.timestamp = timestamp;
-            load.value = base->cpu_data[core].load;
-            base->history.data[core][base->history.offset] = load;
+            sync_history (base->history);
+            base->history_synced = now;
         }
     }
 
+    /* Instances ticking within half a tick of each other share a read of schedstat */
+    if (base->run_delay)
+        read_run_delay_data (*base->run_delay, update_interval_ms (base) * (gint64) 500);
+
+    if (base->pointer_inside && base->governor.level < GOVERNOR_NO_OVERLAYS)
+    {
+        const gint64 now = g_get_monotonic_time ();
+        if (now - base->tasks.timestamp >= TASK_SCAN_INTERVAL_MS * (gint64) 1000)
+            read_task_data (base->tasks);
+    }
+
     queue_draw (base);
-    update_tooltip (base);
+    if (base->pointer_inside)
+        update_tooltip (base);
+
+    /* Sampling, this handler and the drawing count against the budget */
+    if (base->subscription)
+    {
+        base->governor.cpu_time += base->subscription->cpu_time;
+        base->subscription->cpu_time = 0;
+    }
+    base->governor.cpu_time += thread_cpu_time () - cpu_start;
+    if (update_governor (base->governor, g_get_monotonic_time ()))
+        apply_governor (base);
+}
+
+
+
+/* Appends the mean and the maximum of a row over the last hour, from the minute tier */
+static void
+append_last_hour (const Ptr<CPUWaterfall> &base, guint row, std::string &text)
+{
+    const DataSource &source = *base->source;
+    const gint64 since = g_get_real_time () - 3600 * (gint64) G_USEC_PER_SEC;
+    guint8 min, mean, max;
+
+    if (history_tier_stats (base->history, NUM_HISTORY_TIERS - 1, row, since, min, mean, max))
+    {
+        text += "\n" + xfce4::sprintf (_("Last hour: %s mean, %s max"),
+                                       source.format_value (source.denormalize (mean / (gfloat) (HISTORY_GAP - 1))).c_str(),
+                                       source.format_value (source.denormalize (max / (gfloat) (HISTORY_GAP - 1))).c_str());
+    }
+}
+
+
+
+/* Appends the highest load of a row in the archive, and when it was */
+static void
+append_archive_peak (const Ptr<CPUWaterfall> &base, guint row, std::string &text)
+{
+    const HistoryArchive &archive = base->history.archive;
+    if (archive.retention == 0)
+        return;
+
+    const DataSource &source = *base->source;
+    guint8 level;
+    gint64 timestamp;
+    if (archive_peak (archive, row, g_get_real_time () - archive.retention, level, timestamp))
+    {
+        GDateTime *time = g_date_time_new_from_unix_local (timestamp / G_USEC_PER_SEC);
+        gchar *when = g_date_time_format (time, "%X");
+        text += "\n" + xfce4::sprintf (_("Peak of the last %u h: %s at %s"), base->archive_hours,
+                                       source.format_value (source.denormalize (level / (gfloat) (HISTORY_GAP - 1))).c_str(),
+                                       when);
+        g_free (when);
+        g_date_time_unref (time);
+    }
+}
+
+
+
+/* Appends the tasks which last ran on the CPU, ranked by their recent CPU usage */
+static void
+append_top_tasks (const Ptr<CPUWaterfall> &base, guint cpu, std::string &text)
+{
+    const TaskIndex &index = base->tasks;
+    if (cpu >= index.by_cpu.size() || index.interval <= 0)
+        return;
+
+    std::vector<std::pair<guint64, const TaskInfo*>> ranked;
+    for (gint tid : index.by_cpu[cpu])
+    {
+        const TaskInfo &task = index.tasks.at(tid);
+        if (task.delta != 0)
+            ranked.emplace_back(task.delta, &task);
+    }
 
-    return xfce4::TIMEOUT_AGAIN;
+    const size_t n = MIN (ranked.size(), (size_t) TOOLTIP_NUM_TASKS);
+    std::partial_sort (ranked.begin(), ranked.begin() + n, ranked.end(),
+        [](const std::pair<guint64, const TaskInfo*> &a, const std::pair<guint64, const TaskInfo*> &b) {
+            return a.first > b.first;
+        });
+
+    for (size_t i = 0; i < n; i++)
+    {
+        const TaskInfo *task = ranked[i].second;
+        text += xfce4::sprintf ("\n%3u%%  %s", (guint) roundf (task->load * 100), task->comm.c_str());
+    }
 }
 
 
@@ -348,7 +640,112 @@ update_cb (const Ptr<CPUWaterfall> &base)
 static void
 update_tooltip (const Ptr<CPUWaterfall> &base)
 {
-    auto tooltip = xfce4::sprintf (_("Usage: %u%%"), (guint) roundf (base->cpu_data[0].load * 100));
+    const WaterfallStrip &strip = base->tooltip_strip;
+    std::string tooltip;
+
+    if (!base->source)
+        return;
+
+    const DataSource &source = *base->source;
+
+    if (strip.kind == STRIP_CORE && strip.index <= base->nr_cores)
+    {
+        const guint row = strip.index;
+        tooltip = source.row_name (row) + ": " + source.format_value (base->frame[row]);
+
+        const gfloat ratio = history_ratio (base, row, base->history.size);
+        if (!isnan (ratio))
+            tooltip += xfce4::sprintf (_(", %s on average"), source.format_value (source.denormalize (ratio)).c_str());
+
+        const gint cpu = source.row_cpu (row);
+        if (cpu >= 0)
+        {
+            if ((guint) cpu < base->cpu_flags.size())
+            {
+                if (base->cpu_flags[cpu] & CPU_FLAG_ISOLATED)
+                    tooltip += _(" (isolated)");
+                if (base->cpu_flags[cpu] & CPU_FLAG_NOHZ_FULL)
+                    tooltip += _(" (nohz_full)");
+            }
+            if (base->thermal && (guint) cpu < base->thermal->celsius.size() && !isnan (base->thermal->celsius[cpu]))
+                tooltip += xfce4::sprintf (_("  %.0f °C"), base->thermal->celsius[cpu]);
+            if (base->run_delay && (guint) cpu < base->run_delay->ratio.size() && !isnan (base->run_delay->ratio[cpu]))
+                tooltip += xfce4::sprintf (_("  %.0f ms/s queued"), base->run_delay->ratio[cpu] * 1000);
+        }
+        append_last_hour (base, row, tooltip);
+        append_archive_peak (base, row, tooltip);
+        if (cpu >= 0)
+            append_top_tasks (base, cpu, tooltip);
+    }
+    else if (strip.kind == STRIP_POWER && base->power && strip.index < base->power->domains.size())
+    {
+        const PowerDomain &domain = base->power->domains[strip.index];
+        tooltip = xfce4::sprintf (_("%s: %.1f W (max %.1f W)"), domain.name.c_str(), domain.watts, domain.max_watts);
+    }
+    else
+    {
+        tooltip = source.row_name (0) + ": " + source.format_value (base->frame[0]);
+
+        const gfloat ratio = history_ratio (base, 0, base->history.size);
+        if (!isnan (ratio))
+            tooltip += xfce4::sprintf (_(", %s on average"), source.format_value (source.denormalize (ratio)).c_str());
+        append_last_hour (base, 0, tooltip);
+        append_archive_peak (base, 0, tooltip);
+
+        /* Flag any load on isolated and nohz_full CPUs */
+        std::vector<std::string> busy;
+        for (guint row = 1; row <= base->nr_cores; row++)
+        {
+            const gint cpu = source.row_cpu (row);
+            if (cpu >= 0 && (guint) cpu < base->cpu_flags.size() && base->cpu_flags[cpu] &&
+                base->frame[row] > source.min_value())
+            {
+                busy.push_back (xfce4::sprintf ("%d", cpu));
+            }
+        }
+        if (!busy.empty())
+            tooltip += "\n" + xfce4::sprintf (_("Load on isolated CPUs: %s"), xfce4::join (busy, ", ").c_str());
+
+        if (base->has_power && base->power)
+            for (const PowerDomain &domain : base->power->domains)
+                tooltip += "\n" + xfce4::sprintf (_("%s: %.1f W"), domain.name.c_str(), domain.watts);
+
+        if (base->thermal)
+        {
+            gfloat hottest = NAN;
+            for (gfloat celsius : base->thermal->celsius)
+                if (!isnan (celsius) && !(celsius <= hottest))
+                    hottest = celsius;
+            if (!isnan (hottest))
+                tooltip += "\n" + xfce4::sprintf (_("Hottest core: %.0f °C"), hottest);
+        }
+
+        if (base->run_delay)
+        {
+            gint longest = -1;
+            const std::vector<gfloat> &ratio = base->run_delay->ratio;
+            for (guint cpu = 0; cpu < ratio.size(); cpu++)
+                if (!isnan (ratio[cpu]) && (longest < 0 || ratio[cpu] > ratio[longest]))
+                    longest = cpu;
+            if (longest >= 0)
+                tooltip += "\n" + xfce4::sprintf (_("Longest run queue: CPU %d, %.0f ms/s queued"),
+                                                   longest, ratio[longest] * 1000);
+        }
+
+        const CpuGovernor &governor = base->governor;
+        if (governor.budget != 0 && !isnan (governor.usage))
+        {
+            static const gchar *const states[] = {
+                [GOVERNOR_FULL]         = N_("full"),
+                [GOVERNOR_NO_OVERLAYS]  = N_("overlays off"),
+                [GOVERNOR_HALF_RATE]    = N_("overlays off, half rate"),
+                [GOVERNOR_QUARTER_RATE] = N_("overlays off, quarter rate"),
+            };
+            tooltip += "\n" + xfce4::sprintf (_("Plugin CPU use: %.2f%% of %.2f%% (%s)"),
+                                               governor.usage * 100, governor.budget / 100.0, _(states[governor.level]));
+        }
+    }
+
     if (gtk_label_get_text (GTK_LABEL (base->tooltip_text)) != tooltip)
         gtk_label_set_text (GTK_LABEL (base->tooltip_text), tooltip.c_str());
 }
@@ -356,8 +753,23 @@ update_tooltip (const Ptr<CPUWaterfall> &base)
 
 
 static TooltipTime
-tooltip_cb (GtkTooltip *tooltip, const Ptr<CPUWaterfall> &base)
+tooltip_cb (GtkWidget *widget, gint x, gint y, GtkTooltip *tooltip, const Ptr<CPUWaterfall> &base)
 {
+    WaterfallStrip strip = {STRIP_NONE, 0};
+    gint draw_x, draw_y;
+
+    if (base->mode != MODE_DISABLED &&
+        gtk_widget_translate_coordinates (widget, base->draw_area, x, y, &draw_x, &draw_y))
+    {
+        strip = waterfall_strip_at (base, gtk_widget_get_allocated_height (base->draw_area), draw_y);
+    }
+
+    if (base->tooltip_strip != strip)
+    {
+        base->tooltip_strip = strip;
+        update_tooltip (base);
+    }
+
     gtk_tooltip_set_custom (tooltip, base->tooltip_text);
     return xfce4::NOW;
 }
@@ -380,12 +792,15 @@ draw_area_cb (cairo_t *cr, const Ptr<CPUWaterfall> &base)
         case MODE_DISABLED:
             break;
         case MODE_WATERFALL:
+        case MODE_TEMPERATURE:
+        case MODE_RUN_DELAY:
             draw = draw_waterfall;
             break;
     }
 
     if (draw)
     {
+        const gint64 cpu_start = thread_cpu_time ();
         if (!base->colors[BG_COLOR].isTransparent())
         {
             xfce4::cairo_set_source (cr, base->colors[BG_COLOR]);
@@ -393,6 +808,7 @@ draw_area_cb (cairo_t *cr, const Ptr<CPUWaterfall> &base)
             cairo_fill (cr);
         }
         draw (base, cr, w, h);
+        base->governor.cpu_time += thread_cpu_time () - cpu_start;
     }
     return xfce4::PROPAGATE;
 }
@@ -500,6 +916,18 @@ CPUWaterfall::set_command (const Ptr<CPUWaterfall> &base, const std::string &com
 
 
 
+void
+CPUWaterfall::set_archive_hours (const Ptr<CPUWaterfall> &base, guint hours)
+{
+    HistoryArchive &archive = base->history.archive;
+    base->archive_hours = MIN (hours, MAX_ARCHIVE_HOURS);
+    archive.retention = base->archive_hours * 3600 * (gint64) G_USEC_PER_SEC;
+    if (archive.retention == 0)
+        reset_archive (archive, archive.num_rows);
+}
+
+
+
 void
 CPUWaterfall::set_border (const Ptr<CPUWaterfall> &base, bool has_border)
 {
@@ -523,6 +951,119 @@ CPUWaterfall::set_average (const Ptr<CPUWaterfall> &base, bool has_average )
 }
 
 
+/* Collects the per-tick sysfs reads of the power and temperature overlays */
+static void
+rebuild_batch (const Ptr<CPUWaterfall> &base)
+{
+    base->batch.clear ();
+    if (base->power)
+        add_power_reads (*base->power, base->batch);
+    if (base->thermal)
+        add_thermal_reads (*base->thermal, base->batch);
+}
+
+
+/* Opens the counters only while the strips are shown.
+ * If none is readable, the plugin works as if the option were off. */
+static void
+update_power (const Ptr<CPUWaterfall> &base)
+{
+    const bool needed = base->has_power && base->governor.level < GOVERNOR_NO_OVERLAYS;
+    if (needed && !base->power)
+    {
+        base->power = read_power_domains ("/sys");
+        if (!base->power)
+            g_info ("no readable energy counters, power strips disabled");
+        rebuild_batch (base);
+    }
+    else if (!needed && base->power)
+    {
+        base->power = nullptr;
+        rebuild_batch (base);
+    }
+}
+
+
+void
+CPUWaterfall::set_power (const Ptr<CPUWaterfall> &base, bool has_power)
+{
+    if (base->has_power != has_power)
+    {
+        base->has_power = has_power;
+        update_power (base);
+        queue_draw (base);
+    }
+}
+
+
+/* Opens the temperature sensors only while the temperature mode or overlay is on,
+ * and only for sources whose topology is the one of this machine */
+static void
+update_thermal (const Ptr<CPUWaterfall> &base)
+{
+    const bool needed = base->mode == MODE_TEMPERATURE ||
+                        (base->has_temperature && base->governor.level < GOVERNOR_NO_OVERLAYS);
+    if (needed && !base->thermal && base->topology && base->source && base->source->local_topology ())
+    {
+        base->thermal = read_thermal_sensors ("/sys", *base->topology);
+        if (!base->thermal)
+            g_info ("no coretemp sensors found, temperatures disabled");
+        rebuild_batch (base);
+        if (base->thermal)
+        {
+            base->batch.read_all ();
+            read_thermal_data (*base->thermal, base->batch);
+        }
+    }
+    else if (!needed && base->thermal)
+    {
+        base->thermal = nullptr;
+        rebuild_batch (base);
+    }
+}
+
+/* After a CPU hotplug or a change of the rows, the core IDs may differ. Sensors
+ * which could not be mapped before are tried again. */
+static void
+remap_thermal (const Ptr<CPUWaterfall> &base)
+{
+    const bool had_thermal = base->thermal != nullptr;
+    base->topology = base->source->topology ();
+    base->thermal = nullptr;
+    update_thermal (base);
+    if (had_thermal && !base->thermal)
+        rebuild_batch (base);
+}
+
+
+/* Opens /proc/schedstat only while the run-queue latency mode is on */
+static void
+update_run_delay (const Ptr<CPUWaterfall> &base)
+{
+    const bool needed = base->mode == MODE_RUN_DELAY;
+    if (needed && !base->run_delay)
+    {
+        base->run_delay = open_run_delay ();
+        if (!base->run_delay)
+            g_info ("/proc/schedstat is not readable, run-queue latency disabled");
+    }
+    else if (!needed)
+        base->run_delay = nullptr;
+}
+
+
+void
+CPUWaterfall::set_temperature (const Ptr<CPUWaterfall> &base, bool has_temperature)
+{
+    if (base->has_temperature != has_temperature)
+    {
+        base->has_temperature = has_temperature;
+        update_thermal (base);
+        queue_draw (base);
+    }
+}
+
+
 void
 CPUWaterfall::set_frame (const Ptr<CPUWaterfall> &base, bool has_frame)
 {
@@ -537,28 +1078,184 @@ CPUWaterfall::set_frame (const Ptr<CPUWaterfall> &base, bool has_frame)
 
 
 
+static void
+update_subscription_interval (const Ptr<CPUWaterfall> &base)
+{
+    const guint interval = update_interval_ms (base);
+    if (base->subscription)
+        set_subscription_interval (base->subscription.toPtr(), interval);
+    if (base->opening)
+        set_subscription_interval (base->opening.toPtr(), interval);
+}
+
+
 void
 CPUWaterfall::set_update_rate (const Ptr<CPUWaterfall> &base, CPUWaterfallUpdateRate rate)
 {
-    bool change = (base->update_interval != rate);
-    bool init = (base->timeout_id == 0);
+    if (base->update_interval != rate)
+    {
+        base->update_interval = rate;
+        update_subscription_interval (base);
+        queue_draw (base);
+    }
+}
+
 
-    if (change || init)
+
+static void
+apply_governor (const Ptr<CPUWaterfall> &base)
+{
+    const CpuGovernor &governor = base->governor;
+    g_info ("CPU use %.2f%% of a %.2f%% budget, now at level %d",
+            governor.usage * 100, governor.budget / 100.0, governor.level);
+
+    update_subscription_interval (base);
+    update_power (base);
+    update_thermal (base);
+    if (governor.level >= GOVERNOR_NO_OVERLAYS)
+        base->tasks = TaskIndex();
+    queue_draw (base);
+}
+
+
+/* Hundredths of a percent of a CPU, 0 for no budget */
+void
+CPUWaterfall::set_cpu_budget (const Ptr<CPUWaterfall> &base, guint budget)
+{
+    if (base->governor.budget != budget)
     {
-        guint interval = get_update_interval_ms (rate);
+        base->governor.budget = budget;
+        if (budget == 0 && base->governor.level != GOVERNOR_FULL)
+        {
+            init_governor (base->governor);
+            apply_governor (base);
+        }
+    }
+}
 
-        base->update_interval = rate;
-        if (base->timeout_id)
-            g_source_remove (base->timeout_id);
-        base->timeout_id = xfce4::timeout_add (interval, [base]() { return update_cb(base); });
 
-        if (change && !init)
-            queue_draw (base);
+
+/* The file of the history, empty if it is not kept. The runtime directory is
+ * in memory and wiped at logout, the cache directory is where the writes to disk go. */
+static std::string
+history_file_path (const Ptr<CPUWaterfall> &base)
+{
+    if (!base->persist_history || !base->plugin)
+        return "";
+
+    const gchar *parent = base->history_sync != 0 ? g_get_user_cache_dir () : g_get_user_runtime_dir ();
+    gchar *dir = g_build_filename (parent, "xfce4", "cpuwaterfall", NULL);
+    std::string path;
+    if (g_mkdir_with_parents (dir, 0700) == 0)
+        path = xfce4::sprintf ("%s/history-%d.map", dir, xfce_panel_plugin_get_unique_id (base->plugin));
+    else
+        g_warning ("cannot create %s: %s", dir, g_strerror (errno));
+    g_free (dir);
+    return path;
+}
+
+/* Moves the history into its file, or back into memory */
+static void
+update_history_file (const Ptr<CPUWaterfall> &base)
+{
+    History &history = base->history;
+    const std::string path = history_file_path (base);
+    if (path == history.path)
+        return;
+
+    const std::string old_path = history.path;
+    history.path = path;
+    if (!history.empty())
+        reallocate_history (history, history.format, history.num_rows, history.cap_pow2);
+    if (!old_path.empty())
+        g_unlink (old_path.c_str());
+}
+
+
+
+/* The recorded ticks are dropped, they do not convert between the formats */
+void
+CPUWaterfall::set_history_format (const Ptr<CPUWaterfall> &base, HistoryFormat format)
+{
+    History &history = base->history;
+    if (history.format != format)
+    {
+        if (history.empty())
+            history.format = format;
+        else
+            reallocate_history (history, format, history.num_rows, history.cap_pow2);
+        g_info ("history: %s format", format == HISTORY_8BIT ? "8-bit" : format == HISTORY_16BIT ? "16-bit" : "tick");
+        queue_draw (base);
     }
 }
 
 
 
+void
+CPUWaterfall::set_history_sync (const Ptr<CPUWaterfall> &base, guint seconds)
+{
+    base->history_sync = MIN (seconds, MAX_HISTORY_SYNC);
+    update_history_file (base);
+}
+
+
+
+void
+CPUWaterfall::set_persist_history (const Ptr<CPUWaterfall> &base, bool persist)
+{
+    base->persist_history = persist;
+    update_history_file (base);
+}
+
+
+
+/* Directory of the recordings of the flight recorder, empty without a plugin */
+static std::string
+recording_dir (const Ptr<CPUWaterfall> &base)
+{
+    if (!base->plugin)
+        return "";
+
+    const std::string dir = xfce4::sprintf ("%s/xfce4/cpuwaterfall/recording-%d", g_get_user_cache_dir (),
+                                            xfce_panel_plugin_get_unique_id (base->plugin));
+    if (g_mkdir_with_parents (dir.c_str(), 0700) != 0)
+    {
+        g_warning ("cannot create %s: %s", dir.c_str(), g_strerror (errno));
+        return "";
+    }
+    return dir;
+}
+
+
+
+void
+CPUWaterfall::set_publish_samples (const Ptr<CPUWaterfall> &base, bool publish)
+{
+    base->publish_samples = publish;
+    RingPublisher &publisher = base->publisher;
+    if (publish && base->plugin)
+        publisher.name = xfce4::sprintf ("/cpuwaterfall-%u-%d", (guint) getuid (), xfce_panel_plugin_get_unique_id (base->plugin));
+    else
+        publisher.name.clear();
+
+    if (base->source)
+        publish_ring (publisher, *base->source);
+    else
+        close_ring (publisher);
+}
+
+
+
+void
+CPUWaterfall::set_recorder_size (const Ptr<CPUWaterfall> &base, guint mib)
+{
+    base->recorder_size = MIN (mib, MAX_RECORDER_SIZE);
+    set_recorder (base->recorder, base->recorder_size ? recording_dir (base) : "", base->recorder_size * (gsize) 1048576);
+    restart_recording (base);
+}
+
+
+
 void
 CPUWaterfall::set_size (const Ptr<CPUWaterfall> &base, guint size)
 {
@@ -578,6 +1275,8 @@ void
 CPUWaterfall::set_mode (const Ptr<CPUWaterfall> &base, CPUWaterfallMode mode)
 {
     base->mode = mode;
+    update_thermal (base);
+    update_run_delay (base);
     if (mode == MODE_DISABLED)
     {
         gtk_widget_hide (base->frame_widget);
@@ -591,6 +1290,58 @@ CPUWaterfall::set_mode (const Ptr<CPUWaterfall> &base, CPUWaterfallMode mode)
 
 
 
+void
+install_source (const Ptr<CPUWaterfall> &base, const Ptr0<DataSource> &source, const Ptr0<Topology> &topology)
+{
+    log_source_timing (base->opened_id, base->source);
+    base->opened_id = base->source_id;
+    base->opened_options = base->source_options;
+    base->source = source;
+    base->topology = topology;
+    base->thermal = nullptr;
+    rebuild_batch (base);
+    update_thermal (base);
+    reset_rows (base);
+}
+
+/*
+ * Opening a source reads the counter baseline and the CPU topology, which takes
+ * long on big machines. It is done in a thread, so that the panel does not wait
+ * for it. The previous source, if any, keeps being drawn in the meantime.
+ * Plugin instances with the same source settings share the source, see shared.h.
+ */
+void
+CPUWaterfall::set_source (const Ptr<CPUWaterfall> &base, const std::string &id, const std::string &options)
+{
+    if (base->source_id == id && base->source_options == options)
+        return;
+
+    base->source_id = id;
+    base->source_options = options;
+
+    /* Replacing a subscription which is still opening drops it */
+    base->opening = subscribe_source (id, options, update_interval_ms (base),
+        [base, id](const Ptr0<DataSource> &source, const Ptr0<Topology> &topology) {
+            if (!source)
+            {
+                g_warning ("cannot open data source '%s'", id.c_str());
+                base->source_id = base->opened_id;
+                base->source_options = base->opened_options;
+                base->opening = nullptr;
+                return;
+            }
+
+            base->subscription = base->opening;
+            base->opening = nullptr;
+            install_source (base, source, topology);
+        },
+        [base](const gfloat *frame, const guint32 *ticks, const guint64 *used, const guint64 *total, bool new_layout) {
+            update_cb (base, frame, ticks, used, total, new_layout);
+        });
+}
+
+
+
 void
 CPUWaterfall::set_color (const Ptr<CPUWaterfall> &base, CPUWaterfallColorNumber number, const xfce4::RGBA &color)
 {
@@ -33,7 +33,13 @@
 #include <vector>
 #include "xfce4++/util.h"
 
+#include "governor.h"
+#include "history.h"
 #include "os.h"
+#include "publisher.h"
+#include "recorder.h"
+#include "shared.h"
+#include "source.h"
 
 using xfce4::Ptr;
 using xfce4::Ptr0;
@@ -42,12 +48,18 @@ using xfce4::Ptr0;
 #define MAX_HISTORY_SIZE (100*1000)
 #define MAX_SIZE 128
 #define MIN_SIZE 10
+#define MAX_CPU_BUDGET 1000     /* Hundredths of a percent of a CPU */
+#define MAX_HISTORY_SYNC 3600   /* Seconds */
+#define MAX_ARCHIVE_HOURS 48
+#define MAX_RECORDER_SIZE 4096  /* MiB */
 
 
 enum CPUWaterfallMode
 {
     MODE_DISABLED = 0,
     MODE_WATERFALL  = 1,
+    MODE_TEMPERATURE = 2,
+    MODE_RUN_DELAY = 3,     /* Run-queue latency from /proc/schedstat */
 };
 
 
@@ -66,15 +78,30 @@ enum CPUWaterfallColorNumber
     BG_COLOR   = 0,
     FG_COLOR1  = 1,
     FG_COLOR2  = 2,
-    NUM_COLORS = 3,
+    ISOLATED_COLOR = 3,
+    NUM_COLORS = 4,
 };
 
+/* Colors from BG_COLOR to FG_COLOR2 form the load gradient */
+#define NUM_GRADIENT_COLORS (FG_COLOR2 + 1)
 
-struct CpuLoad
+
+enum WaterfallStripKind
 {
-    gint64 timestamp; /* Microseconds since 1970-01-01 UTC, or zero */
-    gfloat value;     /* Range: from 0.0 to 1.0 */
-} __attribute__((packed));
+    STRIP_NONE,
+    STRIP_AVERAGE,
+    STRIP_POWER,    /* index: PowerMeter::domains[index] */
+    STRIP_CORE,     /* index: DataSource row, from 1 to nr_cores */
+};
+
+struct WaterfallStrip
+{
+    WaterfallStripKind kind;
+    guint index;
+
+    bool operator==(const WaterfallStrip &s) const { return kind == s.kind && index == s.index; }
+    bool operator!=(const WaterfallStrip &s) const { return !(*this == s); }
+};
 
 
 struct CPUWaterfall
@@ -97,6 +124,8 @@ struct CPUWaterfall
     CPUWaterfallUpdateRate update_interval;
     guint                size;
     CPUWaterfallMode       mode;
+    std::string          source_id;
+    std::string          source_options;
     std::string          command;
     xfce4::RGBA          colors[NUM_COLORS];
 
@@ -106,35 +135,98 @@ struct CPUWaterfall
     bool has_border:1;
     bool has_frame:1;
     bool has_average:1;
+    bool has_power:1;
+    bool has_temperature:1;    /* Tint the load colour of hot cores */
+    bool persist_history:1;    /* Keep the history in a file across restarts */
+    bool publish_samples:1;    /* In a shared-memory ring for other processes */
+    guint history_sync;        /* Seconds between the writes of the history file to disk, 0 to keep it in memory */
+    guint archive_hours;       /* Retention of the compressed full-resolution history, 0 for none */
+    guint recorder_size;       /* MiB of disk for the flight recorder, 0 not to record */
 
     /* Runtime data */
-    guint nr_cores;
-    guint timeout_id;
+    guint nr_cores;                 /* Rows of the source, not counting the aggregate row */
+    guint nr_band_separators;       /* Separators between the bands of the source */
+    History history;                /* Rows: nr_cores+1 */
+    bool repaint_history;           /* Redraw every column of the history, not just the newest one */
     struct {
-        gssize cap_pow2;            /* Capacity. A power of 2. */
-        gssize size;                /* size <= cap_pow2 */
-        gssize offset;              /* Circular buffer position. Range: from 0 to (cap_pow2 - 1) */
-        std::vector<CpuLoad*> data; /* Circular buffers */
-        gssize mask() const         { return cap_pow2 - 1; }
-    } history;
-    std::vector<CpuData> cpu_data;  /* size == nr_cores+1 */
+        /* See draw_waterfall(). Per instance, in the wrapper process of the instance. */
+        cairo_surface_t *surface;   /* One column per tick, NULL until the first draw */
+        cairo_pattern_t *pattern;   /* Repeats surface, shifted by x */
+        gint w, h;                  /* Of surface */
+        gint x;                     /* Column of the next tick */
+        bool has_level_colors;      /* level_colors is built from gradient */
+        xfce4::RGBA level_colors[HISTORY_LEVELS];
+        xfce4::RGBA gradient[NUM_GRADIENT_COLORS];
+    } canvas;
+    gint64 history_synced;          /* Monotonic time of the last write of the history file to disk */
+    FlightRecorder recorder;
+    RingPublisher publisher;
+    Ptr0<DataSource> source;        /* NULL until the first source has been opened */
+    std::string opened_id;          /* source_id and source_options of source, */
+    std::string opened_options;     /* while the latter may be still opening */
+    Ptr0<SourceSubscription> subscription;  /* Delivers the samples of source */
+    Ptr0<SourceSubscription> opening;       /* Replaces subscription once opened */
+    gint64 startup_time;            /* Monotonic, zero after the first sample */
+    std::vector<gfloat> frame;      /* Latest sample, size == nr_cores+1 */
+    std::vector<guint32> frame_ticks; /* The same as stored in the history */
+    std::vector<guint64> frame_used, frame_total;   /* Exact deltas of frame_ticks, see record_sample() */
     Ptr0<Topology> topology;
     CpuStats stats;
+    std::vector<guint8> cpu_flags;  /* Indexed by logical CPU, see CpuFlags */
+    Ptr0<PowerMeter> power;         /* Non-NULL if has_power and energy counters are readable */
+    Ptr0<Thermal> thermal;          /* Non-NULL if temperatures are shown and coretemp sensors exist */
+    BatchReader batch;              /* Reads of power and thermal */
+    Ptr0<RunDelay> run_delay;       /* Non-NULL in the run-queue latency mode if schedstat is readable */
+
+    /* Hover drill-down */
+    bool pointer_inside;
+    WaterfallStrip tooltip_strip;   /* Strip under the pointer */
+    TaskIndex tasks;
+
+    CpuGovernor governor;           /* CPU budget of the plugin */
 
     ~CPUWaterfall();
 
+    static void set_archive_hours        (const Ptr<CPUWaterfall> &base, guint hours);
     static void set_border               (const Ptr<CPUWaterfall> &base, bool border);
     static void set_color                (const Ptr<CPUWaterfall> &base, CPUWaterfallColorNumber number, const xfce4::RGBA &color);
+    static void set_cpu_budget           (const Ptr<CPUWaterfall> &base, guint budget);
     static void set_command              (const Ptr<CPUWaterfall> &base, const std::string &command);
     static void set_frame                (const Ptr<CPUWaterfall> &base, bool frame);
+    static void set_history_format       (const Ptr<CPUWaterfall> &base, HistoryFormat format);
+    static void set_history_sync         (const Ptr<CPUWaterfall> &base, guint seconds);
     static void set_in_terminal          (const Ptr<CPUWaterfall> &base, bool in_terminal);
     static void set_mode                 (const Ptr<CPUWaterfall> &base, CPUWaterfallMode mode);
+    static void set_persist_history      (const Ptr<CPUWaterfall> &base, bool persist);
+    static void set_publish_samples      (const Ptr<CPUWaterfall> &base, bool publish);
+    static void set_recorder_size        (const Ptr<CPUWaterfall> &base, guint mib);
+    static void set_source               (const Ptr<CPUWaterfall> &base, const std::string &id, const std::string &options);
     static void set_size                 (const Ptr<CPUWaterfall> &base, guint width);
     static void set_startup_notification (const Ptr<CPUWaterfall> &base, bool startup_notification);
     static void set_update_rate          (const Ptr<CPUWaterfall> &base, CPUWaterfallUpdateRate rate);
     static void set_average              (const Ptr<CPUWaterfall> &base, bool has_average );
+    static void set_power                (const Ptr<CPUWaterfall> &base, bool has_power);
+    static void set_temperature          (const Ptr<CPUWaterfall> &base, bool has_temperature);
 };
 
 guint get_update_interval_ms (CPUWaterfallUpdateRate rate);
 
+/* Reallocates the history if history_size does not fit, keeping the newest samples */
+void resize_history (const Ptr<CPUWaterfall> &base, gssize history_size);
+
+/* Shows a source opened by the caller, for tools without a main loop */
+void install_source (const Ptr<CPUWaterfall> &base, const Ptr0<DataSource> &source, const Ptr0<Topology> &topology);
+
+/* Prepends a frame of the source and its tick deltas to the history. used and total
+ * are the exact deltas for the recorder, NULL if the source has none. */
+void record_frame (const Ptr<CPUWaterfall> &base, const gfloat *frame, const guint32 *ticks,
+                   const guint64 *used, const guint64 *total);
+
+/* Samples the source directly, bypassing the shared sampler, and records the frame */
+bool record_sample (const Ptr<CPUWaterfall> &base);
+
+/* Ratio of the summed tick deltas of a row over its newest samples,
+ * from 0.0 to 1.0, or NAN if there are none */
+gfloat history_ratio (const Ptr<CPUWaterfall> &base, guint row, gssize samples);
+
 #endif /* _XFCE_CPUWATERFALL_CPU_H_ */
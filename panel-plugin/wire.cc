@@ -0,0 +1,212 @@
+/*  wire.cc
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <string.h>
+#include "wire.h"
+
+#define WIRE_MAGIC "CWF"
+
+
+
+void
+put_varint (std::string &out, guint64 v)
+{
+    while (v >= 0x80)
+    {
+        out += (gchar) (v | 0x80);
+        v >>= 7;
+    }
+    out += (gchar) v;
+}
+
+void
+put_svarint (std::string &out, gint64 v)
+{
+    put_varint (out, ((guint64) v << 1) ^ (guint64) (v >> 63));
+}
+
+bool
+get_varint (const guint8 *&p, const guint8 *end, guint64 &v)
+{
+    v = 0;
+    for (guint shift = 0; shift < 64; shift += 7)
+    {
+        if (G_UNLIKELY (p == end))
+            return false;
+        const guint8 b = *p++;
+        v |= (guint64) (b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool
+get_svarint (const guint8 *&p, const guint8 *end, gint64 &v)
+{
+    guint64 u;
+    if (!get_varint (p, end, u))
+        return false;
+    v = (gint64) (u >> 1) ^ -(gint64) (u & 1);
+    return true;
+}
+
+/* Prefixes a payload with its length */
+static void
+put_message (std::string &out, WireMessageType type, const std::string &payload)
+{
+    put_varint (out, payload.size() + 1);
+    out += (gchar) type;
+    out += payload;
+}
+
+
+
+void
+wire_encode_hello (std::string &out, const std::string &hostname, guint num_cpus)
+{
+    std::string payload = WIRE_MAGIC;
+    payload += (gchar) WIRE_VERSION;
+    put_varint (payload, num_cpus);
+    put_varint (payload, hostname.size());
+    payload += hostname;
+    put_message (out, WIRE_HELLO, payload);
+}
+
+void
+wire_encode_batch (std::string &out, const std::vector<WireTick> &ticks)
+{
+    if (ticks.empty())
+        return;
+
+    const size_t num_rows = ticks[0].load.size();
+    std::string payload;
+    payload.reserve (4 + ticks.size() * (2 + num_rows));
+
+    put_varint (payload, ticks.size());
+    put_varint (payload, num_rows);
+    for (size_t t = 0; t < ticks.size(); t++)
+    {
+        put_varint (payload, ticks[t].interval_ms);
+        for (size_t row = 0; row < num_rows; row++)
+        {
+            const gint previous = t == 0 ? 0 : ticks[t-1].load[row];
+            put_svarint (payload, (gint) ticks[t].load[row] - previous);
+        }
+    }
+    put_message (out, WIRE_BATCH, payload);
+}
+
+
+
+void
+WireDecoder::feed (const gchar *data, size_t size)
+{
+    /* Drop the consumed part before the buffer grows */
+    if (pos > 0 && pos == buffer.size())
+    {
+        buffer.clear();
+        pos = 0;
+    }
+    else if (pos > 4096 && pos > buffer.size() / 2)
+    {
+        buffer.erase (0, pos);
+        pos = 0;
+    }
+    buffer.append (data, size);
+}
+
+gint
+WireDecoder::next (WireMessage &message)
+{
+    const guint8 *p = (const guint8*) buffer.data() + pos;
+    const guint8 *end = (const guint8*) buffer.data() + buffer.size();
+
+    guint64 length;
+    if (!get_varint (p, end, length))
+        return end - p >= 10 ? -1 : 0;
+    if (length == 0 || length > WIRE_MAX_MESSAGE)
+        return -1;
+    if ((guint64) (end - p) < length)
+        return 0;
+
+    end = p + length;
+    const guint8 type = *p++;
+
+    switch (type)
+    {
+        case WIRE_HELLO:
+        {
+            guint64 cpus, name_length;
+            if (end - p < 4 || memcmp (p, WIRE_MAGIC, 3) != 0 || p[3] != WIRE_VERSION)
+                return -1;
+            p += 4;
+            if (!get_varint (p, end, cpus) || cpus == 0 || cpus > G_MAXUINT16 ||
+                !get_varint (p, end, name_length) || name_length > (guint64) (end - p))
+            {
+                return -1;
+            }
+            message.type = WIRE_HELLO;
+            message.num_cpus = num_cpus = cpus;
+            message.hostname.assign ((const gchar*) p, name_length);
+            break;
+        }
+
+        case WIRE_BATCH:
+        {
+            /* Bounded before allocating: a tick takes at least 1 + num_rows bytes */
+            guint64 num_ticks, num_rows;
+            if (!get_varint (p, end, num_ticks) || !get_varint (p, end, num_rows) ||
+                num_cpus == 0 || num_rows != num_cpus + 1 ||
+                num_ticks > (guint64) (end - p) / (1 + num_rows))
+            {
+                return -1;
+            }
+            message.type = WIRE_BATCH;
+            message.ticks.resize (num_ticks);
+            for (guint64 t = 0; t < num_ticks; t++)
+            {
+                WireTick &tick = message.ticks[t];
+                guint64 interval;
+                if (!get_varint (p, end, interval))
+                    return -1;
+                tick.interval_ms = interval;
+                tick.load.resize (num_rows);
+                for (guint64 row = 0; row < num_rows; row++)
+                {
+                    gint64 delta;
+                    if (!get_svarint (p, end, delta))
+                        return -1;
+                    const gint64 load = (t == 0 ? 0 : message.ticks[t-1].load[row]) + delta;
+                    if (load < 0 || load > WIRE_SCALE)
+                        return -1;
+                    tick.load[row] = load;
+                }
+            }
+            break;
+        }
+
+        default:
+            /* Unknown messages are skipped, newer collectors may send them */
+            message.type = (WireMessageType) type;
+            break;
+    }
+
+    pos = end - (const guint8*) buffer.data();
+    return 1;
+}
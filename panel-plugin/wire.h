@@ -0,0 +1,96 @@
+/*  wire.h
+ *  Part of xfce4-cpuwaterfall-plugin
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+#ifndef _XFCE_CPUWATERFALL_WIRE_H_
+#define _XFCE_CPUWATERFALL_WIRE_H_
+
+/*
+ * Stream format between cpuwaterfall-collector and the remote source.
+ *
+ * Every message is: varint length, type byte, payload (length counts the
+ * type byte). Integers are LEB128 varints, signed ones are zigzag encoded.
+ *
+ *   WIRE_HELLO, sent once after accepting a connection:
+ *     "CWF", version byte, varint num_cpus, varint length, hostname
+ *
+ *   WIRE_BATCH, sent every few ticks:
+ *     varint num_ticks, varint num_rows (num_cpus + 1, row 0 is the average),
+ *     then per tick: varint interval in milliseconds, and per row the
+ *     difference between its load in permille and the row's load in the
+ *     previous tick of the batch (0 for the first tick).
+ *
+ * Every batch is self-contained, so a client can start with any of them.
+ */
+
+#include <glib.h>
+#include <string>
+#include <vector>
+
+#define WIRE_VERSION 1
+#define WIRE_DEFAULT_PORT 7634
+#define WIRE_MAX_MESSAGE (4 << 20)
+#define WIRE_SCALE 1000     /* Loads are sent in permille */
+
+enum WireMessageType
+{
+    WIRE_HELLO = 1,
+    WIRE_BATCH = 2,
+};
+
+struct WireTick
+{
+    guint interval_ms;
+    std::vector<guint16> load;  /* Permille, size == num_cpus + 1 */
+};
+
+struct WireMessage
+{
+    WireMessageType type;
+
+    /* WIRE_HELLO */
+    std::string hostname;
+    guint num_cpus;
+
+    /* WIRE_BATCH */
+    std::vector<WireTick> ticks;
+};
+
+/* LEB128 varints, also used by the recordings, see recorder.cc. The readers advance p
+ * and return false at the end of the data or on a varint of more than 64 bits. */
+void put_varint (std::string &out, guint64 v);
+void put_svarint (std::string &out, gint64 v);
+bool get_varint (const guint8 *&p, const guint8 *end, guint64 &v);
+bool get_svarint (const guint8 *&p, const guint8 *end, gint64 &v);
+
+void wire_encode_hello (std::string &out, const std::string &hostname, guint num_cpus);
+void wire_encode_batch (std::string &out, const std::vector<WireTick> &ticks);
+
+/* Accumulates received bytes and splits them into messages */
+struct WireDecoder
+{
+    std::string buffer;
+    size_t pos = 0;
+    guint num_cpus = 0;         /* From the hello, batches must have num_cpus + 1 rows */
+
+    void feed (const gchar *data, size_t size);
+
+    /* Returns 1 if a message was decoded, 0 if more data is needed, -1 if the stream is corrupt.
+     * A batch before the hello, or with other rows than the hello announced, is corrupt. */
+    gint next (WireMessage &message);
+};
+
+#endif /* _XFCE_CPUWATERFALL_WIRE_H_ */
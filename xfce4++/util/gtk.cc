@@ -262,6 +262,28 @@ void invoke_later(const std::function<void()> &task) {
 
 
 
+struct ThreadData {
+    std::function<void()> task, done;
+
+    static gpointer run(gpointer data) {
+        auto t = (ThreadData*)data;
+        t->task();
+        /* g_timeout_add_full() may be called from any thread */
+        invoke_later([t]() {
+            t->done();
+            delete t;
+        });
+        return NULL;
+    }
+};
+
+void run_in_thread(const std::function<void()> &task, const std::function<void()> &done) {
+    auto data = new ThreadData{task, done};
+    g_thread_unref(g_thread_new("xfce4-worker", ThreadData::run, data));
+}
+
+
+
 struct TimeoutHandlerData {
     static const uint32_t MAGIC = 0x99F67650;
     const uint32_t magic = MAGIC;
@@ -141,6 +141,12 @@ void connect_size_changed    (XfcePanelPlugin *plugin, const std::function<SizeC
 
 void invoke_later(const std::function<void()> &task);
 
+/*
+ * Runs task in a new thread, then done in the main loop once the task has finished.
+ * Both functions are destroyed in the main loop.
+ */
+void run_in_thread(const std::function<void()> &task, const std::function<void()> &done);
+
 typedef TimeoutResponse TimeoutHandler();
 
 guint timeout_add(guint interval_ms, const std::function<TimeoutHandler> &handler);
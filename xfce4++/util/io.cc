@@ -20,18 +20,25 @@
 
 #include "io.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
+#include <unistd.h>
 
 namespace xfce4 {
 
+/* Enough for nearly any file in /sys */
+static const size_t MIN_READ_BUFFER_SIZE = 4096;
+
 bool is_directory(const std::string &path) {
     return g_file_test(path.c_str(), G_FILE_TEST_IS_DIR);
 }
 
 bool read_file(const std::string &path, std::string &data) {
     gchar *contents = NULL;
-    if(g_file_get_contents(path.c_str(), &contents, NULL, NULL)) {
-        data = *contents;
+    gsize length = 0;
+    if(g_file_get_contents(path.c_str(), &contents, &length, NULL)) {
+        data.assign(contents, length);
         g_free(contents);
         return true;
     }
@@ -40,4 +47,50 @@ bool read_file(const std::string &path, std::string &data) {
     }
 }
 
+static bool read_fd(int fd, ReadBuffer &buf, bool from_start) {
+    if(buf.data.size() < MIN_READ_BUFFER_SIZE)
+        buf.data.resize(MIN_READ_BUFFER_SIZE);
+
+    size_t length = 0;
+    while(true) {
+        /* Leave room for the terminating '\0' */
+        const size_t space = buf.data.size() - 1 - length;
+        const ssize_t n = from_start ? pread(fd, &buf.data[length], space, length) : read(fd, &buf.data[length], space);
+        if(n < 0) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+
+        if(n == 0)
+            break;
+
+        length += n;
+        if(size_t(n) == space)
+            buf.data.resize(2 * buf.data.size());
+    }
+
+    buf.data[length] = '\0';
+    buf.length = length;
+    return true;
+}
+
+bool read_file(const char *path, ReadBuffer &buf) {
+    return read_file_at(AT_FDCWD, path, buf);
+}
+
+bool read_file_at(int dir_fd, const char *path, ReadBuffer &buf) {
+    const int fd = openat(dir_fd, path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+        return false;
+
+    const bool ok = read_fd(fd, buf, false);
+    close(fd);
+    return ok;
+}
+
+bool reread_file(int fd, ReadBuffer &buf) {
+    return read_fd(fd, buf, true);
+}
+
 } /* namespace xfce4 */
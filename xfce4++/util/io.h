@@ -22,12 +22,34 @@
 #define _XFCE4PP_UTIL_IO_H_
 
 #include <string>
+#include <vector>
 
 namespace xfce4 {
 
+/*
+ * A caller-owned buffer for reading small files, such as those in /proc and /sys.
+ * It grows to fit the largest file read into it and is then reused,
+ * so that reading the same files again does not allocate memory.
+ */
+struct ReadBuffer {
+    std::vector<char> data;  /* The contents followed by '\0', empty before the first read */
+    size_t length = 0;       /* Of the contents, not counting the '\0' */
+
+    /* Valid after a successful read */
+    char       *c_str()       { return data.data(); }
+    const char *c_str() const { return data.data(); }
+};
+
 bool is_directory(const std::string &path);
 bool read_file   (const std::string &path, std::string &data);
 
+/* Read a whole file into buf, from path or from path relative to the directory dir_fd */
+bool read_file   (const char *path, ReadBuffer &buf);
+bool read_file_at(int dir_fd, const char *path, ReadBuffer &buf);
+
+/* Reads the file again from its start, for descriptors which are kept open between reads */
+bool reread_file (int fd, ReadBuffer &buf);
+
 } /* namespace xfce4 */
 
 #endif /* _XFCE4PP_UTIL_IO_H_ */